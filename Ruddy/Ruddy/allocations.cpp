@@ -0,0 +1,12 @@
+#include "allocations.hpp"
+
+bool countingAllocations = false;
+std::atomic<uint64_t> allocationsMade(0);
+std::atomic<uint64_t> bytesAllocated(0);
+
+AllocationCount allocationsSoFar() {
+    AllocationCount soFar;
+    soFar.allocations = allocationsMade.load(std::memory_order_relaxed);
+    soFar.bytes = bytesAllocated.load(std::memory_order_relaxed);
+    return soFar;
+}
@@ -0,0 +1,43 @@
+#ifndef allocations_hpp
+#define allocations_hpp
+
+#include <stdio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// --- Allocation counting
+// how many times operator new has been called and for how many bytes, for
+// the whole process. the library never counts anything itself: a program
+// that wants the numbers replaces operator new with one that calls
+// countAllocation() and turns countingAllocations on before it starts any
+// threads (the Ruddy tool does both for --stats, see hooks.cpp). the
+// counters are relaxed atomics, so tasks on other threads are counted too,
+// and while counting is off an allocation only pays for reading a bool
+struct AllocationCount {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+inline AllocationCount operator-(AllocationCount later, AllocationCount earlier) {
+    AllocationCount made;
+    made.allocations = later.allocations - earlier.allocations;
+    made.bytes = later.bytes - earlier.bytes;
+    return made;
+}
+
+extern bool countingAllocations;
+extern std::atomic<uint64_t> allocationsMade;
+extern std::atomic<uint64_t> bytesAllocated;
+
+inline void countAllocation(size_t bytes) {
+    if (!countingAllocations) { return; }
+    allocationsMade.fetch_add(1, std::memory_order_relaxed);
+    bytesAllocated.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// the totals so far, take one before and one after something and subtract
+AllocationCount allocationsSoFar();
+
+#endif /* allocations_hpp */
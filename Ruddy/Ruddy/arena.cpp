@@ -0,0 +1,49 @@
+#include "arena.hpp"
+
+#include <cstring>
+
+Arena::~Arena() {
+    for (const std::pair<char*, size_t>& block : blocks) {
+        ::operator delete(block.first);
+    }
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t) (align - 1);
+    if (cursor == nullptr || aligned + size > reinterpret_cast<uintptr_t>(limit)) {
+        // oversized requests get a block of their own
+        size_t newBlockSize = size + align > blockSize ? size + align : blockSize;
+        char* block = static_cast<char*>(::operator new(newBlockSize));
+        blocks.push_back({block, newBlockSize});
+        cursor = block;
+        limit = block + newBlockSize;
+        aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t) (align - 1);
+    }
+
+    cursor = reinterpret_cast<char*>(aligned + size);
+    used += size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+std::string_view Arena::copy(std::string_view s) {
+    if (s.empty()) { return std::string_view(); }
+    char* copied = static_cast<char*>(allocate(s.size(), 1));
+    std::memcpy(copied, s.data(), s.size());
+    return std::string_view(copied, s.size());
+}
+
+void Arena::adopt(Arena& other) {
+    blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+    used += other.used;
+    other.blocks.clear();
+    other.cursor = other.limit = nullptr;
+    other.used = 0;
+}
+
+size_t Arena::bytesReserved() const {
+    size_t reserved = 0;
+    for (const std::pair<char*, size_t>& block : blocks) {
+        reserved += block.second;
+    }
+    return reserved;
+}
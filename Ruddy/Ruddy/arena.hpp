@@ -0,0 +1,81 @@
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <stdio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// a run of T laid out contiguously in an arena. doesn't own anything
+template <typename T>
+struct Span {
+    T* items;
+    uint32_t count;
+
+    Span() : items(nullptr), count(0) {}
+    Span(T* items, uint32_t count) : items(items), count(count) {}
+
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t idx) const { return items[idx]; }
+    T& back() const { return items[count - 1]; }
+};
+
+// --- Arena
+// bump allocator for everything that lives as long as a parsed program (the
+// AST, its strings and child lists). nothing is freed individually, the
+// whole lot goes at once when the arena is destroyed
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize(blockSize), cursor(nullptr), limit(nullptr), used(0) {}
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+
+    // only for types with nothing to destroy, since destructors never run
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    Span<T> copy(const std::vector<T>& items) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        if (items.empty()) { return Span<T>(); }
+        T* copied = static_cast<T*>(allocate(sizeof(T) * items.size(), alignof(T)));
+        for (size_t idx = 0; idx < items.size(); idx++) {
+            new (copied + idx) T(items[idx]);
+        }
+        return Span<T>(copied, (uint32_t) items.size());
+    }
+
+    std::string_view copy(std::string_view s);
+
+    // takes over everything other has allocated, which stays where it is.
+    // other is left empty
+    void adopt(Arena& other);
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const;
+
+private:
+    size_t blockSize;
+    char* cursor;
+    char* limit;
+    size_t used;
+    std::vector<std::pair<char*, size_t>> blocks;
+};
+
+#endif /* arena_hpp */
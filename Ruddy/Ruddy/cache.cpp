@@ -0,0 +1,564 @@
+#include "cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "version.hpp"
+
+namespace {
+
+const char cacheMagic[4] = {'R', 'D', 'C', '2'};
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t functionCount;
+    uint64_t buildHash; // interpreter version + node layout, see buildHash()
+    uint64_t sourceHash;
+    uint64_t bodyHash;  // of everything after the header
+    uint64_t fileSize;
+    uint64_t functionsOffset;
+    uint64_t slotsOffset;
+    uint32_t slotCount;
+    uint32_t options;
+};
+
+struct CachedFunction {
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    Span<std::string_view> params;
+    ExpressionBlock body;
+};
+
+struct CachedSlot {
+    uint64_t nameOffset;
+    uint32_t nameLength;
+};
+
+uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashBytes(std::string_view bytes, uint64_t seed) {
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = seed ^ (bytes.size() * multiplier);
+    size_t idx = 0;
+    for (; idx + 8 <= bytes.size(); idx += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + idx, 8);
+        h = (h ^ mix(word)) * multiplier;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + idx, bytes.size() - idx);
+    return mix(h ^ mix(tail ^ (bytes.size() - idx)));
+}
+
+// the file holds raw node structs, so it's only valid for a binary that lays
+// them out the same way
+uint64_t buildHash() {
+    const uint64_t layout[] = {
+        sizeof(void*), sizeof(std::string_view), sizeof(ExpressionLine), sizeof(Symbol),
+        sizeof(ValueExpression), sizeof(BinaryExpression), sizeof(ListExpression),
+        sizeof(StringExpression), sizeof(IntExpression), sizeof(VarExpression), sizeof(IfExpression),
+        sizeof(ForExpression), sizeof(WhileExpression), sizeof(CallExpression), sizeof(FunctionDefinition),
+        (uint64_t) ExpressionType::STR_CONCAT, (uint64_t) TokenType::NUMBER, 0x0102030405060708ULL,
+    };
+    return hashBytes(std::string_view(reinterpret_cast<const char*>(layout), sizeof(layout)), hashBytes(RUDDY_VERSION, 0));
+}
+
+// --- Writer
+// children go in before their parents so every pointer can be swapped for the
+// offset of something that's already been written. offset 0 is the header, so
+// a null pointer stays null
+class CacheWriter {
+public:
+    CacheWriter() : bytes(sizeof(CacheHeader), 0) {}
+
+    std::vector<char> bytes;
+    std::map<const FunctionDefinition*, uint64_t> functionIds;
+
+    uint64_t reserve(size_t size, size_t align) {
+        uint64_t offset = (bytes.size() + align - 1) & ~(uint64_t) (align - 1);
+        bytes.resize(offset + size, 0);
+        return offset;
+    }
+
+    template <typename T>
+    uint64_t append(const T& value) {
+        uint64_t offset = reserve(sizeof(T), alignof(T));
+        std::memcpy(bytes.data() + offset, &value, sizeof(T));
+        return offset;
+    }
+
+    template <typename T>
+    static T* asPointer(uint64_t offset) { return reinterpret_cast<T*>((uintptr_t) offset); }
+
+    uint64_t appendChars(std::string_view s) {
+        uint64_t offset = reserve(s.size(), 1);
+        if (!s.empty()) { std::memcpy(bytes.data() + offset, s.data(), s.size()); }
+        return offset;
+    }
+
+    std::string_view appendString(std::string_view s) {
+        if (s.empty()) { return std::string_view(); }
+        return std::string_view(asPointer<const char>(appendChars(s)), s.size());
+    }
+
+    Expression* appendExpression(const Expression* expression) {
+        switch(expression->expressionType) {
+            case ExpressionType::VALUE: {
+                // symbols are only good for this process, the loader re-interns
+                // the payload. calls are stored as 1 + the callee's index in the table
+                ValueExpression node = *expression->as<ValueExpression>();
+                node.symbol = NO_SYMBOL;
+                node.cacheVersion = 0;
+                node.literal = NO_LITERAL;
+                node.payload = appendString(node.payload);
+                node.function = node.function ? asPointer<const FunctionDefinition>(functionIds.at(node.function) + 1) : nullptr;
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::STRING: {
+                StringExpression node = *expression->as<StringExpression>();
+                node.payload = appendString(node.payload);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::INT: {
+                return asPointer<Expression>(append(*expression->as<IntExpression>()));
+            }
+            case ExpressionType::JOIN: {
+                return asPointer<Expression>(append(*expression));
+            }
+            case ExpressionType::PAREN:
+            case ExpressionType::PRINT:
+            case ExpressionType::RETURN: {
+                ListExpression node = *expression->as<ListExpression>();
+                node.core = appendLine(node.core);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::VAR: {
+                VarExpression node = *expression->as<VarExpression>();
+                node.var = static_cast<ValueExpression*>(appendExpression(node.var));
+                node.core = appendLine(node.core);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::IF: {
+                IfExpression node = *expression->as<IfExpression>();
+                node.conditional = node.conditional ? appendExpression(node.conditional) : nullptr;
+                node.ifStatements = appendBlock(node.ifStatements);
+                node.elseStatements = appendBlock(node.elseStatements);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::FOR: {
+                ForExpression node = *expression->as<ForExpression>();
+                node.var = static_cast<ValueExpression*>(appendExpression(node.var));
+                node.from = appendExpression(node.from);
+                node.limit = appendExpression(node.limit);
+                node.body = appendBlock(node.body);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::WHILE: {
+                WhileExpression node = *expression->as<WhileExpression>();
+                node.conditional = appendExpression(node.conditional);
+                node.body = appendBlock(node.body);
+                return asPointer<Expression>(append(node));
+            }
+            case ExpressionType::CALL:
+            case ExpressionType::SPAWN: {
+                CallExpression node = *expression->as<CallExpression>();
+                node.callee = static_cast<ValueExpression*>(appendExpression(node.callee));
+                node.args = appendLine(node.args);
+                return asPointer<Expression>(append(node));
+            }
+            default: {
+                BinaryExpression node = *expression->as<BinaryExpression>();
+                node.left = appendExpression(node.left);
+                node.right = appendExpression(node.right);
+                return asPointer<Expression>(append(node));
+            }
+        }
+    }
+
+    ExpressionLine appendLine(const ExpressionLine& expressionLine) {
+        if (expressionLine.empty()) { return ExpressionLine(); }
+        std::vector<Expression*> items;
+        items.reserve(expressionLine.size());
+        for (const Expression* expression : expressionLine) {
+            items.push_back(appendExpression(expression));
+        }
+        return ExpressionLine(asPointer<Expression*>(appendArray(items)), expressionLine.size());
+    }
+
+    ExpressionBlock appendBlock(const ExpressionBlock& expressions) {
+        if (expressions.empty()) { return ExpressionBlock(); }
+        std::vector<ExpressionLine> lines;
+        lines.reserve(expressions.size());
+        for (const ExpressionLine& expressionLine : expressions) {
+            lines.push_back(appendLine(expressionLine));
+        }
+        return ExpressionBlock(asPointer<ExpressionLine>(appendArray(lines)), expressions.size());
+    }
+
+    Span<std::string_view> appendParams(const Span<std::string_view>& params) {
+        if (params.empty()) { return Span<std::string_view>(); }
+        std::vector<std::string_view> names;
+        names.reserve(params.size());
+        for (std::string_view param : params) {
+            names.push_back(appendString(param));
+        }
+        return Span<std::string_view>(asPointer<std::string_view>(appendArray(names)), params.size());
+    }
+
+    template <typename T>
+    uint64_t appendArray(const std::vector<T>& items) {
+        uint64_t offset = reserve(sizeof(T) * items.size(), alignof(T));
+        std::memcpy(bytes.data() + offset, items.data(), sizeof(T) * items.size());
+        return offset;
+    }
+};
+
+// --- Loader
+// turns offsets back into pointers in place. every offset is checked against
+// the file, every node against its type's size and alignment and every slot
+// and call against what it indexes, so a damaged cache is rejected instead
+// of followed. the body hash catches nearly all damage before any of this
+// runs, these checks are what keeps a file that gets past it from reaching
+// the backends
+class Relocator {
+public:
+    Relocator(char* base, size_t size, uint32_t slotCount) : base(base), size(size), slotCount(slotCount), paramCount(0), visited(size / 4 + 1, false) {}
+
+    // the function whose body is relocated next, what its parameter slots are checked against
+    void enterFunction(uint32_t params) { paramCount = params; }
+
+    template <typename T>
+    bool relocate(T*& pointer, size_t count) {
+        uintptr_t offset = reinterpret_cast<uintptr_t>(pointer);
+        if (offset == 0) { return count == 0; }
+        if (offset % alignof(T) != 0 || offset > size || count > (size - offset) / sizeof(T)) { return false; }
+        pointer = reinterpret_cast<T*>(base + offset);
+        return true;
+    }
+
+    bool relocateString(std::string_view& s) {
+        const char* data = s.data();
+        if (!relocate(data, s.size())) { return false; }
+        s = std::string_view(data, s.size());
+        return true;
+    }
+
+    bool relocateExpression(Expression*& expression) {
+        // the smallest node is enough to read the kind, the full size and
+        // alignment are checked below
+        if (!relocateOnce(expression, 1)) { return false; }
+        if (expression->expressionType > ExpressionType::STR_CONCAT || !validSlot(expression)) { return false; }
+        switch(expression->expressionType) {
+            case ExpressionType::VALUE: {
+                if (!fits<ValueExpression>(expression)) { return false; }
+                ValueExpression* value = expression->as<ValueExpression>();
+                if (!relocateString(value->payload)) { return false; }
+                value->symbol = symbols.intern(value->payload);
+                value->cacheVersion = 0;
+                value->binding = NameBinding::SLOT;
+                value->literal = NO_LITERAL;
+                if (value->function != nullptr) { calls.push_back(value); }
+                return true;
+            }
+            case ExpressionType::STRING: {
+                if (!fits<StringExpression>(expression)) { return false; }
+                return relocateString(expression->as<StringExpression>()->payload);
+            }
+            case ExpressionType::INT: {
+                return fits<IntExpression>(expression);
+            }
+            case ExpressionType::JOIN: {
+                return fits<Expression>(expression);
+            }
+            case ExpressionType::PAREN:
+            case ExpressionType::PRINT:
+            case ExpressionType::RETURN: {
+                if (!fits<ListExpression>(expression)) { return false; }
+                return relocateLine(expression->as<ListExpression>()->core);
+            }
+            case ExpressionType::VAR: {
+                // an assignment always has somewhere to go
+                if (!fits<VarExpression>(expression) || expression->slot < 0) { return false; }
+                VarExpression* varExpr = expression->as<VarExpression>();
+                Expression* var = varExpr->var;
+                if (!relocateExpression(var) || var->expressionType != ExpressionType::VALUE) { return false; }
+                varExpr->var = var->as<ValueExpression>();
+                return relocateLine(varExpr->core);
+            }
+            case ExpressionType::IF: {
+                if (!fits<IfExpression>(expression)) { return false; }
+                IfExpression* ifExpr = expression->as<IfExpression>();
+                if (ifExpr->conditional && !relocateExpression(ifExpr->conditional)) { return false; }
+                return relocateBlock(ifExpr->ifStatements) && relocateBlock(ifExpr->elseStatements);
+            }
+            case ExpressionType::FOR: {
+                if (!fits<ForExpression>(expression) || expression->slot < 0) { return false; }
+                ForExpression* forExpr = expression->as<ForExpression>();
+                Expression* var = forExpr->var;
+                if (!relocateExpression(var) || var->expressionType != ExpressionType::VALUE) { return false; }
+                forExpr->var = var->as<ValueExpression>();
+                return relocateExpression(forExpr->from) && relocateExpression(forExpr->limit) && relocateBlock(forExpr->body);
+            }
+            case ExpressionType::WHILE: {
+                if (!fits<WhileExpression>(expression)) { return false; }
+                WhileExpression* whileExpr = expression->as<WhileExpression>();
+                return relocateExpression(whileExpr->conditional) && relocateBlock(whileExpr->body);
+            }
+            case ExpressionType::CALL:
+            case ExpressionType::SPAWN: {
+                if (!fits<CallExpression>(expression)) { return false; }
+                CallExpression* callExpr = expression->as<CallExpression>();
+                Expression* callee = callExpr->callee;
+                if (!relocateExpression(callee) || callee->expressionType != ExpressionType::VALUE) { return false; }
+                callExpr->callee = callee->as<ValueExpression>();
+                // the parser only lets a spawn through if it names a function
+                if (expression->expressionType == ExpressionType::SPAWN && callExpr->callee->function == nullptr) { return false; }
+                return relocateLine(callExpr->args);
+            }
+            default: {
+                if (!fits<BinaryExpression>(expression)) { return false; }
+                BinaryExpression* binaryExpr = expression->as<BinaryExpression>();
+                return relocateExpression(binaryExpr->left) && relocateExpression(binaryExpr->right);
+            }
+        }
+    }
+
+    bool relocateLine(ExpressionLine& expressionLine) {
+        if (!relocateOnce(expressionLine.items, expressionLine.count)) { return false; }
+        for (Expression*& expression : expressionLine) {
+            if (!relocateExpression(expression)) { return false; }
+        }
+        return true;
+    }
+
+    bool relocateBlock(ExpressionBlock& expressions) {
+        if (!relocateOnce(expressions.items, expressions.count)) { return false; }
+        for (ExpressionLine& expressionLine : expressions) {
+            if (!relocateLine(expressionLine)) { return false; }
+        }
+        return true;
+    }
+
+    bool relocateParams(Span<std::string_view>& params) {
+        if (!relocateOnce(params.items, params.count)) { return false; }
+        for (std::string_view& param : params) {
+            if (!relocateString(param)) { return false; }
+        }
+        return true;
+    }
+
+    // calls can only be pointed at their functions once every function is
+    // loaded. the compiler finds a callee by its name, so the name has to be
+    // the one of the function it's linked to
+    bool linkCalls(const std::vector<const std::pair<const std::string, FunctionDefinition>*>& definitions) {
+        for (ValueExpression* value : calls) {
+            uintptr_t functionId = reinterpret_cast<uintptr_t>(value->function);
+            if (functionId == 0 || functionId > definitions.size() || definitions[functionId - 1]->first != value->payload) { return false; }
+            value->function = &definitions[functionId - 1]->second;
+        }
+        return true;
+    }
+
+    bool name(uint64_t offset, uint32_t length, std::string& out) {
+        if (offset > size || length > size - offset) { return false; }
+        out.assign(base + offset, length);
+        return true;
+    }
+
+private:
+    // relocate() for what gets rewritten in place. the writer never shares a
+    // node or an array between two parents, and one reached twice (or from
+    // inside itself) would be relocated twice
+    template <typename T>
+    bool relocateOnce(T*& pointer, size_t count) {
+        uintptr_t offset = reinterpret_cast<uintptr_t>(pointer);
+        if (!relocate(pointer, count)) { return false; }
+        if (offset == 0) { return true; }
+        if (visited[offset / 4]) { return false; }
+        visited[offset / 4] = true;
+        return true;
+    }
+
+    template <typename T>
+    bool fits(const Expression* expression) const {
+        ptrdiff_t offset = reinterpret_cast<const char*>(expression) - base;
+        return offset % alignof(T) == 0 && offset <= (ptrdiff_t) (size - sizeof(T));
+    }
+
+    // a parameter of the function being loaded, a global, or -1 for a name
+    // nothing assigns. local is read as a byte, anything but 0 or 1 isn't a bool
+    bool validSlot(const Expression* expression) const {
+        uint8_t local;
+        std::memcpy(&local, &expression->local, 1);
+        if (local > 1) { return false; }
+        if (local == 1) { return expression->slot >= 0 && (uint32_t) expression->slot < paramCount; }
+        return expression->slot >= -1 && expression->slot < (int64_t) slotCount;
+    }
+
+    char* base;
+    size_t size;
+    uint32_t slotCount;
+    uint32_t paramCount;
+    std::vector<bool> visited; // by offset / 4, every node and array is at least 4-aligned
+    std::vector<ValueExpression*> calls;
+    SymbolCache symbols;
+};
+
+} // namespace
+
+uint64_t hashSource(std::string_view source) {
+    return hashBytes(source, 0);
+}
+
+std::string cachePathFor(const std::string& inputPath, const std::string& cacheDir) {
+    if (cacheDir.empty()) { return inputPath + "c"; }
+    size_t slash = inputPath.find_last_of('/');
+    std::string fileName = slash == std::string::npos ? inputPath : inputPath.substr(slash + 1);
+    return cacheDir + (cacheDir.back() == '/' ? "" : "/") + fileName + "c";
+}
+
+ProgramCache::~ProgramCache() {
+    if (mapped) { munmap(mapped, mappedSize); }
+}
+
+bool ProgramCache::load(const std::string& path, uint64_t sourceHash, uint32_t options, FunctionTable& funcExpressions, SlotTable& slots) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // private and writable: relocation rewrites the offsets in this process's
+    // copy of the pages, the file itself is never touched. every page gets
+    // written, so fault them all in up front where the platform allows it
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    void* addr = mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) { return false; }
+    mapped = static_cast<char*>(addr);
+    mappedSize = (size_t) st.st_size;
+
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mapped);
+    if (std::memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 || header->buildHash != buildHash() || header->sourceHash != sourceHash || header->options != options || header->fileSize != mappedSize) {
+        return false;
+    }
+    std::string_view body(mapped + sizeof(CacheHeader), mappedSize - sizeof(CacheHeader));
+    if (header->bodyHash != hashBytes(body, header->sourceHash)) {
+        return false;
+    }
+
+    Relocator relocator(mapped, mappedSize, header->slotCount);
+    CachedFunction* functions = reinterpret_cast<CachedFunction*>((uintptr_t) header->functionsOffset);
+    CachedSlot* slotEntries = reinterpret_cast<CachedSlot*>((uintptr_t) header->slotsOffset);
+    if (!relocator.relocate(functions, header->functionCount) || !relocator.relocate(slotEntries, header->slotCount)) {
+        return false;
+    }
+
+    FunctionTable loadedFunctions;
+    for (uint32_t idx = 0; idx < header->functionCount; idx++) {
+        std::string name;
+        if (!relocator.name(functions[idx].nameOffset, functions[idx].nameLength, name) || !relocator.relocateParams(functions[idx].params)) {
+            return false;
+        }
+        relocator.enterFunction(functions[idx].params.size());
+        if (!relocator.relocateBlock(functions[idx].body)) {
+            return false;
+        }
+        loadedFunctions[name] = {functions[idx].params, functions[idx].body};
+    }
+    // the writer walked the table in the same (sorted) order
+    std::vector<const std::pair<const std::string, FunctionDefinition>*> definitions;
+    for (const std::pair<const std::string, FunctionDefinition>& function : loadedFunctions) {
+        definitions.push_back(&function);
+    }
+    if (definitions.size() != header->functionCount || !relocator.linkCalls(definitions)) { return false; }
+
+    SlotTable loadedSlots;
+    for (uint32_t idx = 0; idx < header->slotCount; idx++) {
+        std::string name;
+        if (!relocator.name(slotEntries[idx].nameOffset, slotEntries[idx].nameLength, name)) { return false; }
+        Symbol symbol = symbolTable.intern(name);
+        // two slots for one name and only the second could ever be found
+        if (loadedSlots.slotOf(symbol) >= 0) { return false; }
+        loadedSlots.add(symbol, name);
+    }
+
+    // swap rather than move-assign, so the definitions calls point at stay where they are
+    funcExpressions.swap(loadedFunctions);
+    slots = std::move(loadedSlots);
+    return true;
+}
+
+bool writeProgramCache(const std::string& path, uint64_t sourceHash, uint32_t options, const FunctionTable& funcExpressions, const SlotTable& slots) {
+    CacheWriter writer;
+    uint64_t functionId = 0;
+    for (const std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        writer.functionIds[&function.second] = functionId++;
+    }
+
+    std::vector<CachedFunction> functions;
+    for (const std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        CachedFunction entry;
+        entry.params = writer.appendParams(function.second.params);
+        entry.body = writer.appendBlock(function.second.body);
+        entry.nameLength = (uint32_t) function.first.size();
+        entry.nameOffset = writer.appendChars(function.first);
+        functions.push_back(entry);
+    }
+
+    std::vector<CachedSlot> slotEntries;
+    for (const std::string& slotName : slots.slotNames) {
+        CachedSlot entry;
+        entry.nameLength = (uint32_t) slotName.size();
+        entry.nameOffset = writer.appendChars(slotName);
+        slotEntries.push_back(entry);
+    }
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.functionCount = (uint32_t) functions.size();
+    header.functionsOffset = functions.empty() ? 0 : writer.appendArray(functions);
+    header.slotCount = (uint32_t) slotEntries.size();
+    header.slotsOffset = slotEntries.empty() ? 0 : writer.appendArray(slotEntries);
+    header.buildHash = buildHash();
+    header.sourceHash = sourceHash;
+    header.options = options;
+    header.fileSize = writer.bytes.size();
+    header.bodyHash = hashBytes(std::string_view(writer.bytes.data() + sizeof(header), writer.bytes.size() - sizeof(header)), sourceHash);
+    std::memcpy(writer.bytes.data(), &header, sizeof(header));
+
+    // unique per thread too, several Programs may be compiling the same script
+    std::string tempPath = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) { return false; }
+    bool written = fwrite(writer.bytes.data(), 1, writer.bytes.size(), file) == writer.bytes.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef cache_hpp
+#define cache_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "parser.hpp"
+#include "resolver.hpp"
+
+// --- Program cache
+// a .rdc file is the parsed and resolved program written out in the same
+// layout the arena uses, with every pointer stored as an offset from the start
+// of the file. loading maps it privately and turns the offsets back into
+// pointers in one pass over the tree, so a warm start never lexes or parses
+uint64_t hashSource(std::string_view source);
+
+// <cacheDir>/<script name>.rdc, or <input path>.rdc when cacheDir is empty
+std::string cachePathFor(const std::string& inputPath, const std::string& cacheDir);
+
+class ProgramCache {
+public:
+    ProgramCache() : mapped(nullptr), mappedSize(0) {}
+    ~ProgramCache();
+
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+    // false if the file is missing, stale (other source hash, interpreter
+    // build or options) or damaged (its contents don't match the hash in the
+    // header, or a pointer, slot or call in it leads anywhere it shouldn't),
+    // in which case the caller falls back to parsing. options are whatever
+    // front-end settings change the tree, e.g. whether it was optimized. the
+    // loaded AST points into the mapping and lives as long as this object
+    bool load(const std::string& path, uint64_t sourceHash, uint32_t options, FunctionTable& funcExpressions, SlotTable& slots);
+
+private:
+    char* mapped;
+    size_t mappedSize;
+};
+
+// written to a temp file and renamed into place so concurrent runs never see
+// half a cache. failures are silent, the cache is only ever an optimization
+bool writeProgramCache(const std::string& path, uint64_t sourceHash, uint32_t options, const FunctionTable& funcExpressions, const SlotTable& slots);
+
+#endif /* cache_hpp */
@@ -0,0 +1,453 @@
+#include "compiler.hpp"
+
+#include "evaluator.hpp"
+
+std::string printOpCode(OpCode op) {
+    switch(op) {
+        case OpCode::PUSH_INT:      { return "PUSH_INT"; }
+        case OpCode::PUSH_STR:      { return "PUSH_STR"; }
+        case OpCode::PUSH_NONE:     { return "PUSH_NONE"; }
+        case OpCode::POP:           { return "POP"; }
+        case OpCode::LOAD_SLOT:     { return "LOAD_SLOT"; }
+        case OpCode::STORE_SLOT:    { return "STORE_SLOT"; }
+        case OpCode::LOAD_LOCAL:    { return "LOAD_LOCAL"; }
+        case OpCode::STORE_LOCAL:   { return "STORE_LOCAL"; }
+        case OpCode::CALL:          { return "CALL"; }
+        case OpCode::TAIL_CALL:     { return "TAIL_CALL"; }
+        case OpCode::ADD:           { return "ADD"; }
+        case OpCode::SUB:           { return "SUB"; }
+        case OpCode::MUL:           { return "MUL"; }
+        case OpCode::DIV:           { return "DIV"; }
+        case OpCode::IS_LESS:       { return "IS_LESS"; }
+        case OpCode::IS_LEQ:        { return "IS_LEQ"; }
+        case OpCode::IS_GREATER:    { return "IS_GREATER"; }
+        case OpCode::IS_GEQ:        { return "IS_GEQ"; }
+        case OpCode::IS_EQ:         { return "IS_EQ"; }
+        case OpCode::INT_ADD:       { return "INT_ADD"; }
+        case OpCode::INT_SUB:       { return "INT_SUB"; }
+        case OpCode::INT_MUL:       { return "INT_MUL"; }
+        case OpCode::INT_DIV:       { return "INT_DIV"; }
+        case OpCode::INT_LT:        { return "INT_LT"; }
+        case OpCode::INT_LEQ:       { return "INT_LEQ"; }
+        case OpCode::INT_GT:        { return "INT_GT"; }
+        case OpCode::INT_GEQ:       { return "INT_GEQ"; }
+        case OpCode::INT_EQ:        { return "INT_EQ"; }
+        case OpCode::STR_CONCAT:    { return "STR_CONCAT"; }
+        case OpCode::PRINT:         { return "PRINT"; }
+        case OpCode::JUMP:          { return "JUMP"; }
+        case OpCode::JUMP_IF_FALSE: { return "JUMP_IF_FALSE"; }
+        case OpCode::FOR_ENTER:     { return "FOR_ENTER"; }
+        case OpCode::FOR_SET:       { return "FOR_SET"; }
+        case OpCode::FOR_SET_LOCAL: { return "FOR_SET_LOCAL"; }
+        case OpCode::FOR_NEXT:      { return "FOR_NEXT"; }
+        case OpCode::SPAWN:         { return "SPAWN"; }
+        case OpCode::JOIN:          { return "JOIN"; }
+        case OpCode::RETURN:        { return "RETURN"; }
+    }
+    return "INVALID_OPCODE";
+}
+
+std::string Instruction::str() const {
+    return printOpCode(op) + " " + std::to_string(operand);
+}
+
+std::string Function::str() const {
+    std::string representation = "fn " + name + "\n";
+    for (size_t codeIdx = 0; codeIdx < code.size(); codeIdx++) {
+        representation += "    " + std::to_string(codeIdx) + ": " + code[codeIdx].str() + "\n";
+    }
+    return representation;
+}
+
+std::string Program::str() const {
+    std::string representation;
+    for (const Function& function : functions) {
+        representation += function.str();
+    }
+    return representation;
+}
+
+namespace {
+
+struct Compiler {
+    Program program;
+    std::map<std::string, int> stringIndex;
+    std::vector<int> functionBySymbol; // -1 for names that aren't functions
+    const LineNumbers* lineNumbers = nullptr;
+    uint32_t statementLine = 0; // the line of the statement being compiled, see FOR
+
+    // the next instruction emitted starts line
+    void markLine(Function& function, uint32_t line) {
+        if (function.lines.size() <= function.code.size()) { function.lines.resize(function.code.size() + 1); }
+        function.lines[function.code.size()] = line;
+    }
+
+    uint32_t lineOf(const ExpressionLine& expressionLine) const {
+        if (lineNumbers == nullptr || expressionLine.empty()) { return 0; }
+        LineNumbers::const_iterator it = lineNumbers->find(expressionLine.begin());
+        return it != lineNumbers->end() ? it->second : 0;
+    }
+
+    int internString(const std::string& s) {
+        std::map<std::string, int>::iterator it = stringIndex.find(s);
+        if (it != stringIndex.end()) { return it->second; }
+        program.strings.push_back(Value::fromStr(s));
+        return stringIndex[s] = (int) program.strings.size() - 1;
+    }
+
+    void emit(Function& function, OpCode op, int32_t operand = 0) {
+        function.code.push_back(Instruction(op, operand));
+    }
+
+    void compileBinaryOp(Function& function, const Expression* expression, OpCode op, bool wantValue) {
+        compileExpression(function, expression->as<BinaryExpression>()->left, true);
+        compileExpression(function, expression->as<BinaryExpression>()->right, true);
+        emit(function, op);
+        if (!wantValue) { emit(function, OpCode::POP); }
+    }
+
+    void compileExpression(Function& function, const Expression* expression, bool wantValue) {
+        switch(expression->expressionType) {
+            case ExpressionType::VALUE: {
+                const ValueExpression* value = expression->as<ValueExpression>();
+                std::string_view payload = value->payload;
+                if (expression->local) {
+                    if (wantValue) { emit(function, OpCode::LOAD_LOCAL, expression->slot); }
+                    break;
+                }
+                int decoded;
+                if (is_number(payload) && decodeInt(payload, decoded)) {
+                    if (wantValue) { emit(function, OpCode::PUSH_INT, decoded); }
+                    break;
+                }
+
+                if (expression->slot >= 0) {
+                    emit(function, OpCode::LOAD_SLOT, expression->slot);
+                    if (!wantValue) { emit(function, OpCode::POP); }
+                    break;
+                }
+
+                // names nobody assigns to can only ever be calls or bare words
+                if (value->function != nullptr) {
+                    compileCall(function, value, ExpressionLine(), OpCode::CALL);
+                    if (!wantValue) { emit(function, OpCode::POP); }
+                } else if (wantValue) {
+                    emit(function, OpCode::PUSH_STR, internString(std::string(payload)));
+                }
+                break;
+            }
+            case ExpressionType::ADD:        { compileBinaryOp(function, expression, OpCode::ADD, wantValue); break; }
+            case ExpressionType::SUB:        { compileBinaryOp(function, expression, OpCode::SUB, wantValue); break; }
+            case ExpressionType::MUL:        { compileBinaryOp(function, expression, OpCode::MUL, wantValue); break; }
+            case ExpressionType::DIV:        { compileBinaryOp(function, expression, OpCode::DIV, wantValue); break; }
+            case ExpressionType::IS_LESS:    { compileBinaryOp(function, expression, OpCode::IS_LESS, wantValue); break; }
+            case ExpressionType::IS_LEQ:     { compileBinaryOp(function, expression, OpCode::IS_LEQ, wantValue); break; }
+            case ExpressionType::IS_GREATER: { compileBinaryOp(function, expression, OpCode::IS_GREATER, wantValue); break; }
+            case ExpressionType::IS_GEQ:     { compileBinaryOp(function, expression, OpCode::IS_GEQ, wantValue); break; }
+            case ExpressionType::IS_EQ:      { compileBinaryOp(function, expression, OpCode::IS_EQ, wantValue); break; }
+            case ExpressionType::INT_ADD:    { compileBinaryOp(function, expression, OpCode::INT_ADD, wantValue); break; }
+            case ExpressionType::INT_SUB:    { compileBinaryOp(function, expression, OpCode::INT_SUB, wantValue); break; }
+            case ExpressionType::INT_MUL:    { compileBinaryOp(function, expression, OpCode::INT_MUL, wantValue); break; }
+            case ExpressionType::INT_DIV:    { compileBinaryOp(function, expression, OpCode::INT_DIV, wantValue); break; }
+            case ExpressionType::INT_LT:     { compileBinaryOp(function, expression, OpCode::INT_LT, wantValue); break; }
+            case ExpressionType::INT_LEQ:    { compileBinaryOp(function, expression, OpCode::INT_LEQ, wantValue); break; }
+            case ExpressionType::INT_GT:     { compileBinaryOp(function, expression, OpCode::INT_GT, wantValue); break; }
+            case ExpressionType::INT_GEQ:    { compileBinaryOp(function, expression, OpCode::INT_GEQ, wantValue); break; }
+            case ExpressionType::INT_EQ:     { compileBinaryOp(function, expression, OpCode::INT_EQ, wantValue); break; }
+            case ExpressionType::STR_CONCAT: { compileBinaryOp(function, expression, OpCode::STR_CONCAT, wantValue); break; }
+            case ExpressionType::PAREN: {
+                compileLine(function, expression->as<ListExpression>()->core, wantValue);
+                break;
+            }
+            case ExpressionType::STRING: {
+                if (wantValue) { emit(function, OpCode::PUSH_STR, internString(std::string(expression->as<StringExpression>()->payload))); }
+                break;
+            }
+            case ExpressionType::INT: {
+                if (wantValue) { emit(function, OpCode::PUSH_INT, expression->as<IntExpression>()->value); }
+                break;
+            }
+            case ExpressionType::PRINT: {
+                compileLine(function, expression->as<ListExpression>()->core, true);
+                emit(function, OpCode::PRINT);
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::VAR: {
+                compileLine(function, expression->as<VarExpression>()->core, true);
+                emit(function, expression->local ? OpCode::STORE_LOCAL : OpCode::STORE_SLOT, expression->slot);
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::IF: {
+                const IfExpression* ifExpr = expression->as<IfExpression>();
+                compileExpression(function, ifExpr->conditional, true);
+                size_t jumpToElse = function.code.size();
+                emit(function, OpCode::JUMP_IF_FALSE);
+                compileBlock(function, ifExpr->ifStatements);
+
+                size_t jumpToEnd = function.code.size();
+                emit(function, OpCode::JUMP);
+                function.code[jumpToElse].operand = (int32_t) function.code.size();
+                compileBlock(function, ifExpr->elseStatements);
+                function.code[jumpToEnd].operand = (int32_t) function.code.size();
+
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::FOR: {
+                const ForExpression* forExpr = expression->as<ForExpression>();
+                compileExpression(function, forExpr->from, true);
+                compileExpression(function, forExpr->limit, true);
+                size_t enter = function.code.size();
+                emit(function, OpCode::FOR_ENTER);
+                size_t bodyStart = function.code.size();
+                emit(function, expression->local ? OpCode::FOR_SET_LOCAL : OpCode::FOR_SET, expression->slot);
+                // every trip round the loop goes back through the for line
+                uint32_t line = statementLine;
+                compileBlock(function, forExpr->body);
+                if (line != 0) { markLine(function, line); }
+                emit(function, OpCode::FOR_NEXT, (int32_t) bodyStart);
+                function.code[enter].operand = (int32_t) function.code.size();
+
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::WHILE: {
+                const WhileExpression* whileExpr = expression->as<WhileExpression>();
+                size_t loopStart = function.code.size();
+                compileExpression(function, whileExpr->conditional, true);
+                size_t jumpToEnd = function.code.size();
+                emit(function, OpCode::JUMP_IF_FALSE);
+                compileBlock(function, whileExpr->body);
+                emit(function, OpCode::JUMP, (int32_t) loopStart);
+                function.code[jumpToEnd].operand = (int32_t) function.code.size();
+
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::CALL: {
+                const CallExpression* call = expression->as<CallExpression>();
+                if (call->callee->function != nullptr) {
+                    compileCall(function, call->callee, call->args, OpCode::CALL);
+                    if (!wantValue) { emit(function, OpCode::POP); }
+                    break;
+                }
+                // not a function: the name followed by a paren group
+                compileExpression(function, call->callee, false);
+                compileLine(function, call->args, wantValue);
+                break;
+            }
+            case ExpressionType::SPAWN: {
+                const CallExpression* spawn = expression->as<CallExpression>();
+                compileCall(function, spawn->callee, spawn->args, OpCode::SPAWN);
+                program.usesTasks = true;
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::JOIN: {
+                emit(function, OpCode::JOIN);
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            case ExpressionType::RETURN: {
+                const ExpressionLine& returned = expression->as<ListExpression>()->core;
+                ExpressionLine args;
+                const FunctionDefinition* callee = tailCallee(returned, args);
+                if (callee != nullptr) {
+                    const Expression* tail = returned[0];
+                    const ValueExpression* calleeName = tail->expressionType == ExpressionType::CALL ? tail->as<CallExpression>()->callee : tail->as<ValueExpression>();
+                    compileCall(function, calleeName, args, OpCode::TAIL_CALL);
+                    function.returnsValue = true;
+                } else {
+                    compileLine(function, returned, true);
+                    emit(function, OpCode::RETURN);
+                    function.returnsValue = function.returnsValue || !returned.empty();
+                }
+                // never reached, but keeps the stack shape the same on both sides
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+            default: {
+                if (wantValue) { emit(function, OpCode::PUSH_NONE); }
+                break;
+            }
+        }
+    }
+
+    // one value per parameter, then the call. extra arguments are evaluated and dropped
+    void compileCall(Function& function, const ValueExpression* callee, const ExpressionLine& args, OpCode op) {
+        uint32_t paramCount = callee->function->params.size();
+        for (uint32_t argIdx = 0; argIdx < args.size() || argIdx < paramCount; argIdx++) {
+            if (argIdx >= args.size()) {
+                emit(function, OpCode::PUSH_NONE);
+            } else {
+                compileExpression(function, args[argIdx], argIdx < paramCount);
+            }
+        }
+        emit(function, op, indexOf(callee));
+    }
+
+    // compile() binds every function's symbol up front, recompile() looks
+    // up the few calls it compiles by name
+    int indexOf(const ValueExpression* callee) const {
+        if (callee->symbol < functionBySymbol.size()) { return functionBySymbol[callee->symbol]; }
+        return program.functionIndex.find(callee->payload)->second;
+    }
+
+    // a line's value is the value of its last expression
+    void compileLine(Function& function, const ExpressionLine& expressionLine, bool wantValue) {
+        for (uint32_t exprIdx = 0; exprIdx < expressionLine.size(); exprIdx++) {
+            compileExpression(function, expressionLine[exprIdx], wantValue && exprIdx == expressionLine.size() - 1);
+        }
+        if (wantValue && expressionLine.size() == 0) { emit(function, OpCode::PUSH_NONE); }
+    }
+
+    void compileBlock(Function& function, const ExpressionBlock& expressions) {
+        for (const ExpressionLine& expressionLine : expressions) {
+            uint32_t line = lineOf(expressionLine);
+            if (line != 0) {
+                markLine(function, line);
+                statementLine = line;
+            }
+            compileLine(function, expressionLine, false);
+        }
+    }
+
+    // functions get their indices up front so calls can be bound before their bodies are compiled
+    void declare(const std::string& name, const FunctionDefinition& definition, int index) {
+        Symbol symbol = symbolTable.intern(name);
+        if (symbol >= functionBySymbol.size()) { functionBySymbol.resize(symbol + 1, -1); }
+        functionBySymbol[symbol] = index;
+        program.functionIndex[name] = index;
+        program.functions[index].name = name;
+        program.functions[index].paramCount = (int) definition.params.size();
+        program.functions[index].pure = definition.pure;
+    }
+
+    void bindSlots(const SlotTable& slots) {
+        program.slotNames = slots.slotNames;
+        program.slotFunctions.clear();
+        for (const std::string& slotName : slots.slotNames) {
+            Symbol symbol = symbolTable.intern(slotName);
+            program.slotFunctions.push_back(symbol < functionBySymbol.size() ? functionBySymbol[symbol] : -1);
+        }
+    }
+
+    void compileFunction(Function& function, const FunctionDefinition& definition) {
+        compileBlock(function, definition.body);
+        emit(function, OpCode::PUSH_NONE);
+        emit(function, OpCode::RETURN);
+        if (lineNumbers != nullptr) { function.lines.resize(function.code.size()); }
+    }
+};
+
+}
+
+Program compile(const FunctionTable& funcExpressions, const SlotTable& slots, const LineNumbers* lineNumbers) {
+    Compiler compiler;
+    compiler.lineNumbers = lineNumbers;
+
+    for (const auto& funcExpression : funcExpressions) {
+        compiler.program.functions.push_back(Function());
+        compiler.declare(funcExpression.first, funcExpression.second, (int) compiler.program.functions.size() - 1);
+    }
+    compiler.bindSlots(slots);
+
+    for (const auto& funcExpression : funcExpressions) {
+        compiler.compileFunction(compiler.program.functions[compiler.program.functionIndex[funcExpression.first]], funcExpression.second);
+    }
+
+    return std::move(compiler.program);
+}
+
+Program recompile(const Program& previous, const FunctionTable& funcExpressions, const SlotTable& slots, const std::vector<std::string_view>& changed, bool purityChanged) {
+    Compiler compiler;
+    compiler.program.functions = previous.functions;
+    compiler.program.functionIndex = previous.functionIndex;
+    compiler.program.slotFunctions = previous.slotFunctions;
+    for (const Value& string : previous.strings) {
+        compiler.stringIndex[string.asStr()] = (int) compiler.program.strings.size();
+        compiler.program.strings.push_back(string.unshared());
+    }
+
+    // no new function and as many as before means the same ones as before
+    bool sameFunctions = funcExpressions.size() == previous.functionIndex.size();
+    for (std::string_view name : changed) {
+        sameFunctions = sameFunctions && previous.functionIndex.find(name) != previous.functionIndex.end();
+    }
+
+    // otherwise both are in name order, so one walk finds the functions that
+    // came and went. a function that's gone becomes a stub: its callers are
+    // among the changed ones, but its index can't be handed to another
+    std::vector<std::string_view> cameOrWent;
+    auto retire = [&compiler, &cameOrWent](const std::pair<const std::string, int>& indexed) {
+        cameOrWent.push_back(indexed.first);
+        compiler.program.functionIndex.erase(indexed.first);
+        Function& stub = compiler.program.functions[indexed.second];
+        stub = Function();
+        stub.name = indexed.first;
+        compiler.emit(stub, OpCode::PUSH_NONE);
+        compiler.emit(stub, OpCode::RETURN);
+    };
+    std::map<std::string, int, std::less<>>::const_iterator indexed = previous.functionIndex.begin();
+    for (const auto& funcExpression : funcExpressions) {
+        if (sameFunctions && !purityChanged) { break; }
+        while (indexed != previous.functionIndex.end() && indexed->first < funcExpression.first) {
+            retire(*indexed);
+            ++indexed;
+        }
+        Function* function = nullptr;
+        if (indexed != previous.functionIndex.end() && indexed->first == funcExpression.first) {
+            function = &compiler.program.functions[indexed->second];
+            ++indexed;
+        } else {
+            cameOrWent.push_back(funcExpression.first);
+            compiler.program.functionIndex[funcExpression.first] = (int) compiler.program.functions.size();
+            compiler.program.functions.push_back(Function());
+            function = &compiler.program.functions.back();
+            function->name = funcExpression.first;
+        }
+        function->pure = funcExpression.second.pure;
+    }
+    for (; !sameFunctions && indexed != previous.functionIndex.end(); ++indexed) {
+        retire(*indexed);
+    }
+
+    // only new slots, and slots named after a function that came or went,
+    // fall back to something else now
+    compiler.program.slotNames = slots.slotNames;
+    for (size_t slot = compiler.program.slotFunctions.size(); slot < slots.slotNames.size(); slot++) {
+        std::map<std::string, int, std::less<>>::const_iterator function = compiler.program.functionIndex.find(slots.slotNames[slot]);
+        compiler.program.slotFunctions.push_back(function != compiler.program.functionIndex.end() ? function->second : -1);
+    }
+    for (std::string_view name : cameOrWent) {
+        int slot = slots.slotOf(symbolTable.intern(name));
+        if (slot < 0) { continue; }
+        std::map<std::string, int, std::less<>>::const_iterator function = compiler.program.functionIndex.find(name);
+        compiler.program.slotFunctions[slot] = function != compiler.program.functionIndex.end() ? function->second : -1;
+    }
+
+    for (std::string_view name : changed) {
+        Function& function = compiler.program.functions[compiler.program.functionIndex.find(name)->second];
+        const FunctionDefinition& definition = funcExpressions.find(name)->second;
+        function.code.clear();
+        function.lines.clear();
+        function.paramCount = (int) definition.params.size();
+        function.returnsValue = false;
+        function.pure = definition.pure;
+        compiler.compileFunction(function, definition);
+    }
+
+    // compileExpression() only saw the changed functions spawn, the others
+    // only need looking at if one of them might have
+    if (previous.usesTasks) {
+        compiler.program.usesTasks = false;
+        for (const Function& function : compiler.program.functions) {
+            for (const Instruction& instruction : function.code) {
+                compiler.program.usesTasks = compiler.program.usesTasks || instruction.op == OpCode::SPAWN;
+            }
+        }
+    }
+    return std::move(compiler.program);
+}
@@ -0,0 +1,119 @@
+#ifndef compiler_hpp
+#define compiler_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "value.hpp"
+
+// --- Bytecode
+// every expression leaves exactly one value on the stack, statements (print,
+// assignment, if, calls) leave nothing unless they're used as a value.
+// a call's arguments are pushed one per parameter and stay where they are as
+// the callee's locals; RETURN replaces everything above them with the result
+enum class OpCode : uint8_t {
+    PUSH_INT,      // operand: the int itself
+    PUSH_STR,      // operand: index into Program::strings
+    PUSH_NONE,
+    POP,
+    LOAD_SLOT,     // operand: variable slot, see resolver.hpp
+    STORE_SLOT,    // operand: variable slot
+    LOAD_LOCAL,    // operand: parameter index in the current frame
+    STORE_LOCAL,   // operand: parameter index
+    CALL,          // operand: index into Program::functions
+    TAIL_CALL,     // operand: index into Program::functions. the callee replaces the current frame
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    IS_LESS,
+    IS_LEQ,
+    IS_GREATER,
+    IS_GEQ,
+    IS_EQ,
+    // the same on operands known to be ints, and ADD on a left side known to
+    // be a string, see types.hpp
+    INT_ADD,
+    INT_SUB,
+    INT_MUL,
+    INT_DIV,
+    INT_LT,
+    INT_LEQ,
+    INT_GT,
+    INT_GEQ,
+    INT_EQ,
+    STR_CONCAT,
+    PRINT,
+    JUMP,          // operand: absolute instruction index
+    JUMP_IF_FALSE, // operand: absolute instruction index
+    // counted loops keep [counter, limit] as ints on the stack for the whole loop
+    FOR_ENTER,     // operand: loop exit. makes both ints, pops them and exits if counter > limit
+    FOR_SET,       // operand: variable slot, gets the counter
+    FOR_SET_LOCAL, // operand: parameter index, gets the counter
+    FOR_NEXT,      // operand: the FOR_SET. pops both after the last iteration, otherwise counter++ and loops
+    SPAWN,         // operand: index into Program::functions. pops the arguments into a new task, see tasks.hpp
+    JOIN,          // waits for every task the running task (or main) has spawned
+    RETURN,        // the result is on top of the stack
+};
+
+struct Instruction {
+    OpCode op;
+    int32_t operand;
+
+    Instruction(OpCode op, int32_t operand = 0) : op(op), operand(operand) {}
+
+    std::string str() const;
+};
+
+struct Function {
+    std::string name;
+    std::vector<Instruction> code;
+    int paramCount = 0;
+    bool returnsValue = false; // false if every path ends in a bare return or the end of the body
+    bool pure = false;         // calls can be memoized, see memo.hpp
+
+    // the source line that starts at each instruction, 0 for the rest. only
+    // filled in when compile() is given line numbers, for the profiler
+    std::vector<uint32_t> lines;
+
+    std::string str() const;
+};
+
+struct Program {
+    std::vector<Function> functions;
+    std::map<std::string, int, std::less<>> functionIndex;
+
+    std::vector<Value> strings;       // string literals and bare words
+
+    // reads of a slot that hasn't been assigned yet fall back to calling the
+    // function of the same name, or to the name itself as a string
+    std::vector<std::string> slotNames;
+    std::vector<int> slotFunctions;   // -1 if there's no function with that name
+
+    bool usesTasks = false;           // anything spawns, so globals are shared between threads
+
+    std::string str() const;
+};
+
+std::string printOpCode(OpCode op);
+
+// lowers the parsed (and resolved) function table into flat bytecode. with
+// lineNumbers (see parse()), every Function::lines is filled in too
+Program compile(const FunctionTable& funcExpressions, const SlotTable& slots, const LineNumbers* lineNumbers = nullptr);
+
+// compile() for a reloaded table (see ruddy::Program::reload()): only the
+// functions named in changed are compiled, the rest keep their code from
+// previous. so that code still holds, every function keeps its index, a
+// function that's gone stays behind as a stub, new ones go on the end, and
+// string constants are only ever added. slots has to have grown from the
+// table previous was compiled with. purityChanged if a function that isn't
+// in changed may have become pure or stopped being pure
+Program recompile(const Program& previous, const FunctionTable& funcExpressions, const SlotTable& slots, const std::vector<std::string_view>& changed, bool purityChanged);
+
+#endif /* compiler_hpp */
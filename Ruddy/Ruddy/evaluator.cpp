@@ -0,0 +1,378 @@
+#include "evaluator.hpp"
+
+#include <algorithm>
+#include <climits>
+
+#include "output.hpp"
+#include "resolver.hpp"
+
+std::vector<Value> variables;
+FunctionTable funcExpressions;
+MemoCache memo;
+
+namespace {
+
+// parameters of every active call, innermost last. localsBase is where the
+// current call's parameters start
+std::vector<Value> locals;
+size_t localsBase = 0;
+
+// set by RETURN. evaluate() and the loops stop as soon as they see it, and
+// the call it belongs to picks up returnValue, or, for a tail call, starts
+// pendingCallee in place with the arguments at locals[tailArgsStart..]
+bool returning = false;
+Value returnValue;
+const FunctionDefinition* pendingCallee = nullptr;
+size_t tailArgsStart = 0;
+
+// the arguments of every memoized call in progress, innermost last. kept
+// apart from locals since the callee is free to assign its parameters
+std::vector<Value> memoArgs;
+
+// what the inline caches on VALUE nodes are checked against. a global name
+// can only start meaning something else when its slot is assigned for the
+// first time, which stops it falling back to a call or a bare word
+uint32_t bindingVersion = 1;
+
+// numbers and bare words, each decoded once, see ValueExpression::literal
+std::vector<Value> literals;
+
+// the variable an assignment writes to
+Value& slotRef(const Expression* expression) {
+    if (expression->local) { return locals[localsBase + expression->slot]; }
+    Value& variable = variables[expression->slot];
+    if (variable.isNone()) { bindingVersion++; }
+    return variable;
+}
+
+// the slow path for a global name: works out what it means right now and
+// caches that on the node
+Value resolveName(const ValueExpression* value) {
+    value->cacheVersion = bindingVersion;
+    if (value->slot >= 0 && !variables[value->slot].isNone()) {
+        value->binding = NameBinding::SLOT;
+        return variables[value->slot];
+    }
+    if (value->function != nullptr) {
+        value->binding = NameBinding::FUNCTION;
+        return callFunction(*value->function, ExpressionLine());
+    }
+
+    value->binding = NameBinding::LITERAL;
+    if (value->literal == NO_LITERAL) {
+        int decoded;
+        if (!is_number(value->payload)) {
+            value->literal = (uint32_t) literals.size();
+            literals.push_back(Value::fromStr(std::string(value->payload)));
+        } else if (decodeInt(value->payload, decoded)) {
+            value->literal = (uint32_t) literals.size();
+            literals.push_back(Value::fromInt(decoded));
+        } else {
+            // too big for an int, it's the bare word like in the compiler.
+            // left out of the cache, so it comes back here every time
+            value->cacheVersion = 0;
+            return Value::fromStr(std::string(value->payload));
+        }
+    }
+    return literals[value->literal];
+}
+
+// pushes exactly one value per parameter onto locals: the argument, or NONE
+// if it's missing. extra arguments are still evaluated
+void pushArgs(const FunctionDefinition& function, const ExpressionLine& args) {
+    for (uint32_t argIdx = 0; argIdx < args.size() || argIdx < function.params.size(); argIdx++) {
+        Value arg = argIdx < args.size() ? evaluateExpression(args[argIdx]) : Value();
+        if (argIdx < function.params.size()) { locals.push_back(std::move(arg)); }
+    }
+}
+
+}
+
+// every name's cache goes stale at once, see bindingVersion
+void invalidateNameCaches() {
+    bindingVersion++;
+}
+
+// a tail call loops here with the callee in place of function rather than
+// nesting another call
+Value callFunction(const FunctionDefinition& definition, const ExpressionLine& args) {
+    size_t base = locals.size();
+    pushArgs(definition, args);
+
+    bool memoized = definition.pure && memo.enabled();
+    if (memoized) {
+        const Value* result = memo.find(&definition, locals.data() + base, definition.params.size());
+        if (result != nullptr) {
+            locals.resize(base);
+            return *result;
+        }
+        memoArgs.insert(memoArgs.end(), locals.begin() + base, locals.end());
+    }
+
+    const FunctionDefinition* function = &definition;
+    size_t callerBase = localsBase;
+    localsBase = base;
+    Value result;
+    for (;;) {
+        evaluate(function->body);
+        if (!returning) { break; }
+        returning = false;
+        if (pendingCallee == nullptr) {
+            result = std::move(returnValue);
+            returnValue = Value();
+            break;
+        }
+
+        function = pendingCallee;
+        pendingCallee = nullptr;
+        std::move(locals.begin() + tailArgsStart, locals.end(), locals.begin() + base);
+        locals.resize(base + function->params.size());
+    }
+    // under the original call even if a tail call took over
+    if (memoized) {
+        size_t keyStart = memoArgs.size() - definition.params.size();
+        memo.insert(&definition, memoArgs.data() + keyStart, definition.params.size(), result);
+        memoArgs.resize(keyStart);
+    }
+    locals.resize(base);
+    localsBase = callerBase;
+    return result;
+}
+
+bool is_number(std::string_view s) {
+    return !s.empty() && std::find_if(s.begin(),
+        s.end(), [](unsigned char c) { return !std::isdigit(c); }) == s.end();
+}
+
+bool decodeInt(std::string_view digits, int& decoded) {
+    long long value = 0;
+    for (char c : digits) {
+        value = value * 10 + (c - '0');
+        if (value > INT_MAX) { return false; }
+    }
+    decoded = (int) value;
+    return true;
+}
+
+Value evaluateExpression(const Expression* expression) {
+    switch(expression->expressionType) {
+        case ExpressionType::VALUE: {
+            const ValueExpression* value = expression->as<ValueExpression>();
+            // a parameter nobody passed stays NONE rather than falling back
+            if (value->local) {
+                return locals[localsBase + value->slot];
+            }
+            if (value->cacheVersion != bindingVersion) {
+                return resolveName(value);
+            }
+            switch (value->binding) {
+                case NameBinding::SLOT:     { return variables[value->slot]; }
+                case NameBinding::FUNCTION: { return callFunction(*value->function, ExpressionLine()); }
+                default:                    { return literals[value->literal]; }
+            }
+        }
+        case ExpressionType::ADD: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            Value addValueLeft = evaluateExpression(binaryOp->left);
+            Value addValueRight = evaluateExpression(binaryOp->right);
+            
+            if (addValueLeft.isInt()) {
+                return Value::fromInt(addValueLeft.asInt() + addValueRight.asInt());
+            } else {
+                return Value::concat(addValueLeft, addValueRight);
+            }
+        }
+        case ExpressionType::SUB: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() - evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::MUL: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() * evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::DIV: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() / evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::IS_LESS: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() < evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::IS_LEQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() <= evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::IS_GREATER: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() > evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::IS_GEQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() >= evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::IS_EQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return Value::fromInt(evaluateExpression(binaryOp->left).asInt() == evaluateExpression(binaryOp->right).asInt());
+        }
+        case ExpressionType::INT_ADD: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left + evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_SUB: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left - evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_MUL: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left * evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_DIV: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left / evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_LT: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left < evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_LEQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left <= evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_GT: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left > evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_GEQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left >= evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::INT_EQ: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            int left = evaluateExpression(binaryOp->left).knownInt();
+            return Value::fromInt(left == evaluateExpression(binaryOp->right).knownInt());
+        }
+        case ExpressionType::STR_CONCAT: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            Value left = evaluateExpression(binaryOp->left);
+            return Value::concat(left, evaluateExpression(binaryOp->right));
+        }
+        case ExpressionType::IF: {
+            const IfExpression* ifExpr = expression->as<IfExpression>();
+            if (evaluateExpression(ifExpr->conditional).asInt()) {
+                evaluate(ifExpr->ifStatements);
+            } else {
+                evaluate(ifExpr->elseStatements);
+            }
+            return Value();
+        }
+        case ExpressionType::FOR: {
+            // the counter is a plain int and the bounds are only evaluated
+            // once, the variable is just told each value in turn
+            const ForExpression* forExpr = expression->as<ForExpression>();
+            int from = evaluateExpression(forExpr->from).asInt();
+            int limit = evaluateExpression(forExpr->limit).asInt();
+            if (from > limit) { return Value(); }
+            for (int counter = from; ; counter++) {
+                slotRef(forExpr) = Value::fromInt(counter);
+                evaluate(forExpr->body);
+                // checked before the increment so a limit of INT_MAX can't wrap
+                if (counter == limit || returning) { break; }
+            }
+            return Value();
+        }
+        case ExpressionType::WHILE: {
+            const WhileExpression* whileExpr = expression->as<WhileExpression>();
+            // returning first: a call in the condition would take the pending
+            // return value as its own
+            while (!returning && evaluateExpression(whileExpr->conditional).asInt()) {
+                evaluate(whileExpr->body);
+            }
+            return Value();
+        }
+        case ExpressionType::CALL: {
+            const CallExpression* call = expression->as<CallExpression>();
+            if (call->callee->function != nullptr) {
+                return callFunction(*call->callee->function, call->args);
+            }
+            // not a function: the name followed by a paren group
+            Value result = evaluateExpression(call->callee);
+            for (const Expression* arg : call->args) {
+                Value value = evaluateExpression(arg);
+                if (!value.isNone()) { result = std::move(value); }
+            }
+            return result;
+        }
+        case ExpressionType::SPAWN: {
+            // the tree-walker has no threads: a task runs to completion right
+            // where it's spawned, which is one of the orders the VM may pick
+            const CallExpression* spawn = expression->as<CallExpression>();
+            callFunction(*spawn->callee->function, spawn->args);
+            return Value();
+        }
+        case ExpressionType::RETURN: {
+            const ExpressionLine& returned = expression->as<ListExpression>()->core;
+            ExpressionLine args;
+            const FunctionDefinition* callee = tailCallee(returned, args);
+            if (callee != nullptr) {
+                tailArgsStart = locals.size();
+                pushArgs(*callee, args);
+                pendingCallee = callee;
+            } else {
+                returnValue = evaluateLine(returned);
+            }
+            returning = true;
+            return Value();
+        }
+        case ExpressionType::PAREN:  {
+            return evaluateLine(expression->as<ListExpression>()->core);
+        }
+        case ExpressionType::PRINT:  {
+            Value printValue = evaluateLine(expression->as<ListExpression>()->core);
+            if (printValue.isInt()) {
+                output.writeLine(printValue.asInt());
+            } else {
+                output.writeLine(printValue.asStr());
+            }
+            return Value();
+        }
+        case ExpressionType::STRING: {
+            return Value::fromStr(std::string(expression->as<StringExpression>()->payload));
+        }
+        case ExpressionType::INT: {
+            return Value::fromInt(expression->as<IntExpression>()->value);
+        }
+        case ExpressionType::VAR: {
+            // NONE marks a slot that's never been set, so assigning nothing stores an empty string
+            Value varValue = evaluateLine(expression->as<VarExpression>()->core);
+            slotRef(expression) = varValue.isNone() ? Value::fromStr("") : std::move(varValue);
+            return Value();
+        }
+        default: return Value();
+    }
+}
+
+// a line's value is the last value any of its expressions produced
+Value evaluateLine(const ExpressionLine& expressionLine) {
+    Value result;
+    for (const Expression* expression : expressionLine) {
+        if (returning) { break; }
+        Value value = evaluateExpression(expression);
+        if (!value.isNone()) { result = std::move(value); }
+    }
+    return result;
+}
+
+void evaluate(const ExpressionBlock& expressions) {
+    for (const ExpressionLine& expressionLine : expressions) {
+        if (returning) { return; }
+        evaluateLine(expressionLine);
+    }
+}
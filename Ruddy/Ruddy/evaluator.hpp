@@ -0,0 +1,39 @@
+#ifndef evaluator_hpp
+#define evaluator_hpp
+
+#include <stdio.h>
+
+#include <map>
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include "memo.hpp"
+#include "parser.hpp"
+#include "value.hpp"
+
+// --- Tree-walking evaluator
+// original backend: recursively walks the parsed expressions. the bytecode VM
+// (vm.hpp) is the default now, this stays around for comparing output/timings
+extern std::vector<Value> variables; // indexed by Expression::slot, see resolver.hpp
+extern FunctionTable funcExpressions;
+extern MemoCache memo;               // results of calls to pure functions, off unless resized
+
+bool is_number(std::string_view s);
+// digits as an int, false if they don't fit in one. a number too big to be a
+// literal is left as the bare word
+bool decodeInt(std::string_view digits, int& decoded);
+
+Value evaluateExpression(const Expression* expression);
+Value evaluateLine(const ExpressionLine& expressionLine);
+void evaluate(const ExpressionBlock& expressions);
+
+// names cache what they resolved to (see ValueExpression). call this after
+// resetting variables or changing funcExpressions behind the evaluator's back
+void invalidateNameCaches();
+
+// runs a function with the given arguments and returns what it returned,
+// NONE if it ran off the end
+Value callFunction(const FunctionDefinition& function, const ExpressionLine& args);
+
+#endif /* evaluator_hpp */
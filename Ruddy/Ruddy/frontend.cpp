@@ -0,0 +1,138 @@
+#include "frontend.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "lexer.hpp"
+#include "tasks.hpp"
+
+namespace {
+
+// a stretch of whole lines starting at a `fn` (or the top of the file) and
+// everything parsed out of it
+struct Piece {
+    std::string_view text;
+    uint32_t firstLine;
+
+    Arena arena;
+    FunctionTable functions;
+    std::vector<Diagnostic> diagnostics;
+    std::vector<SpawnSite> spawns;
+    LineNumbers lineNumbers;
+    bool complete = false;
+
+    Piece(std::string_view text, uint32_t firstLine) : text(text), firstLine(firstLine) {}
+};
+
+// true if the line starting at p opens a function: `fn` as the first word,
+// the same test parse() makes on the line's first token
+bool startsFunction(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) { p++; }
+    if (end - p < 2 || p[0] != 'f' || p[1] != 'n') { return false; }
+    if (end - p == 2) { return true; }
+    char next = p[2];
+    return next != '\0' && std::strchr(" \t\r\n+-*/=<>()\"',", next) != nullptr;
+}
+
+// source cut into pieces of at least minBytes, see cutAtFunctions()
+std::vector<std::unique_ptr<Piece>> splitAtFunctions(std::string_view source, size_t minBytes) {
+    std::vector<std::unique_ptr<Piece>> pieces;
+    for (const SourceRegion& region : cutAtFunctions(source, minBytes)) {
+        pieces.emplace_back(new Piece(region.text, region.firstLine));
+    }
+    return pieces;
+}
+
+// the name a `fn` line gives its function, the word after the keyword
+std::string_view functionName(std::string_view line) {
+    size_t begin = line.find("fn") + 2;
+    while (begin < line.size() && (line[begin] == ' ' || line[begin] == '\t')) { begin++; }
+    size_t end = begin;
+    while (end < line.size() && line[end] != '\0' && std::strchr(" \t\r\n+-*/=<>()\"',", line[end]) == nullptr) { end++; }
+    return line.substr(begin, end - begin);
+}
+
+}
+
+std::vector<SourceRegion> cutAtFunctions(std::string_view source, size_t minBytes) {
+    std::vector<SourceRegion> regions;
+    const char* begin = source.data();
+    const char* end = begin + source.size();
+    const char* regionStart = begin;
+    uint32_t regionLine = 1, line = 1;
+
+    for (const char* p = begin; p < end; line++) {
+        if (p - regionStart >= (ptrdiff_t) minBytes && startsFunction(p, end)) {
+            regions.push_back(SourceRegion{std::string_view(regionStart, p - regionStart), regionLine, std::string_view()});
+            regionStart = p;
+            regionLine = line;
+        }
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+    }
+    regions.push_back(SourceRegion{std::string_view(regionStart, end - regionStart), regionLine, std::string_view()});
+
+    for (SourceRegion& region : regions) {
+        if (startsFunction(region.text.data(), region.text.data() + region.text.size())) {
+            region.name = functionName(region.text.substr(0, region.text.find('\n')));
+        }
+    }
+    return regions;
+}
+
+int frontEndThreads(std::string_view source, int threads) {
+    if (source.size() < PARALLEL_PARSE_MIN_BYTES) { return 1; }
+    if (threads <= 0) { threads = (int) std::thread::hardware_concurrency(); }
+    return std::max(threads, 1);
+}
+
+bool parseInParallel(std::string_view source, Arena& arena, FunctionTable& funcExpressions, std::vector<Diagnostic>& diagnostics, int threads, LineNumbers* lineNumbers) {
+    // a few pieces per thread so stealing can even out uneven functions
+    size_t minBytes = std::max(source.size() / (size_t) (std::max(threads, 1) * 8), (size_t) 16 * 1024);
+    std::vector<std::unique_ptr<Piece>> pieces = splitAtFunctions(source, minBytes);
+
+    bool complete = pieces.size() > 1;
+    if (complete) {
+        TaskPool pool(threads, [&pieces, lineNumbers](int /* worker */, Task& task) {
+            Piece& piece = *pieces[task.function];
+            TokenStream tokens = tokenize(piece.text);
+            piece.complete = parseLines(piece.arena, piece.functions, tokens, piece.firstLine, piece.diagnostics, piece.spawns, lineNumbers != nullptr ? &piece.lineNumbers : nullptr);
+            task.group->pending.fetch_sub(1, std::memory_order_release);
+        });
+        TaskGroup group;
+        int caller = pool.threads() - 1;
+        for (size_t pieceIdx = 0; pieceIdx < pieces.size(); pieceIdx++) {
+            pool.submit(caller, Task{(int) pieceIdx, std::vector<Value>(), &group});
+        }
+        pool.wait(group, caller);
+
+        // only the last piece may leave something unfinished, anywhere else
+        // it would have run on into the next one
+        for (size_t pieceIdx = 0; pieceIdx + 1 < pieces.size(); pieceIdx++) {
+            complete = complete && pieces[pieceIdx]->complete;
+        }
+    }
+
+    if (!complete) {
+        TokenStream tokens = tokenize(source);
+        parse(arena, funcExpressions, tokens, diagnostics, lineNumbers);
+        return false;
+    }
+
+    // in source order, so a function defined twice keeps its last body and
+    // diagnostics come out in the order parse() would give them
+    std::vector<SpawnSite> spawns;
+    for (std::unique_ptr<Piece>& piece : pieces) {
+        for (std::pair<const std::string, FunctionDefinition>& function : piece->functions) {
+            funcExpressions[function.first] = function.second;
+        }
+        diagnostics.insert(diagnostics.end(), piece->diagnostics.begin(), piece->diagnostics.end());
+        spawns.insert(spawns.end(), piece->spawns.begin(), piece->spawns.end());
+        if (lineNumbers != nullptr) { lineNumbers->insert(piece->lineNumbers.begin(), piece->lineNumbers.end()); }
+        arena.adopt(piece->arena);
+    }
+    checkSpawns(funcExpressions, spawns, diagnostics);
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef frontend_hpp
+#define frontend_hpp
+
+#include <stdio.h>
+
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "parser.hpp"
+
+// --- Parallel front end
+// fn ... endfn blocks don't depend on each other, so a big script is cut at
+// the lines that start with `fn` and the pieces are lexed and parsed on a
+// TaskPool, each into its own arena and function table, then merged in
+// source order. functions and diagnostics come out the same as from
+// tokenize() + parse() on the whole file: if a piece ends halfway through
+// something (a missing endfn, statements between functions) the file is
+// parsed again in one go
+
+// a stretch of whole lines starting at a `fn` line (or the top of the file)
+// and running up to the next one. strings and comments end at the newline,
+// so every region lexes on its own exactly as it would in the whole file
+struct SourceRegion {
+    std::string_view text;
+    uint32_t firstLine;
+    std::string_view name; // the word after `fn`, empty for the top of the file
+};
+
+// source cut at `fn` lines into regions of at least minBytes. with 0 every
+// function gets a region of its own, plus one (maybe empty) for whatever
+// comes before the first
+std::vector<SourceRegion> cutAtFunctions(std::string_view source, size_t minBytes);
+
+// how many threads to lex and parse source with. 0 asks for one per core,
+// and anything under PARALLEL_PARSE_MIN_BYTES gets 1
+const size_t PARALLEL_PARSE_MIN_BYTES = 256 * 1024;
+int frontEndThreads(std::string_view source, int threads);
+
+// false if it ended up parsing the file in one piece
+bool parseInParallel(std::string_view source, Arena& arena, FunctionTable& funcExpressions, std::vector<Diagnostic>& diagnostics, int threads, LineNumbers* lineNumbers = nullptr);
+
+#endif /* frontend_hpp */
@@ -0,0 +1,39 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocations.hpp"
+
+// --- Allocation hooks
+// the command line tool's replacements for operator new and delete, so every
+// allocation in the process is counted while --stats has turned
+// countingAllocations on (see allocations.hpp). only the Ruddy tool builds
+// this file, libruddy leaves operator new to whoever embeds it. in a file of
+// their own so nothing can inline them into their callers. over-aligned
+// new is left to the standard library and isn't counted, nothing in the
+// interpreter asks for it
+void* operator new(std::size_t size) {
+    countAllocation(size);
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) { throw std::bad_alloc(); }
+    return memory;
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    countAllocation(size);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& nothrow) noexcept {
+    return ::operator new(size, nothrow);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
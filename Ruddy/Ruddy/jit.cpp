@@ -0,0 +1,528 @@
+#include "jit.hpp"
+
+#include <cstring>
+
+#if RUDDY_JIT
+#include <sys/mman.h>
+#endif
+
+#include "vm.hpp"
+
+#if RUDDY_JIT
+
+namespace {
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// low nibble of jcc/setcc
+enum Cond : uint8_t { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+// the register allocator: operand stack entry d lives in stackRegs[d], or in
+// the spill area of the native frame once those run out. all callee-saved,
+// so entries survive calls without any saving around them
+const Reg stackRegs[] = {R12, R13, R14, R15};
+const int stackRegCount = 4;
+
+// --- Assembler
+// just the handful of x86-64 encodings the JIT needs. ints are 32-bit like
+// the interpreter's, pointers 64-bit
+class Assembler {
+public:
+    std::vector<uint8_t> bytes;
+
+    size_t size() const { return bytes.size(); }
+
+    void byte(uint8_t b) { bytes.push_back(b); }
+    void imm32(int32_t value) {
+        uint32_t bits = (uint32_t) value;
+        for (int shift = 0; shift < 32; shift += 8) { byte((uint8_t) (bits >> shift)); }
+    }
+    void imm64(uint64_t value) {
+        for (int shift = 0; shift < 64; shift += 8) { byte((uint8_t) (value >> shift)); }
+    }
+
+    // points the rel32 at `at` to `target`
+    void bind(size_t at, size_t target) {
+        uint32_t rel = (uint32_t) (int32_t) (target - (at + 4));
+        for (int shift = 0; shift < 32; shift += 8) { bytes[at + shift / 8] = (uint8_t) (rel >> shift); }
+    }
+
+    void movRR(Reg dst, Reg src, bool wide = false) { rex(wide, src, dst); byte(0x89); modrmReg(src, dst); }
+    void movRI(Reg dst, int32_t imm)                { rex(false, 0, dst); byte(0xB8 + (dst & 7)); imm32(imm); }
+    void movRI64(Reg dst, uint64_t imm)             { rex(true, 0, dst); byte(0xB8 + (dst & 7)); imm64(imm); }
+
+    void load(Reg dst, Reg base, int32_t disp, bool wide = false) { rex(wide, dst, base); byte(0x8B); modrmMem(dst, base, disp); }
+    void store(Reg base, int32_t disp, Reg src)                   { rex(false, src, base); byte(0x89); modrmMem(src, base, disp); }
+    void storeByte(Reg base, int32_t disp, uint8_t imm)           { rex(false, 0, base); byte(0xC6); modrmMem(0, base, disp); byte(imm); }
+    void cmpByte(Reg base, int32_t disp, uint8_t imm)             { rex(false, 0, base); byte(0x80); modrmMem(7, base, disp); byte(imm); }
+    void cmpMem(Reg base, int32_t disp, int32_t imm)              { rex(false, 0, base); byte(0x81); modrmMem(7, base, disp); imm32(imm); }
+    void incMem(Reg base, int32_t disp)                           { rex(false, 0, base); byte(0xFF); modrmMem(0, base, disp); }
+    void decMem(Reg base, int32_t disp)                           { rex(false, 0, base); byte(0xFF); modrmMem(1, base, disp); }
+
+    void add(Reg dst, Reg src)  { rex(false, src, dst); byte(0x01); modrmReg(src, dst); }
+    void sub(Reg dst, Reg src)  { rex(false, src, dst); byte(0x29); modrmReg(src, dst); }
+    void cmp(Reg dst, Reg src)  { rex(false, src, dst); byte(0x39); modrmReg(src, dst); }
+    void test(Reg dst, Reg src) { rex(false, src, dst); byte(0x85); modrmReg(src, dst); }
+    void imul(Reg dst, Reg src) { rex(false, dst, src); byte(0x0F); byte(0xAF); modrmReg(dst, src); }
+    void cdq()                  { byte(0x99); }
+    void idiv(Reg src)          { rex(false, 0, src); byte(0xF7); modrmReg(7, src); }
+
+    // eax = condition ? 1 : 0
+    void setcc(Cond cc) { byte(0x0F); byte(0x90 + cc); byte(0xC0); byte(0x0F); byte(0xB6); byte(0xC0); }
+
+    // branches return the offset of their rel32 for bind()
+    size_t jcc(Cond cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return size() - 4; }
+    size_t jmp()        { byte(0xE9); imm32(0); return size() - 4; }
+    size_t call()       { byte(0xE8); imm32(0); return size() - 4; }
+    void callAbs(const void* target) { movRI64(RAX, (uint64_t) (uintptr_t) target); byte(0xFF); byte(0xD0); }
+
+    void push(Reg reg)       { rex(false, 0, reg); byte(0x50 + (reg & 7)); }
+    void pop(Reg reg)        { rex(false, 0, reg); byte(0x58 + (reg & 7)); }
+    void addRsp(int32_t imm) { byte(0x48); byte(0x81); byte(0xC4); imm32(imm); }
+    void subRsp(int32_t imm) { byte(0x48); byte(0x81); byte(0xEC); imm32(imm); }
+    void ret()               { byte(0xC3); }
+
+private:
+    void rex(bool wide, int reg, int base) {
+        uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+        if (prefix != 0x40) { byte(prefix); }
+    }
+    void modrmReg(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+    // [base + disp32]
+    void modrmMem(int reg, int base, int32_t disp) {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) { byte(0x24); }
+        imm32(disp);
+    }
+};
+
+// operand stack shape at an instruction. ints and NONEs are the only things a
+// native function ever has on its stack, so a bit per entry describes it
+struct StackState {
+    int depth;         // -1 until some path reaches the instruction
+    uint32_t noneMask; // bit d set if entry d is NONE
+
+    bool reached() const { return depth >= 0; }
+    bool isNone(int entry) const { return (noneMask >> entry) & 1; }
+    bool operator==(const StackState& other) const { return depth == other.depth && noneMask == other.noneMask; }
+};
+
+bool isBinaryOp(OpCode op) {
+    return op >= OpCode::ADD && op <= OpCode::INT_EQ;
+}
+
+// ops whose operands are NONE always hand over to the VM, so nothing after them
+// on that path runs natively
+bool alwaysBails(const Instruction& instruction, const StackState& state) {
+    if (instruction.op == OpCode::STORE_SLOT || instruction.op == OpCode::JUMP_IF_FALSE) {
+        return state.isNone(state.depth - 1);
+    }
+    // loop bounds that aren't ints get turned into ints by the VM
+    if (isBinaryOp(instruction.op) || instruction.op == OpCode::FOR_ENTER) {
+        return state.isNone(state.depth - 1) || state.isNone(state.depth - 2);
+    }
+    return false;
+}
+
+// native code has no frame of locals and never hands a result back, so it
+// can only run functions that take no parameters and return nothing
+bool takesOrReturnsValues(const Function& function) {
+    return function.paramCount > 0 || function.returnsValue;
+}
+
+// works out the stack shape at every instruction. false if the function can't
+// be compiled: it touches strings, print, parameters or return values, or its
+// stack doesn't line up
+bool analyze(const Program& program, const Function& function, std::vector<StackState>& states, int& maxDepth) {
+    if (takesOrReturnsValues(function)) { return false; }
+
+    states.assign(function.code.size(), {-1, 0});
+    states[0] = {0, 0};
+    maxDepth = 0;
+
+    std::vector<int> worklist = {0};
+    auto reach = [&](int ip, const StackState& state) {
+        if (ip < 0 || ip >= (int) states.size()) { return false; }
+        if (!states[ip].reached()) {
+            states[ip] = state;
+            worklist.push_back(ip);
+            return true;
+        }
+        return states[ip] == state;
+    };
+
+    while (!worklist.empty()) {
+        int ip = worklist.back();
+        worklist.pop_back();
+        const Instruction& instruction = function.code[ip];
+        StackState state = states[ip];
+
+        // the loop ops work on [counter, limit] and pop them on the way out themselves
+        int pops = 0, needs = 0;
+        switch(instruction.op) {
+            case OpCode::PUSH_STR:
+            case OpCode::STR_CONCAT:
+            case OpCode::PRINT:
+            case OpCode::LOAD_LOCAL:
+            case OpCode::STORE_LOCAL:
+            case OpCode::FOR_SET_LOCAL:
+            case OpCode::TAIL_CALL:
+            case OpCode::SPAWN:
+            case OpCode::JOIN:          { return false; }
+            case OpCode::CALL: {
+                if (takesOrReturnsValues(program.functions[instruction.operand])) { return false; }
+                break;
+            }
+            case OpCode::POP:
+            case OpCode::STORE_SLOT:
+            case OpCode::JUMP_IF_FALSE: { pops = needs = 1; break; }
+            case OpCode::FOR_ENTER:
+            case OpCode::FOR_SET:
+            case OpCode::FOR_NEXT:      { needs = 2; break; }
+            default:                    { pops = needs = isBinaryOp(instruction.op) ? 2 : 0; break; }
+        }
+        if (state.depth < needs) { return false; }
+        if (alwaysBails(instruction, state)) { continue; }
+
+        state.depth -= pops;
+        state.noneMask &= (1u << state.depth) - 1;
+        switch(instruction.op) {
+            case OpCode::PUSH_INT:
+            case OpCode::LOAD_SLOT: { state.depth++; break; }
+            case OpCode::PUSH_NONE:
+            case OpCode::CALL: {
+                state.noneMask |= 1u << state.depth;
+                state.depth++;
+                break;
+            }
+            case OpCode::JUMP: {
+                if (!reach(instruction.operand, state)) { return false; }
+                continue;
+            }
+            case OpCode::JUMP_IF_FALSE: {
+                if (!reach(instruction.operand, state)) { return false; }
+                break;
+            }
+            case OpCode::FOR_ENTER: {
+                StackState exitState = {state.depth - 2, state.noneMask & ((1u << (state.depth - 2)) - 1)};
+                if (!reach(instruction.operand, exitState)) { return false; }
+                break;
+            }
+            case OpCode::FOR_NEXT: {
+                if (!reach(instruction.operand, state)) { return false; }
+                state.depth -= 2;
+                state.noneMask &= (1u << state.depth) - 1;
+                break;
+            }
+            case OpCode::RETURN: { continue; }
+            default: {
+                if (isBinaryOp(instruction.op)) { state.depth++; }
+                break;
+            }
+        }
+        if (state.depth >= JIT_MAX_STACK) { return false; }
+        if (state.depth > maxDepth) { maxDepth = state.depth; }
+        if (!reach(ip + 1, state)) { return false; }
+    }
+    return true;
+}
+
+void jitInterpret(JitContext* context, int functionIdx) {
+    context->vm->interpret(functionIdx);
+}
+
+void jitBail(JitContext* context, int siteIdx) {
+    const Jit::BailSite& site = context->jit->bailSite(siteIdx);
+    Value stackValues[JIT_MAX_STACK];
+    for (int entry = 0; entry < site.depth; entry++) {
+        if (!((site.noneMask >> entry) & 1)) { stackValues[entry] = Value::fromInt(context->bailInts[entry]); }
+    }
+    context->vm->resume(site.function, site.ip, stackValues, site.depth);
+}
+
+// --- Function compiler
+class FunctionCompiler {
+public:
+    FunctionCompiler(Assembler& a, std::vector<Jit::BailSite>& bailSites, std::vector<std::pair<size_t, int>>& callFixups, const std::vector<bool>& compiled)
+        : a(a), bailSites(bailSites), callFixups(callFixups), compiled(compiled) {}
+
+    void compile(int functionIdx, const Function& function, const std::vector<StackState>& states, int maxDepth) {
+        this->functionIdx = functionIdx;
+        int spill = maxDepth > stackRegCount ? (maxDepth - stackRegCount) * 8 : 0;
+        // six pushes leave rsp 8 off 16-byte alignment, the frame makes up for it
+        int frameSize = ((spill + 15) & ~15) + 8;
+        const int32_t depthOffset = (int32_t) offsetof(JitContext, depth);
+
+        const Reg saved[] = {RBX, RBP, R12, R13, R14, R15};
+        for (Reg reg : saved) { a.push(reg); }
+        a.subRsp(frameSize);
+        a.movRR(RBX, RDI, true);
+        a.load(RBP, RBX, (int32_t) offsetof(JitContext, variables), true);
+        a.cmpMem(RBX, depthOffset, JIT_MAX_DEPTH);
+        size_t tooDeep = a.jcc(CC_GE);
+        a.incMem(RBX, depthOffset);
+
+        std::vector<size_t> ipOffsets(function.code.size(), 0);
+        std::vector<std::pair<size_t, int>> jumpFixups;
+        std::vector<size_t> returnFixups;
+        for (int ip = 0; ip < (int) function.code.size(); ip++) {
+            ipOffsets[ip] = a.size();
+            if (!states[ip].reached()) { continue; }
+            compileInstruction(ip, function.code[ip], states[ip], jumpFixups, returnFixups);
+        }
+
+        size_t epilogue = a.size();
+        a.decMem(RBX, depthOffset);
+        size_t leave = a.size();
+        a.addRsp(frameSize);
+        for (int idx = 5; idx >= 0; idx--) { a.pop(saved[idx]); }
+        a.ret();
+
+        // too deep to keep nesting on the C stack, let the VM run it on its own frames
+        a.bind(tooDeep, a.size());
+        a.movRR(RDI, RBX, true);
+        a.movRI(RSI, functionIdx);
+        a.callAbs((const void*) &jitInterpret);
+        a.bind(a.jmp(), leave);
+
+        for (const Stub& stub : stubs) {
+            a.bind(stub.fixup, a.size());
+            const Jit::BailSite& site = bailSites[stub.siteIdx];
+            for (int entry = 0; entry < site.depth; entry++) {
+                if ((site.noneMask >> entry) & 1) { continue; }
+                loadEntry(RAX, entry);
+                a.store(RBX, (int32_t) (offsetof(JitContext, bailInts) + 4 * entry), RAX);
+            }
+            a.movRR(RDI, RBX, true);
+            a.movRI(RSI, stub.siteIdx);
+            a.callAbs((const void*) &jitBail);
+            a.bind(a.jmp(), epilogue);
+        }
+
+        for (const std::pair<size_t, int>& fixup : jumpFixups) { a.bind(fixup.first, ipOffsets[fixup.second]); }
+        for (size_t fixup : returnFixups) { a.bind(fixup, epilogue); }
+    }
+
+private:
+    struct Stub {
+        size_t fixup;
+        int siteIdx;
+    };
+
+    Assembler& a;
+    std::vector<Jit::BailSite>& bailSites;
+    std::vector<std::pair<size_t, int>>& callFixups;
+    const std::vector<bool>& compiled;
+    std::vector<Stub> stubs;
+    int functionIdx = 0;
+
+    void loadEntry(Reg dst, int entry) {
+        if (entry < stackRegCount) {
+            a.movRR(dst, stackRegs[entry]);
+        } else {
+            a.load(dst, RSP, (entry - stackRegCount) * 8);
+        }
+    }
+
+    void storeEntry(int entry, Reg src) {
+        if (entry < stackRegCount) {
+            a.movRR(stackRegs[entry], src);
+        } else {
+            a.store(RSP, (entry - stackRegCount) * 8, src);
+        }
+    }
+
+    // the branch at fixup hands ip over to the VM with the stack as it is in state
+    void bailTo(size_t fixup, int ip, const StackState& state) {
+        stubs.push_back({fixup, (int) bailSites.size()});
+        bailSites.push_back({functionIdx, ip, state.depth, state.noneMask});
+    }
+
+    void compileInstruction(int ip, const Instruction& instruction, const StackState& state, std::vector<std::pair<size_t, int>>& jumpFixups, std::vector<size_t>& returnFixups) {
+        if (alwaysBails(instruction, state)) {
+            bailTo(a.jmp(), ip, state);
+            return;
+        }
+
+        int top = state.depth - 1;
+        int32_t slotOffset = instruction.operand * (int32_t) sizeof(Value);
+        int32_t typeOffset = slotOffset + (int32_t) Value::typeOffset();
+        int32_t intOffset = slotOffset + (int32_t) Value::intOffset();
+        switch(instruction.op) {
+            case OpCode::PUSH_INT: {
+                a.movRI(RAX, instruction.operand);
+                storeEntry(state.depth, RAX);
+                break;
+            }
+            case OpCode::PUSH_NONE:
+            case OpCode::POP: {
+                break;
+            }
+            case OpCode::LOAD_SLOT: {
+                // unset slots (calls, bare words) and strings are the VM's business
+                a.cmpByte(RBP, typeOffset, (uint8_t) ValueType::INT);
+                bailTo(a.jcc(CC_NE), ip, state);
+                a.load(RAX, RBP, intOffset);
+                storeEntry(state.depth, RAX);
+                break;
+            }
+            case OpCode::STORE_SLOT: {
+                // overwriting a string means releasing it, leave that to the VM
+                a.cmpByte(RBP, typeOffset, (uint8_t) ValueType::STR);
+                bailTo(a.jcc(CC_E), ip, state);
+                a.storeByte(RBP, typeOffset, (uint8_t) ValueType::INT);
+                loadEntry(RAX, top);
+                a.store(RBP, intOffset, RAX);
+                break;
+            }
+            case OpCode::CALL: {
+                a.movRR(RDI, RBX, true);
+                if (compiled[instruction.operand]) {
+                    callFixups.push_back({a.call(), instruction.operand});
+                } else {
+                    a.movRI(RSI, instruction.operand);
+                    a.callAbs((const void*) &jitInterpret);
+                }
+                break;
+            }
+            case OpCode::JUMP: {
+                jumpFixups.push_back({a.jmp(), instruction.operand});
+                break;
+            }
+            case OpCode::JUMP_IF_FALSE: {
+                loadEntry(RAX, top);
+                a.test(RAX, RAX);
+                jumpFixups.push_back({a.jcc(CC_E), instruction.operand});
+                break;
+            }
+            case OpCode::FOR_ENTER: {
+                loadEntry(RAX, top - 1);
+                loadEntry(RCX, top);
+                a.cmp(RAX, RCX);
+                jumpFixups.push_back({a.jcc(CC_G), instruction.operand});
+                break;
+            }
+            case OpCode::FOR_SET: {
+                a.cmpByte(RBP, typeOffset, (uint8_t) ValueType::STR);
+                bailTo(a.jcc(CC_E), ip, state);
+                a.storeByte(RBP, typeOffset, (uint8_t) ValueType::INT);
+                loadEntry(RAX, top - 1);
+                a.store(RBP, intOffset, RAX);
+                break;
+            }
+            case OpCode::FOR_NEXT: {
+                // the counter stays in its stack register for the whole loop
+                loadEntry(RAX, top - 1);
+                loadEntry(RCX, top);
+                a.cmp(RAX, RCX);
+                jumpFixups.push_back({a.jcc(CC_E), ip + 1});
+                a.movRI(RCX, 1);
+                a.add(RAX, RCX);
+                storeEntry(top - 1, RAX);
+                jumpFixups.push_back({a.jmp(), instruction.operand});
+                break;
+            }
+            case OpCode::RETURN: {
+                returnFixups.push_back(a.jmp());
+                break;
+            }
+            default: {
+                // binary ops: left in eax, right in ecx, result back into the left entry
+                loadEntry(RAX, top - 1);
+                loadEntry(RCX, top);
+                switch(instruction.op) {
+                    // only ints ever reach native code, so the specialized ops are the same
+                    case OpCode::ADD:
+                    case OpCode::INT_ADD:    { a.add(RAX, RCX); break; }
+                    case OpCode::SUB:
+                    case OpCode::INT_SUB:    { a.sub(RAX, RCX); break; }
+                    case OpCode::MUL:
+                    case OpCode::INT_MUL:    { a.imul(RAX, RCX); break; }
+                    case OpCode::DIV:
+                    case OpCode::INT_DIV:    { a.cdq(); a.idiv(RCX); break; }
+                    case OpCode::IS_LESS:
+                    case OpCode::INT_LT:     { a.cmp(RAX, RCX); a.setcc(CC_L); break; }
+                    case OpCode::IS_LEQ:
+                    case OpCode::INT_LEQ:    { a.cmp(RAX, RCX); a.setcc(CC_LE); break; }
+                    case OpCode::IS_GREATER:
+                    case OpCode::INT_GT:     { a.cmp(RAX, RCX); a.setcc(CC_G); break; }
+                    case OpCode::IS_GEQ:
+                    case OpCode::INT_GEQ:    { a.cmp(RAX, RCX); a.setcc(CC_GE); break; }
+                    default:                 { a.cmp(RAX, RCX); a.setcc(CC_E); break; }
+                }
+                storeEntry(top - 1, RAX);
+                break;
+            }
+        }
+    }
+};
+
+}
+
+Jit::~Jit() {
+    clear();
+}
+
+void Jit::clear() {
+    if (code) { munmap(code, codeSize); }
+    code = nullptr;
+    codeSize = 0;
+    natives.clear();
+    bailSites.clear();
+}
+
+int Jit::compile(const Program& program) {
+    clear();
+    natives.assign(program.functions.size(), nullptr);
+
+    // eligibility first, so calls between compiled functions can be direct
+    std::vector<std::vector<StackState>> states(program.functions.size());
+    std::vector<int> maxDepths(program.functions.size(), 0);
+    std::vector<bool> compiled(program.functions.size(), false);
+    for (size_t functionIdx = 0; functionIdx < program.functions.size(); functionIdx++) {
+        compiled[functionIdx] = !program.functions[functionIdx].code.empty() && analyze(program, program.functions[functionIdx], states[functionIdx], maxDepths[functionIdx]);
+    }
+
+    Assembler a;
+    std::vector<size_t> entries(program.functions.size(), 0);
+    std::vector<std::pair<size_t, int>> callFixups;
+    for (size_t functionIdx = 0; functionIdx < program.functions.size(); functionIdx++) {
+        if (!compiled[functionIdx]) { continue; }
+        entries[functionIdx] = a.size();
+        FunctionCompiler functionCompiler(a, bailSites, callFixups, compiled);
+        functionCompiler.compile((int) functionIdx, program.functions[functionIdx], states[functionIdx], maxDepths[functionIdx]);
+    }
+    for (const std::pair<size_t, int>& fixup : callFixups) { a.bind(fixup.first, entries[fixup.second]); }
+    if (a.bytes.empty()) { return 0; }
+
+    // written while writable, then flipped to executable
+    void* mapped = mmap(nullptr, a.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) { return 0; }
+    std::memcpy(mapped, a.bytes.data(), a.size());
+    if (mprotect(mapped, a.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(mapped, a.size());
+        return 0;
+    }
+    code = mapped;
+    codeSize = a.size();
+
+    int count = 0;
+    for (size_t functionIdx = 0; functionIdx < program.functions.size(); functionIdx++) {
+        if (!compiled[functionIdx]) { continue; }
+        natives[functionIdx] = reinterpret_cast<NativeFunction>(static_cast<char*>(code) + entries[functionIdx]);
+        count++;
+    }
+    return count;
+}
+
+#else
+
+Jit::~Jit() {}
+
+void Jit::clear() {}
+
+int Jit::compile(const Program& program) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef jit_hpp
+#define jit_hpp
+
+#include <stdio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "compiler.hpp"
+#include "value.hpp"
+
+// native code only on x86-64 with POSIX mmap, everywhere else compile() just
+// reports that nothing was compiled and the VM interprets everything
+#if defined(__x86_64__) && (defined(__APPLE__) || defined(__linux__))
+#define RUDDY_JIT 1
+#else
+#define RUDDY_JIT 0
+#endif
+
+class Jit;
+class VM;
+
+// operand stack entries deeper than this make a function ineligible
+const int JIT_MAX_STACK = 32;
+
+// native calls nest on the C stack, past this depth calls go back to the VM
+const int JIT_MAX_DEPTH = 1000;
+
+// what native code gets handed, passed in rdi and kept in rbx
+struct JitContext {
+    Value* variables;
+    VM* vm;
+    const Jit* jit;
+    int32_t depth;
+    int32_t bailInts[JIT_MAX_STACK]; // int stack entries written out before a bail
+};
+
+// --- JIT
+// turns bytecode functions that only do integer work (no PUSH_STR, no PRINT,
+// no parameters or return values) into x86-64. the operand stack lives in r12-r15, deeper entries are spilled
+// to the native frame. every variable read checks the slot holds an int;
+// when a check fails the live stack is written back and the VM picks the
+// function up from that instruction, so nothing is ever run twice
+class Jit {
+public:
+    typedef void (*NativeFunction)(JitContext*);
+
+    // where a native function hands over to the VM
+    struct BailSite {
+        int function;
+        int ip;
+        int depth;
+        uint32_t noneMask; // bit d set if stack entry d is NONE rather than an int
+    };
+
+    Jit() : code(nullptr), codeSize(0) {}
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // compiles every eligible function of the program, returns how many
+    int compile(const Program& program);
+
+    // throws away all native code, every function is interpreted again
+    void clear();
+
+    // nullptr for functions that stay interpreted
+    NativeFunction function(int functionIdx) const { return (size_t) functionIdx < natives.size() ? natives[functionIdx] : nullptr; }
+
+    const BailSite& bailSite(int siteIdx) const { return bailSites[siteIdx]; }
+
+private:
+    void* code;
+    size_t codeSize;
+    std::vector<NativeFunction> natives;
+    std::vector<BailSite> bailSites;
+};
+
+#endif /* jit_hpp */
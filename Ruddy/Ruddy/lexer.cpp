@@ -1,6 +1,151 @@
 #include "lexer.hpp"
 
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RUDDY_LEXER_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RUDDY_LEXER_NEON 1
+#endif
+
+namespace {
+
+enum class CharClass : uint8_t {
+    WORD,     // part of a word or number
+    SPACE,
+    OPERATOR,
+    QUOTE,
+    NEWLINE
+};
+
+struct CharTable {
+    CharClass charClass[256];
+    TokenType operatorType[256];
+
+    CharTable() {
+        for (int c = 0; c < 256; c++) {
+            charClass[c] = CharClass::WORD;
+            operatorType[c] = TokenType::WORD;
+        }
+        charClass[(unsigned char) ' ']  = CharClass::SPACE;
+        charClass[(unsigned char) '\t'] = CharClass::SPACE;
+        charClass[(unsigned char) '\r'] = CharClass::SPACE;
+        charClass[(unsigned char) '\n'] = CharClass::NEWLINE;
+
+        const std::pair<char, TokenType> operators[] = {
+            {'+', TokenType::ADD}, {'-', TokenType::SUB}, {'*', TokenType::MUL}, {'/', TokenType::DIV},
+            {'=', TokenType::EQUAL}, {'<', TokenType::IS_LESS}, {'>', TokenType::IS_GREATER},
+            {'(', TokenType::LEFT_PAREN}, {')', TokenType::RIGHT_PAREN},
+            {'"', TokenType::DOUBLE_QUOTE}, {'\'', TokenType::SINGLE_QUOTE}, {',', TokenType::COMMA},
+        };
+        for (const std::pair<char, TokenType>& op : operators) {
+            charClass[(unsigned char) op.first] = CharClass::OPERATOR;
+            operatorType[(unsigned char) op.first] = op.second;
+        }
+        charClass[(unsigned char) '"']  = CharClass::QUOTE;
+        charClass[(unsigned char) '\''] = CharClass::QUOTE;
+    }
+};
+
+const CharTable charTable;
+
+inline CharClass classOf(char c) { return charTable.charClass[(unsigned char) c]; }
+
+// end of a word: the first char that isn't CharClass::WORD. the SIMD paths
+// flag every byte <= '/' or in '<'..'>' (a superset of the delimiters) and
+// the table sorts out the false positives like '.' or ','
+const char* scanWord(const char* p, const char* end) {
+#if RUDDY_LEXER_SSE2
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i less = _mm_set1_epi8('<');
+    const __m128i two = _mm_set1_epi8(2);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(chunk, slash), chunk);
+        __m128i cmp = _mm_sub_epi8(chunk, less);
+        __m128i compare = _mm_cmpeq_epi8(_mm_min_epu8(cmp, two), cmp);
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(low, compare));
+        while (mask != 0) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (classOf(*candidate) != CharClass::WORD) { return candidate; }
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+#elif RUDDY_LEXER_NEON
+    const uint8x16_t slash = vdupq_n_u8('/');
+    const uint8x16_t less = vdupq_n_u8('<');
+    const uint8x16_t two = vdupq_n_u8(2);
+    while (end - p >= 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        uint8x16_t flagged = vorrq_u8(vcleq_u8(chunk, slash), vcleq_u8(vsubq_u8(chunk, less), two));
+        // narrow to 4 bits per byte so the mask fits a u64
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(flagged), 4)), 0);
+        while (mask != 0) {
+            const char* candidate = p + (__builtin_ctzll(mask) >> 2);
+            if (classOf(*candidate) != CharClass::WORD) { return candidate; }
+            mask &= ~(0xFULL << (__builtin_ctzll(mask) & ~3));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && classOf(*p) == CharClass::WORD) { p++; }
+    return p;
+}
+
+// end of a string literal's body: the next quote or newline
+const char* scanString(const char* p, const char* end) {
+#if RUDDY_LEXER_SSE2
+    const __m128i doubleQuote = _mm_set1_epi8('"');
+    const __m128i singleQuote = _mm_set1_epi8('\'');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, doubleQuote), _mm_cmpeq_epi8(chunk, singleQuote)), _mm_cmpeq_epi8(chunk, newline));
+        unsigned mask = (unsigned) _mm_movemask_epi8(hits);
+        if (mask != 0) { return p + __builtin_ctz(mask); }
+        p += 16;
+    }
+#elif RUDDY_LEXER_NEON
+    const uint8x16_t doubleQuote = vdupq_n_u8('"');
+    const uint8x16_t singleQuote = vdupq_n_u8('\'');
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    while (end - p >= 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(chunk, doubleQuote), vceqq_u8(chunk, singleQuote)), vceqq_u8(chunk, newline));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+        if (mask != 0) { return p + (__builtin_ctzll(mask) >> 2); }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\'' && *p != '\n') { p++; }
+    return p;
+}
+
+}
+
+TokenType classifyToken(std::string_view s) {
+    if (s.empty()) { return TokenType::WORD; }
+    if (s.size() == 2 && s[1] == '=') {
+        if (s[0] == '<') { return TokenType::IS_LEQ; }
+        if (s[0] == '>') { return TokenType::IS_GEQ; }
+        if (s[0] == '=') { return TokenType::IS_EQ; }
+    }
+    if (s.size() == 1 && charTable.operatorType[(unsigned char) s[0]] != TokenType::WORD) {
+        return charTable.operatorType[(unsigned char) s[0]];
+    }
+    return std::isdigit((unsigned char) s[0]) ? TokenType::NUMBER : TokenType::WORD;
+}
 
 std::string printTokenType(TokenType tokenType) {
          if (tokenType == TokenType::ADD) { return "ADD"; }
@@ -17,70 +162,115 @@ std::string printTokenType(TokenType tokenType) {
     else if (tokenType == TokenType::RIGHT_PAREN) { return "RIGHT_PAREN"; }
     else if (tokenType == TokenType::DOUBLE_QUOTE) { return "DOUBLE_QUOTE"; }
     else if (tokenType == TokenType::SINGLE_QUOTE) { return "SINGLE_QUOTE"; }
+    else if (tokenType == TokenType::COMMA) { return "COMMA"; }
     else if (tokenType == TokenType::WORD) { return "WORD"; }
     else if (tokenType == TokenType::NUMBER) { return "NUMBER"; }
     else { return "INVALID_TOKEN"; }
 }
 
 std::string Token::str() const {
-   return printTokenType(tokenType) + " - " + payload;
+   return printTokenType(tokenType) + " - " + std::string(payload);
+}
+
+SourceFile::~SourceFile() {
+    if (mapped) { munmap(const_cast<char*>(mapped), mappedSize); }
+}
+
+bool SourceFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* addr = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            mapped = static_cast<const char*>(addr);
+            mappedSize = (size_t) st.st_size;
+            close(fd);
+            return true;
+        }
+    }
+    close(fd);
+
+    // empty files, pipes and the like just get read in
+    std::ifstream s(path, std::ios::binary);
+    std::stringstream contents;
+    contents << s.rdbuf();
+    buffer = contents.str();
+    return true;
 }
 
-std::vector<Token> tokenize_line(const std::string& line) {
-    std::vector<Token> tokens;
-    
-    std::string curPayload;
+TokenStream tokenize(std::string_view source) {
+    TokenStream stream;
+    stream.tokens.reserve(source.size() / 4);
+
+    const char* p = source.data();
+    const char* end = p + source.size();
     bool inString = false;
-    
-    int strIdx = 0;
-    while(strIdx < line.size()) {
-        char c = line[strIdx];
-        if (
-            (!inString && (c == ' ' || c == '>' || c == '<' || c == '=' || c == '+' || c == '-' || c == '*' || c == '/' || c == '(' || c == ')' || c == '\"' || c == '\'')) ||
-            (inString  && (c == '\"' || c == '\''))
-           ) {
-            if (curPayload.size() > 0) {
-                tokens.push_back(Token(curPayload));
-                curPayload = std::string();
+    SymbolCache symbols;
+
+    while (p < end) {
+        if (inString && *p != '"' && *p != '\'' && *p != '\n') {
+            const char* stringEnd = scanString(p, end);
+            stream.tokens.push_back(Token(std::string_view(p, stringEnd - p)));
+            p = stringEnd;
+            continue;
+        }
+
+        switch (classOf(*p)) {
+            case CharClass::NEWLINE: {
+                stream.lineEnds.push_back((uint32_t) stream.tokens.size());
+                inString = false;
+                p++;
+                break;
+            }
+            case CharClass::SPACE: {
+                p++;
+                break;
             }
-            
-            if (c == '/' && line[strIdx + 1] == '/') {
-                return tokens; // end of line, since rest is comment
+            case CharClass::QUOTE: {
+                stream.tokens.push_back(Token(charTable.operatorType[(unsigned char) *p], std::string_view(p, 1)));
+                inString = !inString;
+                p++;
+                break;
             }
-            
-            if (c != ' ') {
-                std::string temp;
-                temp += c;
-                
-                if ((c == '>' || c == '<' || c == '=') && line[strIdx + 1] == '=') {
-                    temp += line[strIdx + 1];
-                    strIdx++;
+            case CharClass::OPERATOR: {
+                if (*p == '/' && p + 1 < end && p[1] == '/') {
+                    // rest of the line is a comment
+                    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                    p = newline ? newline : end;
+                    break;
                 }
-                
-                tokens.push_back(Token(temp));
+
+                if ((*p == '>' || *p == '<' || *p == '=') && p + 1 < end && p[1] == '=') {
+                    stream.tokens.push_back(Token(classifyToken(std::string_view(p, 2)), std::string_view(p, 2)));
+                    p += 2;
+                } else {
+                    stream.tokens.push_back(Token(charTable.operatorType[(unsigned char) *p], std::string_view(p, 1)));
+                    p++;
+                }
+                break;
             }
-            
-            if (c == '\"' || c == '\'') {
-                inString = !inString;
+            case CharClass::WORD: {
+                const char* wordEnd = scanWord(p + 1, end);
+                std::string_view word(p, wordEnd - p);
+                stream.tokens.push_back(Token(std::isdigit((unsigned char) *p) ? TokenType::NUMBER : TokenType::WORD, symbols.intern(word), word));
+                p = wordEnd;
+                break;
             }
-        } else {
-            curPayload += c;
         }
-        
-        strIdx++;
     }
-    
-    if (curPayload.size() > 0) {
-        tokens.push_back(Token(curPayload));
+
+    // last line has no trailing newline
+    if (source.empty() || source.back() != '\n') {
+        stream.lineEnds.push_back((uint32_t) stream.tokens.size());
     }
 
-    return tokens;
+    return stream;
 }
 
-std::vector<std::vector<Token>> tokenize(const std::vector<std::string>& lines) {
-    std::vector<std::vector<Token>> statements;
-    for (const std::string& line : lines) {
-        statements.push_back(tokenize_line(line));
-    }
-    return statements;
+std::vector<size_t> countTokensByType(const TokenStream& tokens) {
+    std::vector<size_t> byType((size_t) TokenType::NUMBER + 1, 0);
+    for (const Token& token : tokens.tokens) { byType[(size_t) token.tokenType]++; }
+    return byType;
 }
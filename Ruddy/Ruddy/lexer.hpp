@@ -3,10 +3,15 @@
 
 #include <stdio.h>
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum class TokenType {
+#include "arena.hpp"
+#include "symbols.hpp"
+
+enum class TokenType : uint8_t {
     ADD,
     SUB,
     MUL,
@@ -21,38 +26,67 @@ enum class TokenType {
     RIGHT_PAREN,
     DOUBLE_QUOTE,
     SINGLE_QUOTE,
+    COMMA,
     WORD,
     NUMBER
 };
 
+// table-driven: operators are looked up by their first char, anything else is
+// a NUMBER if it starts with a digit and a WORD otherwise
+TokenType classifyToken(std::string_view s);
+
+// payload is a slice of the source buffer, so the source has to outlive its tokens.
+// WORD and NUMBER tokens are interned as they're lexed, everything else has NO_SYMBOL
 struct Token {
     TokenType tokenType;
-    std::string payload;
-
-    Token() : payload("") {}
-    
-    Token(const std::string& s) : payload(s) {
-             if (s == "+")  { tokenType = TokenType::ADD; }
-        else if (s == "-")  { tokenType = TokenType::SUB; }
-        else if (s == "*")  { tokenType = TokenType::MUL; }
-        else if (s == "/")  { tokenType = TokenType::DIV; }
-        else if (s == "=")  { tokenType = TokenType::EQUAL; }
-        else if (s == "<")  { tokenType = TokenType::IS_LESS; }
-        else if (s == "<=") { tokenType = TokenType::IS_LEQ; }
-        else if (s == ">")  { tokenType = TokenType::IS_GREATER; }
-        else if (s == ">=") { tokenType = TokenType::IS_GEQ; }
-        else if (s == "==") { tokenType = TokenType::IS_EQ; }
-        else if (s == "(")  { tokenType = TokenType::LEFT_PAREN; }
-        else if (s == ")")  { tokenType = TokenType::RIGHT_PAREN; }
-        else if (s == "\"") { tokenType = TokenType::DOUBLE_QUOTE; }
-        else if (s == "'")  { tokenType = TokenType::SINGLE_QUOTE; }
-        else if (std::isdigit(s[0])) { tokenType = TokenType::NUMBER; }
-        else { tokenType = TokenType::WORD; }
-    }
-    
+    Symbol symbol;
+    std::string_view payload;
+
+    Token() : tokenType(TokenType::WORD), symbol(NO_SYMBOL) {}
+    Token(TokenType tokenType, std::string_view payload) : tokenType(tokenType), symbol(NO_SYMBOL), payload(payload) {}
+    Token(TokenType tokenType, Symbol symbol, std::string_view payload) : tokenType(tokenType), symbol(symbol), payload(payload) {}
+    explicit Token(std::string_view s) : tokenType(classifyToken(s)), symbol(NO_SYMBOL), payload(s) {}
+
     std::string str() const;
 };
 
-std::vector<std::vector<Token>> tokenize(const std::vector<std::string>& lines);
+// every token of a file in one flat vector, split into source lines by offset
+struct TokenStream {
+    std::vector<Token> tokens;
+    std::vector<uint32_t> lineEnds; // lineEnds[i] is one past the last token of line i
+
+    size_t lineCount() const { return lineEnds.size(); }
+    Span<const Token> line(size_t lineIdx) const {
+        uint32_t lineStart = lineIdx == 0 ? 0 : lineEnds[lineIdx - 1];
+        return Span<const Token>(tokens.data() + lineStart, lineEnds[lineIdx] - lineStart);
+    }
+};
+
+// --- Source
+// read-only view of a script. memory-mapped when possible so the lexer can
+// slice tokens straight out of the page cache
+class SourceFile {
+public:
+    SourceFile() : mapped(nullptr), mappedSize(0) {}
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    bool open(const std::string& path);
+    std::string_view text() const { return mapped ? std::string_view(mapped, mappedSize) : std::string_view(buffer); }
+
+private:
+    const char* mapped;
+    size_t mappedSize;
+    std::string buffer; // fallback when the file can't be mapped
+};
+
+std::string printTokenType(TokenType tokenType);
+
+TokenStream tokenize(std::string_view source);
+
+// how many tokens of each kind there are, indexed by TokenType
+std::vector<size_t> countTokensByType(const TokenStream& tokens);
 
 #endif /* lexer_hpp */
@@ -1,220 +1,283 @@
-#include <iostream>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
-#include <map>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <sys/resource.h>
 
 #include <gflags/gflags.h>
 
+#include "allocations.hpp"
+#include "cache.hpp"
+#include "evaluator.hpp"
 #include "lexer.hpp"
-#include "parser.hpp"
+#include "output.hpp"
+#include "profiler.hpp"
+#include "ruddy.hpp"
 
 DEFINE_string(input_path, "", "Path to test file");
+DEFINE_string(cache_dir, "", "Directory for precompiled .rdc files (default: next to the script)");
+DEFINE_bool(cache, true, "Reuse/write the precompiled .rdc program cache");
+DEFINE_bool(tree_walk, false, "Evaluate with the recursive tree-walker instead of the bytecode VM");
+DEFINE_bool(optimize, true, "Fold constants and drop dead if branches before running");
+DEFINE_bool(dump_ast, false, "Print the tree before and after optimization");
+DEFINE_bool(jit, false, "Compile integer-only functions to native x86-64 code before running them on the VM");
+DEFINE_bool(dump_bytecode, false, "Print the compiled bytecode before running it");
+DEFINE_bool(timing, false, "Print per-phase timings to stderr");
+DEFINE_bool(stats, false, "Print allocations per phase, tokens and tree nodes by type, peak memory and variable table sizes to stderr as one line of JSON");
+DEFINE_int32(parse_threads, 0, "Threads that lex and parse scripts of 256 KB or more, 0 for one per core");
+DEFINE_int32(threads, 0, "Threads that run spawned functions on the VM, 0 for one per core");
+DEFINE_int32(memo_size, 4096, "Entries in the cache of pure function results, 0 turns memoization off");
+DEFINE_bool(profile, false, "Profile the run on the VM: calls and time per function and line go to name.prof next to the script, call stacks for flame graphs to name.folded");
+DEFINE_string(profile_path, "", "Path for the --profile report instead of next to the script, the folded stacks go to the same path plus .folded");
+DEFINE_string(flush, "auto", "When print output is written out: line (after every line), block (when the buffer fills) or auto (line for a terminal, block otherwise)");
 
-std::map<std::string, int> intVariables;
-std::map<std::string, std::string> strVariables;
-std::map<std::string, std::vector<std::vector<std::shared_ptr<Expression>>>> funcExpressions;
-
-// --- Evaluator
-// err, is this the best way? could use union but meh
-enum class ResultType {
-    INT,
-    STR,
-    NONE
-};
+// --- Timing
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-struct Result {
-    int resultInt;
-    std::string resultStr;
-    ResultType resultType; // says which to reference
-};
+// high-water mark of the process's resident memory
+long peakMemoryKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
 
-std::string resultTypeToStr(ResultType resultType) {
-    switch(resultType) {
-        case ResultType::INT:  { return "INT"; }
-        case ResultType::STR:  { return "STR"; }
-        case ResultType::NONE: { return "NONE"; }
+// --- Stats
+std::string jsonString(std::string_view text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
     }
-    return "";
+    return quoted + "\"";
 }
 
-bool is_number(const std::string& s) {
-    return !s.empty() && std::find_if(s.begin(),
-        s.end(), [](unsigned char c) { return !std::isdigit(c); }) == s.end();
+std::string jsonAllocations(const AllocationCount& count) {
+    return "{\"allocations\": " + std::to_string(count.allocations) + ", \"bytes\": " + std::to_string(count.bytes) + "}";
 }
 
-void evaluate(const std::vector<std::vector<std::shared_ptr<Expression>>>& expressions);
-
-Result evaluateLine(const std::vector<std::shared_ptr<Expression>>& expressionLine) {
-    Result result;
-    result.resultType = ResultType::NONE;
-    
-    for (const std::shared_ptr<Expression>& expression : expressionLine) {
-        switch(expression->expressionType) {
-            case ExpressionType::VALUE: {
-                if (intVariables.find(expression->token.payload) != intVariables.end()) {
-                    result.resultType = ResultType::INT;
-                    result.resultInt  = intVariables[expression->token.payload];
-                } else if (strVariables.find(expression->token.payload) != strVariables.end()) {
-                    result.resultType = ResultType::STR;
-                    result.resultStr  = strVariables[expression->token.payload];
-                } else if (funcExpressions.find(expression->token.payload) != funcExpressions.end()) {
-                    evaluate(funcExpressions[expression->token.payload]);
-                } else {
-                    if (is_number(expression->token.payload)) {
-                        result.resultType = ResultType::INT;
-                        result.resultInt  = std::stoi(expression->token.payload);
-                    } else {
-                        result.resultType = ResultType::STR;
-                        result.resultStr  = expression->token.payload;
-                    }
-                }
-                break;
-            }
-            case ExpressionType::ADD: {
-                Result addResultLeft = evaluateLine({expression->left});
-                Result addResultRight = evaluateLine({expression->right});
-                
-                if (addResultLeft.resultType == ResultType::INT) {
-                    result.resultType = ResultType::INT;
-                    result.resultInt  = addResultLeft.resultInt + addResultRight.resultInt;
-                } else {
-                    result.resultType = ResultType::STR;
-                    result.resultStr  = addResultLeft.resultStr + addResultRight.resultStr;
-                }
-                break;
-            }
-            case ExpressionType::SUB: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt - evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::MUL: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt * evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::DIV: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt / evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::IF: {
-                Result boolResult = evaluateLine({expression->conditional});
-                if (boolResult.resultInt) {
-                    evaluate(expression->ifStatements);
-                } else {
-                    evaluate(expression->elseStatements);
-                }
-                break;
-            }
-            case ExpressionType::IS_LESS: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt < evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::IS_LEQ: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt <= evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::IS_GREATER: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt > evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::IS_GEQ: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt >= evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::IS_EQ: {
-                result.resultType = ResultType::INT;
-                result.resultInt  = evaluateLine({expression->left}).resultInt == evaluateLine({expression->right}).resultInt;
-                break;
-            }
-            case ExpressionType::PAREN:  {
-                return evaluateLine(expression->core);
-            }
-            case ExpressionType::PRINT:  {
-                Result printExprResult = evaluateLine(expression->core);
-                if (printExprResult.resultType == ResultType::INT) {
-                    std::cout << printExprResult.resultInt << std::endl;
-                } else {
-                    std::cout << printExprResult.resultStr << std::endl;
-                }
-                break;
-            }
-            case ExpressionType::STRING: {
-                result.resultType = ResultType::STR;
-                result.resultStr  = expression->payload->token.payload;
-                break;
-            }
-            case ExpressionType::VAR: {
-                Result varResult = evaluateLine(expression->core);
-                if (varResult.resultType == ResultType::INT) {
-                    intVariables[expression->var->token.payload] = varResult.resultInt;
-                } else {
-                    strVariables[expression->var->token.payload] = varResult.resultStr;
-                }
-
-                break;
-            }
-            default: break;
-        }
+// {"NAME": count, ...} for every kind, {} if nothing was counted
+template <typename Kind>
+std::string jsonByType(const std::vector<size_t>& byType, std::string (*name)(Kind)) {
+    std::string object = "{";
+    for (size_t kind = 0; kind < byType.size(); kind++) {
+        if (kind > 0) { object += ", "; }
+        object += jsonString(name((Kind) kind)) + ": " + std::to_string(byType[kind]);
     }
-    
-    return result;
+    return object + "}";
 }
 
-void evaluate(const std::vector<std::vector<std::shared_ptr<Expression>>>& expressions) {
-    for (const std::vector<std::shared_ptr<Expression>>& expressionLine : expressions) {
-        evaluateLine(expressionLine);
+// what's in the variable table at the end of the run, the VM's or the tree-walker's
+struct VariableStats {
+    size_t slots = 0;
+    size_t assigned = 0;
+    size_t nameBytes = 0;
+};
+
+// --stats, one line of JSON so runs can be appended to a file and compared
+void printStats(std::string_view source, const ruddy::Program& program, const AllocationCount& readAllocations, const AllocationCount& evalAllocations, const VariableStats& variableStats) {
+    const ruddy::CompileStats& stats = program.stats();
+    size_t instructions = 0;
+    for (const Function& function : program.code().functions) { instructions += function.code.size(); }
+
+    std::string json = "{\"script\": " + jsonString(FLAGS_input_path);
+    json += ", \"bytes\": " + std::to_string(source.size());
+    json += ", \"cache_hit\": " + std::string(stats.cacheHit ? "true" : "false");
+    json += ", \"phases\": {\"read\": " + jsonAllocations(readAllocations);
+    if (FLAGS_cache) {
+        json += ", \"cache\": " + jsonAllocations(stats.cacheAllocations);
+    }
+    json += ", \"tokenize\": " + jsonAllocations(stats.lexAllocations);
+    json += ", \"parse\": " + jsonAllocations(stats.parseAllocations);
+    json += ", \"optimize\": " + jsonAllocations(stats.optimizeAllocations);
+    json += ", \"compile\": " + jsonAllocations(stats.compileAllocations);
+    json += ", \"evaluate\": " + jsonAllocations(evalAllocations) + "}";
+    json += ", \"tokens\": " + jsonByType(stats.tokensByType, printTokenType);
+    json += ", \"nodes\": {\"parsed\": " + jsonByType(stats.parsedByType, printExpressionType);
+    json += ", \"optimized\": " + jsonByType(stats.optimizedByType, printExpressionType) + "}";
+    json += ", \"arena\": {\"used\": " + std::to_string(stats.arenaBytes) + ", \"reserved\": " + std::to_string(stats.arenaReserved) + "}";
+    json += ", \"variables\": {\"slots\": " + std::to_string(variableStats.slots);
+    json += ", \"assigned\": " + std::to_string(variableStats.assigned);
+    json += ", \"value_bytes\": " + std::to_string(variableStats.slots * sizeof(Value));
+    json += ", \"name_bytes\": " + std::to_string(variableStats.nameBytes) + "}";
+    json += ", \"symbols\": " + std::to_string(symbolTable.size());
+    json += ", \"bytecode\": {\"functions\": " + std::to_string(program.code().functions.size());
+    json += ", \"instructions\": " + std::to_string(instructions);
+    json += ", \"strings\": " + std::to_string(program.code().strings.size()) + "}";
+    json += ", \"peak_rss_kb\": " + std::to_string(peakMemoryKb()) + "}";
+    std::cerr << json << std::endl;
+}
+
+// example.rd -> example.prof and example.folded, unless --profile_path says otherwise
+bool writeProfile(const Profiler& profiler, std::string_view source) {
+    std::string reportPath = FLAGS_profile_path;
+    std::string foldedPath = reportPath + ".folded";
+    if (reportPath.empty()) {
+        std::string stem = FLAGS_input_path;
+        if (stem.size() > 3 && stem.compare(stem.size() - 3, 3, ".rd") == 0) { stem.resize(stem.size() - 3); }
+        reportPath = stem + ".prof";
+        foldedPath = stem + ".folded";
+    }
+    std::ofstream report(reportPath), folded(foldedPath);
+    report << profiler.report(source);
+    folded << profiler.foldedStacks();
+    if (!report || !folded) {
+        std::cerr << "could not write the profile to " << reportPath << " and " << foldedPath << std::endl;
+        return false;
     }
+    std::cerr << "profile written to " << reportPath << " and " << foldedPath << std::endl;
+    return true;
 }
 
 // --- Tester
 int main(int argc, char * argv[]) {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
+    countingAllocations = FLAGS_stats;
+    if (!parseFlushPolicy(FLAGS_flush, output)) {
+        std::cerr << "unknown --flush policy " << FLAGS_flush << std::endl;
+        return 1;
+    }
+    flushOutputOnCrash();
+    if (FLAGS_profile && FLAGS_tree_walk) {
+        std::cerr << "--profile only works on the VM, drop --tree_walk" << std::endl;
+        return 1;
+    }
+
+    AllocationCount allocationsBefore = allocationsSoFar();
+    SourceFile source;
+    if (!source.open(FLAGS_input_path)) {
+        std::cerr << "could not open " << FLAGS_input_path << std::endl;
+        return 1;
+    }
+    AllocationCount readAllocations = allocationsSoFar() - allocationsBefore;
+
+    ruddy::CompileOptions options;
+    options.optimize = FLAGS_optimize;
+    options.parseThreads = FLAGS_parse_threads;
+    options.lineNumbers = FLAGS_profile;
+    options.dumpAst = FLAGS_dump_ast;
+    options.countNodes = FLAGS_timing;
+    options.memoryStats = FLAGS_stats;
+    if (FLAGS_cache) {
+        options.cachePath = cachePathFor(FLAGS_input_path, FLAGS_cache_dir);
+    }
+    ruddy::Program program;
+    if (!program.compile(source.text(), options)) {
+        for (const Diagnostic& diagnostic : program.diagnostics()) {
+            std::cerr << FLAGS_input_path << ":" << diagnostic.str() << std::endl;
+        }
+        return 1;
+    }
+    const ruddy::CompileStats& stats = program.stats();
+    if (FLAGS_dump_ast && !stats.cacheHit) {
+        output.write("--- before optimization ---\n");
+        output.write(stats.astBefore);
+        output.write("--- after optimization ---\n");
+        output.write(stats.astAfter);
+    }
+
+    int jitCompiled = 0;
+    uint64_t memoHits = 0, memoMisses = 0;
+    std::unique_ptr<Profiler> profiler;
+    AllocationCount evalAllocations;
+    VariableStats variableStats;
+    for (const std::string& name : program.slots().slotNames) { variableStats.nameBytes += name.size(); }
+    variableStats.slots = program.slots().size();
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    allocationsBefore = allocationsSoFar();
+    if (FLAGS_tree_walk) {
+        // the tree-walker runs on the globals in evaluator.hpp, not on an Interpreter
+        funcExpressions = program.functions();
+        variables.resize(program.slots().size());
+        invalidateNameCaches();
+        memo.resize(std::max(FLAGS_memo_size, 0));
+        callFunction(funcExpressions["main"], ExpressionLine());
+        evalAllocations = allocationsSoFar() - allocationsBefore;
+        memoHits = memo.hits;
+        memoMisses = memo.misses;
+        variableStats.assigned = std::count_if(variables.begin(), variables.end(), [](const Value& value) { return !value.isNone(); });
+    } else {
+        if (FLAGS_dump_bytecode) {
+            output.writeLine(program.code().str());
+        }
+
+        phaseStart = std::chrono::steady_clock::now();
+        allocationsBefore = allocationsSoFar();
+        ruddy::Interpreter interpreter(program, output);
+        interpreter.setJit(FLAGS_jit);
+        interpreter.setMemoSize(std::max(FLAGS_memo_size, 0));
+        interpreter.setThreads(FLAGS_threads > 0 ? FLAGS_threads : std::max((int) std::thread::hardware_concurrency(), 1));
+        if (FLAGS_profile) {
+            std::vector<std::string> functionNames;
+            for (const Function& function : program.code().functions) { functionNames.push_back(function.name); }
+            profiler.reset(new Profiler(std::move(functionNames)));
+            interpreter.setProfiler(profiler.get());
+        }
+        interpreter.run("main");
+        evalAllocations = allocationsSoFar() - allocationsBefore;
+        jitCompiled = interpreter.jitCompiled();
+        memoHits = interpreter.memo().hits;
+        memoMisses = interpreter.memo().misses;
+        for (const std::string& name : program.slots().slotNames) {
+            if (!interpreter.get(name).isNone()) { variableStats.assigned++; }
+        }
+    }
+    double evalMs = elapsedMs(phaseStart);
+    output.flush();
+    if (profiler != nullptr && !writeProfile(*profiler, source.text())) {
+        return 1;
+    }
 
-    std::vector<std::string> lines;
-    
-    std::ifstream s;
-    s.open(FLAGS_input_path);
-    for (std::string line; std::getline(s, line); ) {
-        lines.push_back(line);
+    if (FLAGS_timing) {
+        size_t lineCount = std::count(source.text().begin(), source.text().end(), '\n');
+        if (!source.text().empty() && source.text().back() != '\n') { lineCount++; }
+        std::cerr << "size:     " << source.text().size() << " bytes, " << lineCount << " lines";
+        if (!stats.cacheHit) {
+            std::cerr << ", " << stats.nodes << " nodes";
+        }
+        std::cerr << std::endl;
+        if (FLAGS_cache) {
+            std::cerr << "cache:    " << stats.cacheMs << " ms (" << (stats.cacheHit ? "hit" : "miss") << ")" << std::endl;
+        }
+        std::cerr << "lex:      " << stats.lexMs << " ms" << std::endl;
+        std::cerr << "parse:    " << stats.parseMs << " ms";
+        if (stats.parseThreads > 1) {
+            std::cerr << " (lexed and parsed on " << stats.parseThreads << " threads)";
+        }
+        std::cerr << std::endl;
+        std::cerr << "optimize: " << stats.optimizeMs << " ms" << std::endl;
+        if (!FLAGS_tree_walk) {
+            std::cerr << "compile:  " << stats.compileMs << " ms" << std::endl;
+        }
+        std::cerr << "evaluate: " << evalMs << " ms (" << (FLAGS_tree_walk ? "tree-walker" : "vm") << ")" << std::endl;
+        if (FLAGS_jit && !FLAGS_tree_walk) {
+            std::cerr << "jit:      " << jitCompiled << " of " << program.code().functions.size() << " functions native" << std::endl;
+        }
+        if (FLAGS_memo_size > 0) {
+            std::cerr << "memo:     " << memoHits << " hits, " << memoMisses << " misses" << std::endl;
+        }
+        std::cerr << "memory:   " << peakMemoryKb() << " KB peak" << std::endl;
     }
-    s.close();
-    
-    // basic flow: strings -> tokens -> expressions -> values
-    std::vector<std::vector<Token>> tokens = tokenize(lines);
-    
-    // box up tokens as expressions and do parsing
-    std::vector<std::vector<std::shared_ptr<Expression>>> expressions;
-    for (const std::vector<Token>& tokenLine : tokens) {
-        // for (Token token : tokenLine) {
-        //     std::cout << token.payload << " " << printTokenType(token.tokenType) << std::endl;
-        // }
-        
-        expressions.push_back(wrapTokens(tokenLine));
+    if (FLAGS_stats) {
+        printStats(source.text(), program, readAllocations, evalAllocations, variableStats);
     }
-    parse(funcExpressions, expressions);
-    
-    // for (std::vector<std::shared_ptr<Expression>> expressions : funcExpressions["main"]) {
-    //     for (std::shared_ptr<Expression> expression : expressions) {
-    //         std::cout << expression->str() << std::endl;
-    //     }
-    // }
-    
-    evaluate(funcExpressions["main"]);
-    
-    // std::cout << "--- variables ---" << std::endl;
-    // std::map<std::string, int>::iterator it;
-    // for (it = intVariables.begin(); it != intVariables.end(); it++)
-    // {
-    //     std::cout << it->first    // string (key)
-    //               << ':'
-    //               << it->second   // string's value
-    //               << std::endl;
-    // }
-    
+
     return 0;
 }
@@ -0,0 +1,197 @@
+#include "memo.hpp"
+
+#include <functional>
+#include <map>
+#include <string_view>
+
+namespace {
+
+// false as soon as anything in the tree reads or writes a global or prints.
+// names that are calls are collected in callees, whether those are pure is
+// only known once every function has been looked at
+bool isLocalOnly(const Expression* expression, std::vector<const FunctionDefinition*>& callees);
+
+bool isLocalOnly(const ExpressionLine& expressionLine, std::vector<const FunctionDefinition*>& callees) {
+    for (const Expression* expression : expressionLine) {
+        if (!isLocalOnly(expression, callees)) { return false; }
+    }
+    return true;
+}
+
+bool isLocalOnly(const ExpressionBlock& expressions, std::vector<const FunctionDefinition*>& callees) {
+    for (const ExpressionLine& expressionLine : expressions) {
+        if (!isLocalOnly(expressionLine, callees)) { return false; }
+    }
+    return true;
+}
+
+bool isLocalOnly(const Expression* expression, std::vector<const FunctionDefinition*>& callees) {
+    switch(expression->expressionType) {
+        case ExpressionType::VALUE: {
+            // a name with a slot is a global, even if it falls back to a call
+            // while unassigned. names without one are calls or bare words
+            if (expression->local) { return true; }
+            if (expression->slot >= 0) { return false; }
+            const ValueExpression* value = expression->as<ValueExpression>();
+            if (value->function != nullptr) { callees.push_back(value->function); }
+            return true;
+        }
+        case ExpressionType::STRING:
+        case ExpressionType::INT: {
+            return true;
+        }
+        case ExpressionType::PRINT:
+        case ExpressionType::SPAWN:
+        case ExpressionType::JOIN: {
+            return false;
+        }
+        case ExpressionType::PAREN:
+        case ExpressionType::RETURN: {
+            return isLocalOnly(expression->as<ListExpression>()->core, callees);
+        }
+        case ExpressionType::VAR: {
+            return expression->local && isLocalOnly(expression->as<VarExpression>()->core, callees);
+        }
+        case ExpressionType::IF: {
+            const IfExpression* ifExpr = expression->as<IfExpression>();
+            return (ifExpr->conditional == nullptr || isLocalOnly(ifExpr->conditional, callees))
+                && isLocalOnly(ifExpr->ifStatements, callees) && isLocalOnly(ifExpr->elseStatements, callees);
+        }
+        case ExpressionType::FOR: {
+            const ForExpression* forExpr = expression->as<ForExpression>();
+            return expression->local && isLocalOnly(forExpr->from, callees) && isLocalOnly(forExpr->limit, callees) && isLocalOnly(forExpr->body, callees);
+        }
+        case ExpressionType::WHILE: {
+            const WhileExpression* whileExpr = expression->as<WhileExpression>();
+            return isLocalOnly(whileExpr->conditional, callees) && isLocalOnly(whileExpr->body, callees);
+        }
+        case ExpressionType::CALL: {
+            const CallExpression* call = expression->as<CallExpression>();
+            return isLocalOnly(call->callee, callees) && isLocalOnly(call->args, callees);
+        }
+        default: {
+            const BinaryExpression* binaryExpr = expression->as<BinaryExpression>();
+            return isLocalOnly(binaryExpr->left, callees) && isLocalOnly(binaryExpr->right, callees);
+        }
+    }
+}
+
+uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// same type and same contents. "5" and 5 behave differently under ADD, so
+// they're different keys
+bool sameValue(const Value& a, const Value& b) {
+    if (a.type() != b.type()) { return false; }
+    if (a.isInt()) { return a.asInt() == b.asInt(); }
+    if (a.isStr()) { return a.asStr() == b.asStr(); }
+    return true;
+}
+
+}
+
+PurityFacts purityFacts(const FunctionDefinition& function) {
+    PurityFacts facts;
+    facts.localOnly = isLocalOnly(function.body, facts.callees);
+    return facts;
+}
+
+void markPureFunctions(FunctionTable& funcExpressions) {
+    std::vector<PurityFacts> facts;
+    for (const auto& funcExpression : funcExpressions) {
+        facts.push_back(purityFacts(funcExpression.second));
+    }
+    std::vector<const PurityFacts*> factsByFunction;
+    for (const PurityFacts& functionFacts : facts) {
+        factsByFunction.push_back(&functionFacts);
+    }
+    markPureFunctions(funcExpressions, factsByFunction);
+}
+
+void markPureFunctions(FunctionTable& funcExpressions, const std::vector<const PurityFacts*>& facts) {
+    // optimistic to begin with, so mutually recursive functions can be pure;
+    // then anything calling an impure function is knocked out until nothing changes
+    size_t functionIdx = 0;
+    for (auto& funcExpression : funcExpressions) {
+        funcExpression.second.pure = facts[functionIdx++]->localOnly;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        functionIdx = 0;
+        for (auto& funcExpression : funcExpressions) {
+            FunctionDefinition& function = funcExpression.second;
+            const PurityFacts& functionFacts = *facts[functionIdx++];
+            if (!function.pure) { continue; }
+            for (const FunctionDefinition* callee : functionFacts.callees) {
+                if (!callee->pure) {
+                    function.pure = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void MemoCache::resize(size_t capacity) {
+    size_t bucketCount = 0;
+    if (capacity > 0) {
+        bucketCount = 1;
+        while (bucketCount < capacity) { bucketCount *= 2; }
+    }
+    buckets.clear();
+    buckets.resize(bucketCount);
+}
+
+void MemoCache::clear() {
+    for (Entry& entry : buckets) {
+        entry.function = nullptr;
+        entry.args.clear();
+        entry.result = Value();
+    }
+    hits = misses = 0;
+}
+
+uint64_t MemoCache::hashCall(const void* function, const Value* args, size_t count) {
+    uint64_t h = mix((uint64_t) (uintptr_t) function);
+    for (size_t argIdx = 0; argIdx < count; argIdx++) {
+        uint64_t argHash = (uint64_t) args[argIdx].type();
+        if (args[argIdx].isInt()) {
+            argHash ^= (uint64_t) (uint32_t) args[argIdx].asInt() << 8;
+        } else if (args[argIdx].isStr()) {
+            argHash ^= std::hash<std::string_view>()(args[argIdx].asStr());
+        }
+        h = mix(h ^ (argHash * 0x9E3779B97F4A7C15ULL));
+    }
+    return h;
+}
+
+const Value* MemoCache::find(const void* function, const Value* args, size_t count) {
+    uint64_t hash = hashCall(function, args, count);
+    const Entry& entry = buckets[hash & (buckets.size() - 1)];
+    bool found = entry.function == function && entry.hash == hash && entry.args.size() == count;
+    for (size_t argIdx = 0; found && argIdx < count; argIdx++) {
+        found = sameValue(entry.args[argIdx], args[argIdx]);
+    }
+    if (!found) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return &entry.result;
+}
+
+void MemoCache::insert(const void* function, const Value* args, size_t count, const Value& result) {
+    uint64_t hash = hashCall(function, args, count);
+    Entry& entry = buckets[hash & (buckets.size() - 1)];
+    entry.function = function;
+    entry.hash = hash;
+    entry.args.assign(args, args + count);
+    entry.result = result;
+}
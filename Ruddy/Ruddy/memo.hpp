@@ -0,0 +1,65 @@
+#ifndef memo_hpp
+#define memo_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "parser.hpp"
+#include "value.hpp"
+
+// --- Purity analysis
+// sets FunctionDefinition::pure on every function whose result depends on
+// nothing but its arguments: it doesn't print, doesn't read or assign any
+// global (parameters are fine) and only calls other pure functions. has to
+// run after resolve(), which is what tells locals and globals apart
+void markPureFunctions(FunctionTable& funcExpressions);
+
+// what markPureFunctions() works out about each function on its own: whether
+// it touches anything but its parameters, and which functions it calls.
+// they only change with the function's tree, so a reload (see
+// ruddy::Program::reload()) keeps them for the functions it didn't touch
+// and passes them in, one per function in table order
+struct PurityFacts {
+    bool localOnly = false;
+    std::vector<const FunctionDefinition*> callees;
+};
+PurityFacts purityFacts(const FunctionDefinition& function);
+void markPureFunctions(FunctionTable& funcExpressions, const std::vector<const PurityFacts*>& facts);
+
+// --- Memo cache
+// results of pure function calls keyed on the function and its argument
+// values. direct-mapped: an insert overwrites whatever was in its bucket, so
+// the cache never holds more than its capacity however many distinct calls
+// a script makes. functions are opaque keys, the VM and the tree-walker each
+// use their own kind of pointer
+class MemoCache {
+public:
+    // rounded up to a power of two. 0 turns memoization off
+    void resize(size_t capacity);
+    void clear();
+    bool enabled() const { return !buckets.empty(); }
+    size_t capacity() const { return buckets.size(); }
+
+    // nullptr on a miss
+    const Value* find(const void* function, const Value* args, size_t count);
+    void insert(const void* function, const Value* args, size_t count, const Value& result);
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+private:
+    struct Entry {
+        const void* function = nullptr; // nullptr while the bucket is empty
+        uint64_t hash = 0;
+        std::vector<Value> args;
+        Value result;
+    };
+
+    static uint64_t hashCall(const void* function, const Value* args, size_t count);
+
+    std::vector<Entry> buckets;
+};
+
+#endif /* memo_hpp */
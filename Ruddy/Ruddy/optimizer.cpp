@@ -0,0 +1,191 @@
+#include "optimizer.hpp"
+
+#include <climits>
+#include <vector>
+
+#include "evaluator.hpp"
+#include "types.hpp"
+#include "value.hpp"
+
+namespace {
+
+class Optimizer {
+public:
+    explicit Optimizer(Arena& arena) : arena(arena) {}
+
+    ExpressionBlock optimizeBlock(const ExpressionBlock& expressions) {
+        std::vector<ExpressionLine> lines;
+        lines.reserve(expressions.size());
+        bool changed = false;
+        for (const ExpressionLine& expressionLine : expressions) {
+            optimizeLine(expressionLine);
+
+            // parse() gives every if a line of its own, so a dead one can be
+            // swapped for the lines of the branch that's always taken
+            Value condition;
+            if (expressionLine.size() == 1 && expressionLine[0]->expressionType == ExpressionType::IF && constantValue(expressionLine[0]->as<IfExpression>()->conditional, condition)) {
+                const IfExpression* ifExpr = expressionLine[0]->as<IfExpression>();
+                const ExpressionBlock& taken = condition.asInt() ? ifExpr->ifStatements : ifExpr->elseStatements;
+                lines.insert(lines.end(), taken.begin(), taken.end());
+                changed = true;
+            } else if (expressionLine.size() == 1 && expressionLine[0]->expressionType == ExpressionType::WHILE && constantValue(expressionLine[0]->as<WhileExpression>()->conditional, condition) && !condition.asInt()) {
+                // same for a loop that never runs
+                changed = true;
+            } else {
+                lines.push_back(expressionLine);
+            }
+        }
+        return changed ? arena.copy(lines) : expressions;
+    }
+
+private:
+    void optimizeLine(const ExpressionLine& expressionLine) {
+        for (Expression*& expression : expressionLine) {
+            expression = optimizeExpression(expression);
+        }
+    }
+
+    Expression* optimizeExpression(Expression* expression) {
+        switch(expression->expressionType) {
+            case ExpressionType::VALUE: {
+                // variables and calls stay, anything else is a literal
+                std::string_view payload = expression->as<ValueExpression>()->payload;
+                if (expression->slot >= 0 || expression->as<ValueExpression>()->function != nullptr) {
+                    return expression;
+                }
+                if (is_number(payload)) {
+                    int decoded;
+                    // out-of-range literals are left for the backends to deal with
+                    return decodeInt(payload, decoded) ? arena.make<IntExpression>(decoded) : expression;
+                }
+                return arena.make<StringExpression>(payload);
+            }
+            case ExpressionType::PAREN: {
+                // a group of constants is worth its last value
+                const ExpressionLine& core = expression->as<ListExpression>()->core;
+                optimizeLine(core);
+                for (const Expression* item : core) {
+                    if (!isConstant(item)) { return expression; }
+                }
+                return core.empty() ? expression : core.back();
+            }
+            case ExpressionType::PRINT:
+            case ExpressionType::RETURN: {
+                optimizeLine(expression->as<ListExpression>()->core);
+                return expression;
+            }
+            case ExpressionType::CALL:
+            case ExpressionType::SPAWN: {
+                optimizeLine(expression->as<CallExpression>()->args);
+                return expression;
+            }
+            case ExpressionType::VAR: {
+                optimizeLine(expression->as<VarExpression>()->core);
+                return expression;
+            }
+            case ExpressionType::IF: {
+                IfExpression* ifExpr = expression->as<IfExpression>();
+                ifExpr->conditional = optimizeExpression(ifExpr->conditional);
+                ifExpr->ifStatements = optimizeBlock(ifExpr->ifStatements);
+                ifExpr->elseStatements = optimizeBlock(ifExpr->elseStatements);
+                return expression;
+            }
+            case ExpressionType::FOR: {
+                ForExpression* forExpr = expression->as<ForExpression>();
+                forExpr->from = optimizeExpression(forExpr->from);
+                forExpr->limit = optimizeExpression(forExpr->limit);
+                forExpr->body = optimizeBlock(forExpr->body);
+                return expression;
+            }
+            case ExpressionType::WHILE: {
+                WhileExpression* whileExpr = expression->as<WhileExpression>();
+                whileExpr->conditional = optimizeExpression(whileExpr->conditional);
+                whileExpr->body = optimizeBlock(whileExpr->body);
+                return expression;
+            }
+            case ExpressionType::STRING:
+            case ExpressionType::INT:
+            case ExpressionType::JOIN: {
+                return expression;
+            }
+            default: {
+                BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+                binaryOp->left = optimizeExpression(binaryOp->left);
+                binaryOp->right = optimizeExpression(binaryOp->right);
+                if (!isConstant(binaryOp->left) || !isConstant(binaryOp->right)) { return expression; }
+                Value left, right, folded;
+                if (constantValue(binaryOp->left, left) && constantValue(binaryOp->right, right) && foldBinary(expression->expressionType, left, right, folded)) {
+                    return makeConstant(folded);
+                }
+                return expression;
+            }
+        }
+    }
+
+    static bool isConstant(const Expression* expression) {
+        return expression->expressionType == ExpressionType::INT || expression->expressionType == ExpressionType::STRING;
+    }
+
+    static bool constantValue(const Expression* expression, Value& value) {
+        if (expression->expressionType == ExpressionType::INT) {
+            value = Value::fromInt(expression->as<IntExpression>()->value);
+            return true;
+        } else if (expression->expressionType == ExpressionType::STRING) {
+            value = Value::fromStr(std::string(expression->as<StringExpression>()->payload));
+            return true;
+        }
+        return false;
+    }
+
+    Expression* makeConstant(const Value& value) {
+        if (value.isInt()) { return arena.make<IntExpression>(value.asInt()); }
+        return arena.make<StringExpression>(arena.copy(value.asStr()));
+    }
+
+    // same rules as evaluateExpression(). ints wrap instead of overflowing, and
+    // division by zero is left for run time
+    static bool foldBinary(ExpressionType expressionType, const Value& left, const Value& right, Value& folded) {
+        unsigned int l = (unsigned int) left.asInt(), r = (unsigned int) right.asInt();
+        switch(expressionType) {
+            case ExpressionType::ADD: {
+                folded = left.isInt() ? Value::fromInt((int) (l + r)) : Value::concat(left, right);
+                return true;
+            }
+            case ExpressionType::SUB:        { folded = Value::fromInt((int) (l - r)); return true; }
+            case ExpressionType::MUL:        { folded = Value::fromInt((int) (l * r)); return true; }
+            case ExpressionType::DIV: {
+                if (right.asInt() == 0 || (left.asInt() == INT_MIN && right.asInt() == -1)) { return false; }
+                folded = Value::fromInt(left.asInt() / right.asInt());
+                return true;
+            }
+            case ExpressionType::IS_LESS:    { folded = Value::fromInt(left.asInt() <  right.asInt()); return true; }
+            case ExpressionType::IS_LEQ:     { folded = Value::fromInt(left.asInt() <= right.asInt()); return true; }
+            case ExpressionType::IS_GREATER: { folded = Value::fromInt(left.asInt() >  right.asInt()); return true; }
+            case ExpressionType::IS_GEQ:     { folded = Value::fromInt(left.asInt() >= right.asInt()); return true; }
+            case ExpressionType::IS_EQ:      { folded = Value::fromInt(left.asInt() == right.asInt()); return true; }
+            default: return false;
+        }
+    }
+
+    Arena& arena;
+};
+
+}
+
+void optimize(Arena& arena, FunctionTable& funcExpressions) {
+    Optimizer optimizer(arena);
+    for (std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        function.second.body = optimizer.optimizeBlock(function.second.body);
+    }
+    // a spawn in a branch that was just dropped doesn't count
+    bool sharedGlobals = spawnsTasks(funcExpressions);
+    for (std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        specializeTypes(function.second, sharedGlobals);
+    }
+}
+
+void optimize(Arena& arena, FunctionDefinition& function, bool sharedGlobals) {
+    Optimizer optimizer(arena);
+    function.body = optimizer.optimizeBlock(function.body);
+    specializeTypes(function, sharedGlobals);
+}
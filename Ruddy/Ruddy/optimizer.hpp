@@ -0,0 +1,23 @@
+#ifndef optimizer_hpp
+#define optimizer_hpp
+
+#include <stdio.h>
+
+#include "arena.hpp"
+#include "parser.hpp"
+
+// --- Optimizer
+// rewrites the resolved tree once before it's compiled or walked:
+// - integer literals become INT nodes holding the decoded value
+// - arithmetic, comparisons and string concatenation on constants are folded
+// - an if whose condition is constant is replaced by the branch it would take
+// - arithmetic and comparisons whose operand types are certain become their
+//   specialized nodes, see types.hpp
+// a name only counts as a constant if nothing assigns to it and it isn't a
+// function, so this has to run after resolve()
+void optimize(Arena& arena, FunctionTable& funcExpressions);
+// just the one function, for a reload (see ruddy::Program::reload()).
+// sharedGlobals if any function in the table spawns (see spawnsTasks())
+void optimize(Arena& arena, FunctionDefinition& function, bool sharedGlobals);
+
+#endif /* optimizer_hpp */
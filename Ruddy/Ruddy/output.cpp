@@ -0,0 +1,122 @@
+#include "output.hpp"
+
+#include <csignal>
+#include <cstring>
+
+#include <signal.h>
+#include <unistd.h>
+
+OutputSink output(STDOUT_FILENO);
+
+OutputSink::OutputSink(int fd, size_t capacity) : fd(fd), policy(FlushPolicy::BLOCK), buffer(capacity), used(0), shared(false) {}
+
+OutputSink::OutputSink(Writer writer, size_t capacity) : fd(-1), writer(std::move(writer)), policy(FlushPolicy::BLOCK), buffer(capacity), used(0), shared(false) {}
+
+void OutputSink::setPolicyForTerminal() {
+    policy = fd >= 0 && isatty(fd) ? FlushPolicy::LINE : FlushPolicy::BLOCK;
+}
+
+void OutputSink::write(std::string_view text) {
+    if (used + text.size() > buffer.size()) {
+        flush();
+        // anything bigger than the whole buffer goes straight out
+        if (text.size() > buffer.size()) {
+            send(text.data(), text.size());
+            return;
+        }
+    }
+    memcpy(buffer.data() + used, text.data(), text.size());
+    used += text.size();
+}
+
+void OutputSink::writeLine(std::string_view text) {
+    std::unique_lock<std::mutex> guard(lineLock, std::defer_lock);
+    if (shared) { guard.lock(); }
+    write(text);
+    endLine();
+}
+
+void OutputSink::writeLine(int i) {
+    // digits come out backwards, build them at the end of a scratch buffer.
+    // unsigned so INT_MIN negates cleanly
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    unsigned int magnitude = i < 0 ? 0u - (unsigned int) i : (unsigned int) i;
+    do {
+        *--start = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (i < 0) { *--start = '-'; }
+
+    std::unique_lock<std::mutex> guard(lineLock, std::defer_lock);
+    if (shared) { guard.lock(); }
+    write(std::string_view(start, end - start));
+    endLine();
+}
+
+void OutputSink::endLine() {
+    if (used == buffer.size()) { flush(); }
+    buffer[used++] = '\n';
+    if (policy == FlushPolicy::LINE) { flush(); }
+}
+
+void OutputSink::flush() {
+    send(buffer.data(), used);
+    used = 0;
+}
+
+void OutputSink::send(const char* data, size_t size) {
+    if (fd < 0) {
+        if (size > 0 && writer) { writer(std::string_view(data, size)); }
+        return;
+    }
+    for (size_t written = 0; written < size; ) {
+        ssize_t n = ::write(fd, data + written, size - written);
+        if (n <= 0) { return; }
+        written += n;
+    }
+}
+
+bool parseFlushPolicy(std::string_view name, OutputSink& sink) {
+    if (name == "auto") {
+        sink.setPolicyForTerminal();
+    } else if (name == "line") {
+        sink.setPolicy(FlushPolicy::LINE);
+    } else if (name == "block") {
+        sink.setPolicy(FlushPolicy::BLOCK);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+void flushAndDie(int signal) {
+    output.flush();
+    // put the default action back and let it happen, so the exit status
+    // still says what went wrong
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+}
+
+void flushOutputOnCrash() {
+    // the tree-walker dies of a SIGSEGV when it runs out of stack, and the
+    // handler needs a stack of its own to run on then
+    static char handlerStack[64 * 1024];
+    stack_t altStack = {};
+    altStack.ss_sp = handlerStack;
+    altStack.ss_size = sizeof(handlerStack);
+    sigaltstack(&altStack, nullptr);
+
+    struct sigaction action = {};
+    action.sa_handler = flushAndDie;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (int signal : {SIGFPE, SIGSEGV, SIGBUS, SIGABRT}) {
+        sigaction(signal, &action, nullptr);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef output_hpp
+#define output_hpp
+
+#include <stdio.h>
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+enum class FlushPolicy {
+    LINE,  // write(2) after every line, for a terminal
+    BLOCK  // only when the buffer fills up or on flush()
+};
+
+// --- Output sink
+// where print goes. lines are collected in one big buffer and handed to the
+// kernel in as few write calls as the flush policy allows; ints are
+// formatted straight into the buffer rather than through iostreams
+class OutputSink {
+public:
+    // gets each chunk of output as it's flushed, for hosts that want it
+    // somewhere other than a file descriptor
+    typedef std::function<void(std::string_view)> Writer;
+
+    explicit OutputSink(int fd, size_t capacity = 64 * 1024);
+    explicit OutputSink(Writer writer, size_t capacity = 64 * 1024);
+    ~OutputSink() { flush(); }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // LINE if the fd is a terminal, BLOCK otherwise
+    void setPolicy(FlushPolicy policy) { this->policy = policy; }
+    void setPolicyForTerminal();
+
+    // shared: several threads print at once. each line then goes in whole,
+    // under a lock that a single-threaded run never takes
+    void setShared(bool shared) { this->shared = shared; }
+    bool isShared() const { return shared; }
+
+    void write(std::string_view text);
+    void writeLine(std::string_view text);
+    void writeLine(int i);
+
+    // only calls write(2) when writing to a file descriptor, so it's safe
+    // from a signal handler
+    void flush();
+
+private:
+    void endLine();
+    void send(const char* data, size_t size);
+
+    int fd;       // -1 when writer is set
+    Writer writer;
+    FlushPolicy policy;
+    std::vector<char> buffer;
+    size_t used;
+
+    bool shared;
+    std::mutex lineLock;
+};
+
+// stdout. flushed when it's destroyed at exit
+extern OutputSink output;
+
+// parses --flush ("auto", "line" or "block"), false for anything else
+bool parseFlushPolicy(std::string_view name, OutputSink& sink);
+
+// flushes `output` before the process dies of a fatal signal (division by
+// zero, running out of stack), so nothing printed before the crash is lost
+void flushOutputOnCrash();
+
+#endif /* output_hpp */
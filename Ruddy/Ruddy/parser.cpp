@@ -1,9 +1,8 @@
 #include "parser.hpp"
 
+#include <algorithm>
 #include <iostream>
 
-std::vector<std::shared_ptr<Expression>> parseLine(const std::vector<std::shared_ptr<Expression>> expressions);
-
 std::string printExpressionType(ExpressionType tokenType) {
          if (tokenType == ExpressionType::VALUE)      { return "VALUE"; }
     else if (tokenType == ExpressionType::ADD)        { return "ADD"; }
@@ -11,59 +10,134 @@ std::string printExpressionType(ExpressionType tokenType) {
     else if (tokenType == ExpressionType::MUL)        { return "MUL"; }
     else if (tokenType == ExpressionType::DIV)        { return "DIV"; }
     else if (tokenType == ExpressionType::IF)         { return "IF"; }
+    else if (tokenType == ExpressionType::FOR)        { return "FOR"; }
+    else if (tokenType == ExpressionType::WHILE)      { return "WHILE"; }
+    else if (tokenType == ExpressionType::CALL)       { return "CALL"; }
+    else if (tokenType == ExpressionType::RETURN)     { return "RETURN"; }
+    else if (tokenType == ExpressionType::SPAWN)      { return "SPAWN"; }
+    else if (tokenType == ExpressionType::JOIN)       { return "JOIN"; }
     else if (tokenType == ExpressionType::IS_LESS)    { return "IS_LESS"; }
     else if (tokenType == ExpressionType::IS_LEQ)     { return "IS_LEQ"; }
     else if (tokenType == ExpressionType::IS_GREATER) { return "IS_GREATER"; }
     else if (tokenType == ExpressionType::IS_GEQ)     { return "IS_GEQ"; }
     else if (tokenType == ExpressionType::IS_EQ)      { return "IS_EQ"; }
+    else if (tokenType == ExpressionType::INT_ADD)    { return "INT_ADD"; }
+    else if (tokenType == ExpressionType::INT_SUB)    { return "INT_SUB"; }
+    else if (tokenType == ExpressionType::INT_MUL)    { return "INT_MUL"; }
+    else if (tokenType == ExpressionType::INT_DIV)    { return "INT_DIV"; }
+    else if (tokenType == ExpressionType::INT_LT)     { return "INT_LT"; }
+    else if (tokenType == ExpressionType::INT_LEQ)    { return "INT_LEQ"; }
+    else if (tokenType == ExpressionType::INT_GT)     { return "INT_GT"; }
+    else if (tokenType == ExpressionType::INT_GEQ)    { return "INT_GEQ"; }
+    else if (tokenType == ExpressionType::INT_EQ)     { return "INT_EQ"; }
+    else if (tokenType == ExpressionType::STR_CONCAT) { return "STR_CONCAT"; }
     else if (tokenType == ExpressionType::PAREN)      { return "PAREN"; }
-    else if (tokenType == ExpressionType::PAREN)      { return "VAR"; }
+    else if (tokenType == ExpressionType::VAR)        { return "VAR"; }
     else if (tokenType == ExpressionType::STRING)     { return "STRING"; }
+    else if (tokenType == ExpressionType::INT)        { return "INT"; }
     else if (tokenType == ExpressionType::PRINT)      { return "PRINT"; }
     else { return "INVALID_EXPRESSION"; }
 }
 
+namespace {
+
+// one line per statement, each followed by a newline
+std::string blockStr(const ExpressionBlock& block) {
+    std::string representation;
+    for (const ExpressionLine& expressions : block) {
+        for (const Expression* expression : expressions) {
+            representation += expression->str();
+        }
+        representation += '\n';
+    }
+    return representation;
+}
+
+}
+
 std::string Expression::str() const {
-    if (expressionType == ExpressionType::VALUE)      { return "<" + token.str() + ">"; }
+    if (expressionType == ExpressionType::VALUE)      {
+        const ValueExpression* value = as<ValueExpression>();
+        return "<" + printTokenType(value->tokenType) + " - " + std::string(value->payload) + ">";
+    }
     else if (expressionType == ExpressionType::PAREN) {
         std::string representation;
         representation = "(";
-        for (std::shared_ptr<Expression> expression : core) {
+        for (const Expression* expression : as<ListExpression>()->core) {
             representation += expression->str();
         }
         representation += ")";
         return representation;
     }
-    else if (expressionType == ExpressionType::MUL)        { return "<" + left->str() + "> * <" + right->str() + ">";  }
-    else if (expressionType == ExpressionType::DIV)        { return "<" + left->str() + "> / <" + right->str() + ">";  }
-    else if (expressionType == ExpressionType::ADD)        { return "<" + left->str() + "> + <" + right->str() + ">";  }
-    else if (expressionType == ExpressionType::SUB)        { return "<" + left->str() + "> - <" + right->str() + ">";  }
+    else if (expressionType == ExpressionType::MUL)        { return "<" + as<BinaryExpression>()->left->str() + "> * <" + as<BinaryExpression>()->right->str() + ">";  }
+    else if (expressionType == ExpressionType::DIV)        { return "<" + as<BinaryExpression>()->left->str() + "> / <" + as<BinaryExpression>()->right->str() + ">";  }
+    else if (expressionType == ExpressionType::ADD)        { return "<" + as<BinaryExpression>()->left->str() + "> + <" + as<BinaryExpression>()->right->str() + ">";  }
+    else if (expressionType == ExpressionType::SUB)        { return "<" + as<BinaryExpression>()->left->str() + "> - <" + as<BinaryExpression>()->right->str() + ">";  }
     else if (expressionType == ExpressionType::IF)         {
+        const IfExpression* ifExpr = as<IfExpression>();
         std::string representation;
         representation = "if ";
-        representation += conditional->str();
+        representation += ifExpr->conditional->str();
         representation += '\n';
-        for (std::vector<std::shared_ptr<Expression>> expressions : ifStatements) {
-            for (std::shared_ptr<Expression> expression : expressions) {
-                representation += expression->str();
-            }
-            representation += '\n';
+        representation += blockStr(ifExpr->ifStatements);
+        if (!ifExpr->elseStatements.empty()) {
+            representation += "else\n";
+            representation += blockStr(ifExpr->elseStatements);
         }
-        
+        representation += "endif";
+
+        return representation;
+    }
+    else if (expressionType == ExpressionType::FOR)        {
+        const ForExpression* forExpr = as<ForExpression>();
+        return "for " + forExpr->var->str() + " = " + forExpr->from->str() + " to " + forExpr->limit->str() + "\n" + blockStr(forExpr->body) + "endfor";
+    }
+    else if (expressionType == ExpressionType::WHILE)      {
+        const WhileExpression* whileExpr = as<WhileExpression>();
+        return "while " + whileExpr->conditional->str() + "\n" + blockStr(whileExpr->body) + "endwhile";
+    }
+    else if (expressionType == ExpressionType::CALL || expressionType == ExpressionType::SPAWN) {
+        const CallExpression* call = as<CallExpression>();
+        std::string representation = (expressionType == ExpressionType::SPAWN ? "spawn " : "") + std::string(call->callee->payload) + "(";
+        for (uint32_t argIdx = 0; argIdx < call->args.size(); argIdx++) {
+            representation += (argIdx > 0 ? ", " : "") + call->args[argIdx]->str();
+        }
+        return representation + ")";
+    }
+    else if (expressionType == ExpressionType::RETURN)     {
+        std::string representation = "return";
+        for (const Expression* expression : as<ListExpression>()->core) {
+            representation += " " + expression->str();
+        }
+        return representation;
+    }
+    else if (expressionType == ExpressionType::JOIN)       { return "join"; }
+    else if (expressionType == ExpressionType::IS_LESS)    { return "<" + as<BinaryExpression>()->left->str() + "> < <" + as<BinaryExpression>()->right->str() + ">";  }
+    else if (expressionType == ExpressionType::IS_LEQ)     { return "<" + as<BinaryExpression>()->left->str() + "> <= <" + as<BinaryExpression>()->right->str() + ">"; }
+    else if (expressionType == ExpressionType::IS_GREATER) { return "<" + as<BinaryExpression>()->left->str() + "> > <" + as<BinaryExpression>()->right->str() + ">";  }
+    else if (expressionType == ExpressionType::IS_GEQ)     { return "<" + as<BinaryExpression>()->left->str() + "> >= <" + as<BinaryExpression>()->right->str() + ">"; }
+    else if (expressionType == ExpressionType::IS_EQ)      { return "<" + as<BinaryExpression>()->left->str() + "> == <" + as<BinaryExpression>()->right->str() + ">"; }
+    else if (expressionType >= ExpressionType::INT_ADD && expressionType <= ExpressionType::STR_CONCAT) {
+        // the kind in place of the operator, so --dump_ast shows what was specialized
+        return "<" + as<BinaryExpression>()->left->str() + "> " + printExpressionType(expressionType) + " <" + as<BinaryExpression>()->right->str() + ">";
+    }
+    else if (expressionType == ExpressionType::STRING)     { return "\"" + std::string(as<StringExpression>()->payload) + "\""; }
+    else if (expressionType == ExpressionType::INT)        { return "<INT - " + std::to_string(as<IntExpression>()->value) + ">"; }
+    else if (expressionType == ExpressionType::PRINT)      {
+        std::string representation;
+        representation = "print(";
+        for (const Expression* expression : as<ListExpression>()->core) {
+            representation += expression->str();
+        }
+        representation += ")";
         return representation;
     }
-    else if (expressionType == ExpressionType::IS_LESS)    { return "<" + left->str() + "> < <" + right->str() + ">";  }
-    else if (expressionType == ExpressionType::IS_LEQ)     { return "<" + left->str() + "> <= <" + right->str() + ">"; }
-    else if (expressionType == ExpressionType::IS_GREATER) { return "<" + left->str() + "> > <" + right->str() + ">";  }
-    else if (expressionType == ExpressionType::IS_GEQ)     { return "<" + left->str() + "> >= <" + right->str() + ">"; }
-    else if (expressionType == ExpressionType::IS_EQ)      { return "<" + left->str() + "> == <" + right->str() + ">"; }
-    else if (expressionType == ExpressionType::STRING)     { return "\"" + payload->token.payload + "\""; }
-    else if (expressionType == ExpressionType::PRINT)      { return "print(" + printExpressionType(core[0]->expressionType) + ")"; }
     else if (expressionType == ExpressionType::VAR)   {
+        const VarExpression* varExpr = as<VarExpression>();
         std::string representation;
-        representation += var->str();
+        representation += varExpr->var->str();
         representation += " = ";
-        for (std::shared_ptr<Expression> expression : core) {
+        for (const Expression* expression : varExpr->core) {
             representation += expression->str();
         }
         return representation;
@@ -71,328 +145,590 @@ std::string Expression::str() const {
     else { return "INVALID_EXPRESSION"; }
 }
 
-std::shared_ptr<Expression> valueExpression(Token token) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->expressionType = ExpressionType::VALUE;
-    expression->token = token;
-    return expression;
+std::string printFunctionTable(const FunctionTable& funcExpressions) {
+    std::string representation;
+    for (const std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        representation += "fn " + function.first;
+        if (!function.second.params.empty()) {
+            representation += "(";
+            for (uint32_t paramIdx = 0; paramIdx < function.second.params.size(); paramIdx++) {
+                representation += (paramIdx > 0 ? ", " : "") + std::string(function.second.params[paramIdx]);
+            }
+            representation += ")";
+        }
+        representation += "\n" + blockStr(function.second.body) + "endfn\n";
+    }
+    return representation;
+}
+
+namespace {
+
+size_t countNodes(const Expression* expression);
+
+size_t countNodes(const ExpressionLine& expressionLine) {
+    size_t count = 0;
+    for (const Expression* expression : expressionLine) { count += countNodes(expression); }
+    return count;
 }
 
-std::shared_ptr<Expression> binaryOpExpression(ExpressionType expressionType, std::shared_ptr<Expression> core, std::shared_ptr<Expression> left, std::shared_ptr<Expression> right) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->token = core->token;
-    expression->expressionType = expressionType;
-    expression->left = left;
-    expression->right = right;
-    return expression;
+size_t countNodes(const ExpressionBlock& block) {
+    size_t count = 0;
+    for (const ExpressionLine& expressionLine : block) { count += countNodes(expressionLine); }
+    return count;
 }
 
-std::shared_ptr<Expression> printExpression(std::shared_ptr<Expression> root, std::vector<std::shared_ptr<Expression>> core) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->expressionType = ExpressionType::PRINT;
-    expression->token = root->token;
-    expression->core = parseLine(core);
-    return expression;
+size_t countNodes(const Expression* expression) {
+    switch(expression->expressionType) {
+        case ExpressionType::VALUE:
+        case ExpressionType::STRING:
+        case ExpressionType::INT:
+        case ExpressionType::JOIN:   { return 1; }
+        case ExpressionType::PAREN:
+        case ExpressionType::PRINT:
+        case ExpressionType::RETURN: { return 1 + countNodes(expression->as<ListExpression>()->core); }
+        case ExpressionType::VAR:    { return 2 + countNodes(expression->as<VarExpression>()->core); }
+        case ExpressionType::IF: {
+            const IfExpression* ifExpr = expression->as<IfExpression>();
+            return 1 + (ifExpr->conditional != nullptr ? countNodes(ifExpr->conditional) : 0) + countNodes(ifExpr->ifStatements) + countNodes(ifExpr->elseStatements);
+        }
+        case ExpressionType::FOR: {
+            const ForExpression* forExpr = expression->as<ForExpression>();
+            return 2 + countNodes(forExpr->from) + countNodes(forExpr->limit) + countNodes(forExpr->body);
+        }
+        case ExpressionType::WHILE: {
+            const WhileExpression* whileExpr = expression->as<WhileExpression>();
+            return 1 + countNodes(whileExpr->conditional) + countNodes(whileExpr->body);
+        }
+        case ExpressionType::CALL:
+        case ExpressionType::SPAWN:  { return 2 + countNodes(expression->as<CallExpression>()->args); }
+        default: {
+            const BinaryExpression* binaryExpr = expression->as<BinaryExpression>();
+            return 1 + countNodes(binaryExpr->left) + countNodes(binaryExpr->right);
+        }
+    }
 }
 
-std::shared_ptr<Expression> ifExpression(std::shared_ptr<Expression> root, std::shared_ptr<Expression> conditional, std::vector<std::vector<std::shared_ptr<Expression>>> ifStatements, std::vector<std::vector<std::shared_ptr<Expression>>> elseStatements) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->expressionType = ExpressionType::IF;
-    expression->token = root->token;
-    expression->conditional = conditional;
-    expression->ifStatements = ifStatements;
-    expression->elseStatements = elseStatements;
-    return expression;
 }
 
-std::shared_ptr<Expression> parenExpression(std::shared_ptr<Expression> root, std::vector<std::shared_ptr<Expression>> core) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->expressionType = ExpressionType::PAREN;
-    expression->token = root->token;
-    expression->core = parseLine(core);
-    return expression;
+size_t countNodes(const FunctionTable& funcExpressions) {
+    size_t count = 0;
+    for (const std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        count += countNodes(function.second.body);
+    }
+    return count;
 }
 
-std::shared_ptr<Expression> varExpression(std::shared_ptr<Expression> root, std::shared_ptr<Expression> var, std::vector<std::shared_ptr<Expression>> core) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->token = root->token;
-    expression->var = var;
-    expression->expressionType = ExpressionType::VAR;
-    expression->core = parseLine(core);
-    return expression;
+namespace {
+
+void countNodesByType(const Expression* expression, std::vector<size_t>& byType);
+
+void countNodesByType(const ExpressionLine& expressionLine, std::vector<size_t>& byType) {
+    for (const Expression* expression : expressionLine) { countNodesByType(expression, byType); }
 }
 
-std::shared_ptr<Expression> strExpression(std::shared_ptr<Expression> root, std::shared_ptr<Expression> payload) {
-    std::shared_ptr<Expression> expression = std::make_shared<Expression>();
-    expression->expressionType = ExpressionType::STRING;
-    expression->token = root->token;
-    expression->payload = payload;
-    return expression;
+void countNodesByType(const ExpressionBlock& block, std::vector<size_t>& byType) {
+    for (const ExpressionLine& expressionLine : block) { countNodesByType(expressionLine, byType); }
 }
 
-std::vector<std::shared_ptr<Expression>> wrapTokens(const std::vector<Token> tokens) {
-    std::vector<std::shared_ptr<Expression>> expressions;
-    for (Token token : tokens) {
-        expressions.push_back(valueExpression(token));
+void countNodesByType(const Expression* expression, std::vector<size_t>& byType) {
+    byType[(size_t) expression->expressionType]++;
+    switch(expression->expressionType) {
+        case ExpressionType::VALUE:
+        case ExpressionType::STRING:
+        case ExpressionType::INT:
+        case ExpressionType::JOIN:   { return; }
+        case ExpressionType::PAREN:
+        case ExpressionType::PRINT:
+        case ExpressionType::RETURN: { return countNodesByType(expression->as<ListExpression>()->core, byType); }
+        case ExpressionType::VAR:    { return countNodesByType(expression->as<VarExpression>()->core, byType); }
+        case ExpressionType::IF: {
+            const IfExpression* ifExpr = expression->as<IfExpression>();
+            if (ifExpr->conditional != nullptr) { countNodesByType(ifExpr->conditional, byType); }
+            countNodesByType(ifExpr->ifStatements, byType);
+            return countNodesByType(ifExpr->elseStatements, byType);
+        }
+        case ExpressionType::FOR: {
+            const ForExpression* forExpr = expression->as<ForExpression>();
+            countNodesByType(forExpr->from, byType);
+            countNodesByType(forExpr->limit, byType);
+            return countNodesByType(forExpr->body, byType);
+        }
+        case ExpressionType::WHILE: {
+            const WhileExpression* whileExpr = expression->as<WhileExpression>();
+            countNodesByType(whileExpr->conditional, byType);
+            return countNodesByType(whileExpr->body, byType);
+        }
+        case ExpressionType::CALL:
+        case ExpressionType::SPAWN:  { return countNodesByType(expression->as<CallExpression>()->args, byType); }
+        default: {
+            const BinaryExpression* binaryExpr = expression->as<BinaryExpression>();
+            countNodesByType(binaryExpr->left, byType);
+            return countNodesByType(binaryExpr->right, byType);
+        }
     }
-    return expressions;
 }
 
-std::vector<std::shared_ptr<Expression>> binaryOpExpressions(const std::vector<std::shared_ptr<Expression>> expressions, std::vector<ExpressionType> expressionTypes) {
-    
-    std::vector<TokenType> tokenTypes;
-    for (ExpressionType expressionType : expressionTypes) {
-        if (expressionType == ExpressionType::ADD)        { tokenTypes.push_back(TokenType::ADD); }
-        if (expressionType == ExpressionType::SUB)        { tokenTypes.push_back(TokenType::SUB); }
-        if (expressionType == ExpressionType::MUL)        { tokenTypes.push_back(TokenType::MUL); }
-        if (expressionType == ExpressionType::DIV)        { tokenTypes.push_back(TokenType::DIV); }
-        if (expressionType == ExpressionType::IS_LESS)    { tokenTypes.push_back(TokenType::IS_LESS); }
-        if (expressionType == ExpressionType::IS_LEQ)     { tokenTypes.push_back(TokenType::IS_LEQ); }
-        if (expressionType == ExpressionType::IS_GREATER) { tokenTypes.push_back(TokenType::IS_GREATER); }
-        if (expressionType == ExpressionType::IS_GEQ)     { tokenTypes.push_back(TokenType::IS_GEQ); }
-        if (expressionType == ExpressionType::IS_EQ)      { tokenTypes.push_back(TokenType::IS_EQ); }
+}
+
+std::vector<size_t> countNodesByType(const FunctionTable& funcExpressions) {
+    std::vector<size_t> byType((size_t) ExpressionType::STR_CONCAT + 1, 0);
+    for (const std::pair<const std::string, FunctionDefinition>& function : funcExpressions) {
+        countNodesByType(function.second.body, byType);
     }
-    
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool addingExpression = false;
-    ExpressionType expressionType;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (addingExpression) {
-            std::shared_ptr<Expression> core = newExpressions.back();
-            newExpressions.pop_back();
-            std::shared_ptr<Expression> left = newExpressions.back();
-            newExpressions.pop_back();
-            newExpressions.push_back(binaryOpExpression(expressionType, core, left, expression));
-            addingExpression = false;
-        } else {
-            for (TokenType tokenType : tokenTypes) {
-                if (expression->token.tokenType == tokenType) {
-                    addingExpression = true;
-                    if (tokenType == TokenType::ADD)        { expressionType = ExpressionType::ADD; }
-                    if (tokenType == TokenType::SUB)        { expressionType = ExpressionType::SUB; }
-                    if (tokenType == TokenType::MUL)        { expressionType = ExpressionType::MUL; }
-                    if (tokenType == TokenType::DIV)        { expressionType = ExpressionType::DIV; }
-                    if (tokenType == TokenType::IS_LESS)    { expressionType = ExpressionType::IS_LESS; }
-                    if (tokenType == TokenType::IS_LEQ)     { expressionType = ExpressionType::IS_LEQ; }
-                    if (tokenType == TokenType::IS_GREATER) { expressionType = ExpressionType::IS_GREATER; }
-                    if (tokenType == TokenType::IS_GEQ)     { expressionType = ExpressionType::IS_GEQ; }
-                    if (tokenType == TokenType::IS_EQ)      { expressionType = ExpressionType::IS_EQ; }
-                }
-            }
-            
-            newExpressions.push_back(expression);
-        }
+    return byType;
+}
+
+std::string Diagnostic::str() const {
+    return std::to_string(line) + ": " + message;
+}
+
+namespace {
+
+// binding power of binary operators, 0 for anything that isn't one
+int precedence(TokenType tokenType) {
+    switch(tokenType) {
+        case TokenType::MUL:
+        case TokenType::DIV:        { return 3; }
+        case TokenType::ADD:
+        case TokenType::SUB:        { return 2; }
+        case TokenType::IS_LESS:
+        case TokenType::IS_LEQ:
+        case TokenType::IS_GREATER:
+        case TokenType::IS_GEQ:
+        case TokenType::IS_EQ:      { return 1; }
+        default:                    { return 0; }
     }
-    return newExpressions;
 }
 
-std::vector<std::shared_ptr<Expression>> parenExpressions(const std::vector<std::shared_ptr<Expression>> expressions) {
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool addingExpression = false;
-    std::vector<std::shared_ptr<Expression>> currentParenExpression;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (addingExpression) {
-            if (expression->token.tokenType == TokenType::RIGHT_PAREN) {
-                newExpressions.push_back(parenExpression(expression, currentParenExpression));
-                addingExpression = false;
-            } else {
-                currentParenExpression.push_back(expression);
-            }
-        } else {
-            if (expression->token.tokenType == TokenType::LEFT_PAREN) {
-                addingExpression = true;
-                currentParenExpression = std::vector<std::shared_ptr<Expression>>();
-            } else {
-                newExpressions.push_back(expression);
-            }
-        }
+ExpressionType binaryExpressionType(TokenType tokenType) {
+    switch(tokenType) {
+        case TokenType::ADD:        { return ExpressionType::ADD; }
+        case TokenType::SUB:        { return ExpressionType::SUB; }
+        case TokenType::MUL:        { return ExpressionType::MUL; }
+        case TokenType::DIV:        { return ExpressionType::DIV; }
+        case TokenType::IS_LESS:    { return ExpressionType::IS_LESS; }
+        case TokenType::IS_LEQ:     { return ExpressionType::IS_LEQ; }
+        case TokenType::IS_GREATER: { return ExpressionType::IS_GREATER; }
+        case TokenType::IS_GEQ:     { return ExpressionType::IS_GEQ; }
+        default:                    { return ExpressionType::IS_EQ; }
     }
-    return newExpressions;
 }
 
-std::vector<std::shared_ptr<Expression>> varExpressions(const std::vector<std::shared_ptr<Expression>> expressions) {
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool isVarExpr = false;
-    std::vector<std::shared_ptr<Expression>> varExpr;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (isVarExpr) {
-            varExpr.push_back(expression);
-        } else {
-            if (expression->token.tokenType == TokenType::EQUAL) {
-                isVarExpr = true;
+// --- Line parser
+// precedence climbing over one line's tokens, building arena nodes directly.
+// expression lists (a line, a paren group, print's argument) are collected on
+// a scratch stack shared by the whole parse and copied into the arena once
+class LineParser {
+public:
+    LineParser(Arena& arena, std::vector<Diagnostic>& diagnostics, std::vector<SpawnSite>& spawns) : arena(arena), diagnostics(diagnostics), spawns(spawns) {}
+
+    void reset(Span<const Token> tokens, uint32_t line) {
+        cur = tokens.begin();
+        end = tokens.end();
+        statementStart = nullptr;
+        this->line = line;
+    }
+
+    bool atEnd() const { return cur == end; }
+
+    // a block header's parts are one expression each, reports whatever's
+    // left after one (what names the part) and returns false
+    bool expectEnd(const char* what) {
+        if (cur == end) { return true; }
+        error("unexpected '" + std::string(cur->payload) + "' after " + what);
+        return false;
+    }
+
+    // everything up to the end of the line
+    ExpressionLine parseLine() {
+        statementStart = cur;
+        return parseList(false);
+    }
+
+    Expression* parseExpression(int minPrecedence = 1) {
+        Expression* left = parsePrimary();
+        if (left == nullptr) { return nullptr; }
+
+        // left-associative: the right operand only takes operators that bind tighter
+        while (cur != end && precedence(cur->tokenType) >= minPrecedence) {
+            const Token& op = *cur++;
+            Expression* right = parseExpression(precedence(op.tokenType) + 1);
+            if (right == nullptr) {
+                error("expected an operand after '" + std::string(op.payload) + "'");
+                return left;
             }
-            newExpressions.push_back(expression);
+            left = arena.make<BinaryExpression>(binaryExpressionType(op.tokenType), left, right);
         }
+        return left;
     }
-    
-    if (isVarExpr) {
-        std::shared_ptr<Expression> core = newExpressions.back();
-        newExpressions.pop_back();
-        std::shared_ptr<Expression> var = newExpressions.back();
-        newExpressions.pop_back();
-        newExpressions.push_back(varExpression(core, var, varExpr));
+
+private:
+    Arena& arena;
+    std::vector<Diagnostic>& diagnostics;
+    std::vector<SpawnSite>& spawns; // checked once every function is known
+    std::vector<Expression*> scratch;
+
+    const Token* cur = nullptr;
+    const Token* end = nullptr;
+    const Token* statementStart = nullptr; // the first token of a statement line, the only place return can go
+    uint32_t line = 0;
+
+    void error(const std::string& message) {
+        diagnostics.push_back({line, message});
     }
-        
-    return newExpressions;
-}
 
-std::vector<std::shared_ptr<Expression>> printExpressions(const std::vector<std::shared_ptr<Expression>> expressions) {
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool isPrintExpr = false;
-    std::vector<std::shared_ptr<Expression>> printExpr;
-    std::shared_ptr<Expression> rootExpr;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (isPrintExpr) {
-            if (expression->token.tokenType != TokenType::LEFT_PAREN && expression->token.tokenType != TokenType::RIGHT_PAREN) {
-                printExpr.push_back(expression);
+    ExpressionLine parseList(bool untilRightParen) {
+        size_t listStart = scratch.size();
+        while (cur != end && !(untilRightParen && cur->tokenType == TokenType::RIGHT_PAREN)) {
+            const Token* expressionStart = cur;
+            Expression* expression = parseExpression();
+            if (expression != nullptr) {
+                scratch.push_back(expression);
+            } else if (cur == expressionStart) {
+                error("unexpected '" + std::string((cur++)->payload) + "'");
             }
-        } else {
-            if (expression->token.tokenType == TokenType::WORD && expression->token.payload == "print") {
-                rootExpr = expression;
-                isPrintExpr = true;
+        }
+        if (untilRightParen) {
+            if (cur == end) {
+                error("expected ')'");
             } else {
-                newExpressions.push_back(expression);
+                cur++;
             }
         }
+
+        return takeScratch(listStart);
     }
-    
-    if (isPrintExpr) {
-        newExpressions.push_back(printExpression(rootExpr, printExpr));
+
+    // moves scratch[start..] into the arena
+    ExpressionLine takeScratch(size_t start) {
+        ExpressionLine list;
+        if (scratch.size() > start) {
+            Expression** items = static_cast<Expression**>(arena.allocate(sizeof(Expression*) * (scratch.size() - start), alignof(Expression*)));
+            std::copy(scratch.begin() + start, scratch.end(), items);
+            list = ExpressionLine(items, (uint32_t) (scratch.size() - start));
+        }
+        scratch.resize(start);
+        return list;
     }
-        
-    return newExpressions;
-}
 
-std::vector<std::shared_ptr<Expression>> reservedWordExpressions(const std::vector<std::shared_ptr<Expression>> expressions, const std::string& reserved) {
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool isExpr = false;
-    std::vector<std::shared_ptr<Expression>> expr;
-    std::shared_ptr<Expression> rootExpr;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (isExpr) {
-            if (expression->token.tokenType != TokenType::LEFT_PAREN && expression->token.tokenType != TokenType::RIGHT_PAREN) {
-                expr.push_back(expression);
+    // comma-separated expressions up to the closing paren, which is consumed
+    ExpressionLine parseArgs() {
+        size_t argsStart = scratch.size();
+        while (cur != end && cur->tokenType != TokenType::RIGHT_PAREN) {
+            // a failed argument has already been reported and skipped
+            Expression* arg = parseExpression();
+            if (arg == nullptr) { continue; }
+            scratch.push_back(arg);
+            if (cur != end && cur->tokenType == TokenType::COMMA) {
+                cur++;
+            } else if (cur != end && cur->tokenType != TokenType::RIGHT_PAREN) {
+                error("expected ',' or ')' after an argument");
+                cur++;
             }
+        }
+        if (cur == end) {
+            error("expected ')'");
         } else {
-            if (expression->token.tokenType == TokenType::WORD && expression->token.payload == reserved) {
-                rootExpr = expression;
-                isExpr = true;
-            } else {
-                newExpressions.push_back(expression);
-            }
+            cur++;
         }
+        return takeScratch(argsStart);
     }
-    
-    if (isExpr) {
-        std::shared_ptr<Expression> newExpression;
-        if (reserved == "print") { newExpression = printExpression(rootExpr, expr); }
-        newExpressions.push_back(newExpression);
-    }
-        
-    return newExpressions;
-}
 
-std::vector<std::shared_ptr<Expression>> stringExpressions(const std::vector<std::shared_ptr<Expression>> expressions) {
-    std::vector<std::shared_ptr<Expression>> newExpressions;
-    bool isStrExpr = false;
-    std::vector<std::shared_ptr<Expression>> strExpr;
-    for (std::shared_ptr<Expression> expression : expressions) {
-        if (isStrExpr) {
-            if (expression->token.tokenType == TokenType::DOUBLE_QUOTE) {
-                // strExpr should always only be 1 long
-                newExpressions.push_back(strExpression(expression, strExpr[0]));
-                isStrExpr = false;
-            } else {
-                strExpr.push_back(expression);
+    Expression* parsePrimary() {
+        if (cur == end) { return nullptr; }
+
+        const Token& token = *cur++;
+        switch(token.tokenType) {
+            case TokenType::LEFT_PAREN: {
+                return arena.make<ListExpression>(ExpressionType::PAREN, parseList(true));
             }
-        } else {
-            if (expression->token.tokenType == TokenType::DOUBLE_QUOTE) {
-                isStrExpr = true;
-                strExpr = std::vector<std::shared_ptr<Expression>>();
-            } else {
-                newExpressions.push_back(expression);
+            case TokenType::DOUBLE_QUOTE:
+            case TokenType::SINGLE_QUOTE: {
+                // the lexer hands back the body of a string as a single token
+                std::string_view payload;
+                if (cur != end && cur->tokenType != token.tokenType) {
+                    payload = arena.copy((cur++)->payload);
+                }
+                if (cur == end) {
+                    error("unterminated string");
+                } else {
+                    cur++;
+                }
+                return arena.make<StringExpression>(payload);
+            }
+            case TokenType::SUB: {
+                // unary minus, as 0 - operand
+                Expression* operand = parsePrimary();
+                if (operand == nullptr) {
+                    error("expected an operand after '-'");
+                    return nullptr;
+                }
+                return arena.make<BinaryExpression>(ExpressionType::SUB, arena.make<ValueExpression>(TokenType::NUMBER, symbolTable.intern("0"), std::string_view("0")), operand);
+            }
+            case TokenType::WORD:
+            case TokenType::NUMBER: {
+                if (token.symbol == PRINT_SYMBOL) {
+                    // print(...) takes what's inside the parens, bare print takes the rest of the line
+                    if (cur != end && cur->tokenType == TokenType::LEFT_PAREN) {
+                        cur++;
+                        return arena.make<ListExpression>(ExpressionType::PRINT, parseList(true));
+                    }
+                    return arena.make<ListExpression>(ExpressionType::PRINT, parseList(false));
+                }
+                if (token.symbol == RETURN_SYMBOL) {
+                    // return takes the rest of the line, or nothing. anywhere
+                    // else in a line, whatever came before it would be half
+                    // evaluated
+                    if (&token != statementStart) {
+                        error("'return' must start a line");
+                        return nullptr;
+                    }
+                    return arena.make<ListExpression>(ExpressionType::RETURN, parseList(false));
+                }
+                if (token.symbol == SPAWN_SYMBOL) {
+                    // spawn name or spawn name(arg, ...)
+                    if (cur == end || cur->tokenType != TokenType::WORD) {
+                        error("expected a function name after 'spawn'");
+                        return nullptr;
+                    }
+                    const Token& name = *cur++;
+                    ValueExpression* callee = arena.make<ValueExpression>(name.tokenType, name.symbol, arena.copy(name.payload));
+                    ExpressionLine args;
+                    if (cur != end && cur->tokenType == TokenType::LEFT_PAREN) {
+                        cur++;
+                        args = parseArgs();
+                    }
+                    CallExpression* spawn = arena.make<CallExpression>(callee, args, ExpressionType::SPAWN);
+                    spawns.push_back({spawn, line});
+                    return spawn;
+                }
+                if (token.symbol == JOIN_SYMBOL) {
+                    return arena.make<Expression>(ExpressionType::JOIN);
+                }
+
+                ValueExpression* value = arena.make<ValueExpression>(token.tokenType, token.symbol, arena.copy(token.payload));
+                if (cur != end && cur->tokenType == TokenType::EQUAL) {
+                    cur++;
+                    return arena.make<VarExpression>(value, parseList(false));
+                }
+                if (token.tokenType == TokenType::WORD && cur != end && cur->tokenType == TokenType::LEFT_PAREN) {
+                    cur++;
+                    return arena.make<CallExpression>(value, parseArgs());
+                }
+                return value;
+            }
+            case TokenType::RIGHT_PAREN: {
+                // closes whatever list we're in, leave it for the caller
+                cur--;
+                return nullptr;
+            }
+            default: {
+                error("unexpected '" + std::string(token.payload) + "'");
+                return nullptr;
             }
         }
     }
-    
-    return newExpressions;
+};
+
+// an if, for or while that hasn't seen its end keyword yet. loops keep their
+// body in statements
+struct OpenBlock {
+    uint32_t line;
+    Symbol keyword;                     // IF_SYMBOL, FOR_SYMBOL or WHILE_SYMBOL
+    Expression* conditional;            // if and while; nullptr if it didn't parse
+    ValueExpression* var;               // for
+    Expression* from;
+    Expression* limit;
+    std::vector<ExpressionLine> statements;
+    std::vector<ExpressionLine> elseStatements;
+    bool inElse;
+    bool valid;                         // false if the opening line had errors
+
+    OpenBlock(uint32_t line, Symbol keyword) : line(line), keyword(keyword), conditional(nullptr), var(nullptr), from(nullptr), limit(nullptr), inElse(false), valid(true) {}
+};
+
+// the "(a, b)" after a function's name, if there is one. false if it's
+// malformed or names a parameter twice
+bool parseParams(Arena& arena, Span<const Token> tokens, std::vector<std::string_view>& params) {
+    if (tokens.empty()) { return true; }
+    if (tokens[0].tokenType != TokenType::LEFT_PAREN || tokens.back().tokenType != TokenType::RIGHT_PAREN) { return false; }
+    for (uint32_t tokenIdx = 1; tokenIdx + 1 < tokens.size(); tokenIdx++) {
+        // names at odd positions, commas between them
+        bool expectName = tokenIdx % 2 == 1;
+        if (expectName) {
+            if (tokens[tokenIdx].tokenType != TokenType::WORD) { return false; }
+            for (std::string_view param : params) {
+                if (param == tokens[tokenIdx].payload) { return false; }
+            }
+            params.push_back(arena.copy(tokens[tokenIdx].payload));
+        } else if (tokens[tokenIdx].tokenType != TokenType::COMMA || tokenIdx + 2 == tokens.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* endKeyword(Symbol keyword) {
+    switch(keyword) {
+        case FOR_SYMBOL:   { return "endfor"; }
+        case WHILE_SYMBOL: { return "endwhile"; }
+        default:           { return "endif"; }
+    }
 }
 
-std::vector<std::shared_ptr<Expression>> parseLine(const std::vector<std::shared_ptr<Expression>> expressions) {
-    std::vector<std::shared_ptr<Expression>> newExpressions = expressions;
-    
-    newExpressions = reservedWordExpressions(newExpressions, "print");
-    newExpressions = varExpressions(newExpressions);
-    newExpressions = stringExpressions(newExpressions);
-    newExpressions = parenExpressions(newExpressions);
-    newExpressions = binaryOpExpressions(newExpressions, {ExpressionType::MUL, ExpressionType::DIV});
-    newExpressions = binaryOpExpressions(newExpressions, {ExpressionType::ADD, ExpressionType::SUB});
-    newExpressions = binaryOpExpressions(newExpressions, {
-        ExpressionType::IS_LESS, ExpressionType::IS_LEQ, ExpressionType::IS_GREATER, ExpressionType::IS_GEQ, ExpressionType::IS_EQ
-    });
-    
-    return newExpressions;
 }
 
-void parse(std::map<std::string, std::vector<std::vector<std::shared_ptr<Expression>>>>& funcExpressions,
-           const std::vector<std::vector<std::shared_ptr<Expression>>>& expressionLines) {
-    std::vector<std::vector<std::shared_ptr<Expression>>> curFuncExpressions;
+void parse(Arena& arena, FunctionTable& funcExpressions, const TokenStream& tokens, std::vector<Diagnostic>& diagnostics, LineNumbers* lineNumbers) {
+    std::vector<SpawnSite> spawns;
+    parseLines(arena, funcExpressions, tokens, 1, diagnostics, spawns, lineNumbers);
+    checkSpawns(funcExpressions, spawns, diagnostics);
+}
+
+bool parseLines(Arena& arena, FunctionTable& funcExpressions, const TokenStream& tokens, uint32_t firstLine, std::vector<Diagnostic>& diagnostics, std::vector<SpawnSite>& spawns, LineNumbers* lineNumbers) {
+    LineParser lineParser(arena, diagnostics, spawns);
+
+    std::vector<ExpressionLine> curFuncExpressions;
+    std::vector<std::string_view> curFuncParams;
+    std::vector<OpenBlock> openBlocks;
+
+    // lines go to the innermost open block, or straight into the function
+    auto currentLines = [&]() -> std::vector<ExpressionLine>& {
+        if (openBlocks.empty()) { return curFuncExpressions; }
+        OpenBlock& block = openBlocks.back();
+        return block.inElse ? block.elseStatements : block.statements;
+    };
+    auto addLine = [&](ExpressionLine expressionLine, uint32_t lineNumber) {
+        currentLines().push_back(expressionLine);
+        if (lineNumbers != nullptr && !expressionLine.empty()) { (*lineNumbers)[expressionLine.begin()] = lineNumber; }
+    };
+
+    // closes the innermost block if it was opened by opener, diagnosing it otherwise
+    auto closeBlock = [&](Symbol opener, uint32_t lineNumber, OpenBlock& closed) {
+        if (openBlocks.empty() || openBlocks.back().keyword != opener) {
+            const char* name = opener == FOR_SYMBOL ? "for" : opener == WHILE_SYMBOL ? "while" : "if";
+            diagnostics.push_back({lineNumber, std::string(endKeyword(opener)) + " without a matching " + name});
+            return false;
+        }
+        closed = std::move(openBlocks.back());
+        openBlocks.pop_back();
+        return closed.valid;
+    };
 
-    std::vector<std::vector<std::vector<std::shared_ptr<Expression>>>> curIfExpressions;
-    std::vector<std::vector<std::vector<std::shared_ptr<Expression>>>> curElseExpressions;
-    std::vector<std::shared_ptr<Expression>> ifExpressionRoot;
-    std::vector<std::shared_ptr<Expression>> ifExpressionConditional;
-    std::vector<bool> inIf;
-    
     std::string funcName;
-    for (const std::vector<std::shared_ptr<Expression>>& expressionLine : expressionLines) {
-        if (expressionLine.size() == 0) { continue; }
+    for (size_t lineIdx = 0; lineIdx < tokens.lineCount(); lineIdx++) {
+        Span<const Token> tokenLine = tokens.line(lineIdx);
+        if (tokenLine.size() == 0) { continue; }
 
-        if (expressionLine[0]->token.payload == "fn") {
-            funcName = expressionLine[1]->token.payload;
-        } else if (expressionLine[0]->token.payload == "endfn") {
-            funcExpressions[funcName] = curFuncExpressions;
+        uint32_t lineNumber = firstLine + (uint32_t) lineIdx;
+        // keywords have fixed symbols, so spotting one is an int compare
+        Symbol keyword = tokenLine[0].tokenType == TokenType::WORD ? tokenLine[0].symbol : NO_SYMBOL;
+        if (keyword == FN_SYMBOL) {
+            if (tokenLine.size() < 2) {
+                diagnostics.push_back({lineNumber, "expected a function name after 'fn'"});
+                continue;
+            }
+            funcName = std::string(tokenLine[1].payload);
+            curFuncParams.clear();
+            if (!parseParams(arena, Span<const Token>(tokenLine.begin() + 2, tokenLine.size() - 2), curFuncParams)) {
+                diagnostics.push_back({lineNumber, "expected 'fn name' or 'fn name(param, ...)' with distinct parameter names"});
+            }
+        } else if (keyword == ENDFN_SYMBOL) {
+            while (!openBlocks.empty()) {
+                diagnostics.push_back({openBlocks.back().line, std::string("missing ") + endKeyword(openBlocks.back().keyword)});
+                openBlocks.pop_back();
+            }
+            funcExpressions[funcName] = {arena.copy(curFuncParams), arena.copy(curFuncExpressions)};
             funcName = std::string();
-            curFuncExpressions = std::vector<std::vector<std::shared_ptr<Expression>>>();
-        } else if (expressionLine[0]->token.payload == "if") {
-            inIf.push_back(true);
-            
-            std::vector<std::shared_ptr<Expression>> cutExpressionLine;
-            for (int cutExprIdx = 1; cutExprIdx < expressionLine.size(); cutExprIdx++) {
-                cutExpressionLine.push_back(expressionLine[cutExprIdx]);
+            curFuncParams.clear();
+            curFuncExpressions.clear();
+        } else if (keyword == IF_SYMBOL) {
+            lineParser.reset(Span<const Token>(tokenLine.begin() + 1, tokenLine.size() - 1), lineNumber);
+            OpenBlock block(lineNumber, keyword);
+            block.conditional = lineParser.parseExpression();
+            if (block.conditional == nullptr) {
+                diagnostics.push_back({lineNumber, "expected a condition after 'if'"});
+                block.valid = false;
+            } else if (!lineParser.expectEnd("the condition")) {
+                block.valid = false;
             }
-            
-            curIfExpressions.push_back(std::vector<std::vector<std::shared_ptr<Expression>>>());
-            ifExpressionConditional.push_back(parseLine(cutExpressionLine)[0]);
-            ifExpressionRoot.push_back(expressionLine[0]);
-        } else if (expressionLine[0]->token.payload == "endif") {
-            
-            std::shared_ptr<Expression> addingExpressionRoot = ifExpressionRoot.back();
-            std::shared_ptr<Expression> addingExpressionConditional = ifExpressionConditional.back();
-            std::vector<std::vector<std::shared_ptr<Expression>>> addingIfExpressions = curIfExpressions.back();
-            std::vector<std::vector<std::shared_ptr<Expression>>> addingElseExpressions = curElseExpressions.back();
-            
-            ifExpressionRoot.pop_back();
-            ifExpressionConditional.pop_back();
-            curIfExpressions.pop_back();
-            curElseExpressions.pop_back();
-            
-            curFuncExpressions.push_back({ifExpression(addingExpressionRoot, addingExpressionConditional, addingIfExpressions, addingElseExpressions)});
-        } else if (expressionLine[0]->token.payload == "else") {
-            inIf[inIf.size() - 1] = false;
-            curElseExpressions.push_back(std::vector<std::vector<std::shared_ptr<Expression>>>());
-        } else {
-            if (curIfExpressions.size() > 0) {
-                if (inIf[inIf.size() - 1]) {
-                    curIfExpressions[curIfExpressions.size() - 1].push_back(parseLine(expressionLine));
-                } else {
-                    curElseExpressions[curIfExpressions.size() - 1].push_back(parseLine(expressionLine));
+            openBlocks.push_back(std::move(block));
+        } else if (keyword == ELSE_SYMBOL) {
+            if (openBlocks.empty() || openBlocks.back().keyword != IF_SYMBOL || openBlocks.back().inElse) {
+                diagnostics.push_back({lineNumber, "else without a matching if"});
+                continue;
+            }
+            openBlocks.back().inElse = true;
+        } else if (keyword == ENDIF_SYMBOL) {
+            OpenBlock block(lineNumber, keyword);
+            if (!closeBlock(IF_SYMBOL, lineNumber, block)) { continue; }
+
+            Expression* ifExpr = arena.make<IfExpression>(block.conditional, arena.copy(block.statements), arena.copy(block.elseStatements));
+            addLine(arena.copy(std::vector<Expression*>{ifExpr}), block.line);
+        } else if (keyword == FOR_SYMBOL) {
+            // for var = from to limit. `to` splits the two bounds so each can
+            // be parsed as a plain expression
+            OpenBlock block(lineNumber, keyword);
+            const Token* toToken = std::find_if(tokenLine.begin(), tokenLine.end(), [](const Token& token) { return token.tokenType == TokenType::WORD && token.symbol == TO_SYMBOL; });
+            if (tokenLine.size() < 3 || tokenLine[1].tokenType != TokenType::WORD || tokenLine[2].tokenType != TokenType::EQUAL || toToken == tokenLine.end()) {
+                diagnostics.push_back({lineNumber, "expected 'for name = from to limit'"});
+                block.valid = false;
+            } else {
+                block.var = arena.make<ValueExpression>(tokenLine[1].tokenType, tokenLine[1].symbol, arena.copy(tokenLine[1].payload));
+                lineParser.reset(Span<const Token>(tokenLine.begin() + 3, (uint32_t) (toToken - tokenLine.begin() - 3)), lineNumber);
+                block.from = lineParser.parseExpression();
+                bool boundsEnd = block.from == nullptr || lineParser.expectEnd("the loop bound");
+                lineParser.reset(Span<const Token>(toToken + 1, (uint32_t) (tokenLine.end() - toToken - 1)), lineNumber);
+                block.limit = lineParser.parseExpression();
+                boundsEnd = (block.limit == nullptr || lineParser.expectEnd("the loop bound")) && boundsEnd;
+                if (block.from == nullptr || block.limit == nullptr) {
+                    diagnostics.push_back({lineNumber, "expected 'for name = from to limit'"});
+                    block.valid = false;
+                } else if (!boundsEnd) {
+                    block.valid = false;
                 }
             }
-            
-            else {
-                curFuncExpressions.push_back(parseLine(expressionLine));
+            openBlocks.push_back(std::move(block));
+        } else if (keyword == ENDFOR_SYMBOL) {
+            OpenBlock block(lineNumber, keyword);
+            if (!closeBlock(FOR_SYMBOL, lineNumber, block)) { continue; }
+
+            Expression* forExpr = arena.make<ForExpression>(block.var, block.from, block.limit, arena.copy(block.statements));
+            addLine(arena.copy(std::vector<Expression*>{forExpr}), block.line);
+        } else if (keyword == WHILE_SYMBOL) {
+            lineParser.reset(Span<const Token>(tokenLine.begin() + 1, tokenLine.size() - 1), lineNumber);
+            OpenBlock block(lineNumber, keyword);
+            block.conditional = lineParser.parseExpression();
+            if (block.conditional == nullptr) {
+                diagnostics.push_back({lineNumber, "expected a condition after 'while'"});
+                block.valid = false;
+            } else if (!lineParser.expectEnd("the loop condition")) {
+                block.valid = false;
             }
+            openBlocks.push_back(std::move(block));
+        } else if (keyword == ENDWHILE_SYMBOL) {
+            OpenBlock block(lineNumber, keyword);
+            if (!closeBlock(WHILE_SYMBOL, lineNumber, block)) { continue; }
+
+            Expression* whileExpr = arena.make<WhileExpression>(block.conditional, arena.copy(block.statements));
+            addLine(arena.copy(std::vector<Expression*>{whileExpr}), block.line);
+        } else {
+            lineParser.reset(tokenLine, lineNumber);
+            addLine(lineParser.parseLine(), lineNumber);
+        }
+    }
+
+    return funcName.empty() && curFuncExpressions.empty() && openBlocks.empty();
+}
+
+void checkSpawns(const FunctionTable& funcExpressions, const std::vector<SpawnSite>& spawns, std::vector<Diagnostic>& diagnostics) {
+    checkSpawns([&funcExpressions](std::string_view name) { return funcExpressions.find(name) != funcExpressions.end(); }, spawns, diagnostics);
+}
+
+void checkSpawns(const std::function<bool(std::string_view)>& isFunction, const std::vector<SpawnSite>& spawns, std::vector<Diagnostic>& diagnostics) {
+    // tasks can only run functions, and functions can be defined after use
+    for (const SpawnSite& spawn : spawns) {
+        if (!isFunction(spawn.first->callee->payload)) {
+            diagnostics.push_back({spawn.second, "spawn of '" + std::string(spawn.first->callee->payload) + "', which isn't a function"});
         }
     }
 }
@@ -3,13 +3,18 @@
 
 #include <stdio.h>
 
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.hpp"
 #include "lexer.hpp"
 
-enum class ExpressionType {
+enum class ExpressionType : uint8_t {
     VALUE,
     ADD,
     SUB,
@@ -18,48 +23,216 @@ enum class ExpressionType {
     PAREN,
     VAR,
     STRING,
+    INT,
     PRINT,
     IF,
+    FOR,
+    WHILE,
+    CALL,
+    RETURN,
+    SPAWN,
+    JOIN,
     IS_LESS,
     IS_LEQ,
     IS_GREATER,
     IS_GEQ,
     IS_EQ,
+    // what specializeTypes() turns the ones above into where it can prove
+    // both operands are ints, or for STR_CONCAT that ADD's left side is a
+    // string (see types.hpp)
+    INT_ADD,
+    INT_SUB,
+    INT_MUL,
+    INT_DIV,
+    INT_LT,
+    INT_LEQ,
+    INT_GT,
+    INT_GEQ,
+    INT_EQ,
+    STR_CONCAT,
 };
 
+// every node lives in the program's Arena and is one of the kind-specific
+// structs below, picked by expressionType. children are raw pointers/spans
+// into the same arena
 struct Expression {
     ExpressionType expressionType;
-    
-    // value tokens
-    Token token;
-    
-    // variable setting
-    std::shared_ptr<Expression> payload;
-    
-    // variable setting
-    std::shared_ptr<Expression> var;
-    
-    // unary ops
-    std::vector<std::shared_ptr<Expression>> core;
-    
-    // binary ops
-    std::shared_ptr<Expression> left;
-    std::shared_ptr<Expression> right;
-    
-    // control flow
-    std::vector<std::vector<std::shared_ptr<Expression>>> ifStatements;
-    std::vector<std::vector<std::shared_ptr<Expression>>> elseStatements;
-    
-    std::shared_ptr<Expression> conditional;
-    
-    Expression() {}
-    
+
+    // set by resolve() when slot is one of the enclosing function's parameters
+    // rather than a global
+    bool local;
+
+    // variable slot, filled in by resolve(). -1 if the name is never assigned
+    int32_t slot;
+
+    explicit Expression(ExpressionType expressionType) : expressionType(expressionType), local(false), slot(-1) {}
+
+    template <typename T> const T* as() const { return static_cast<const T*>(this); }
+    template <typename T> T* as() { return static_cast<T*>(this); }
+
+    std::string str() const;
+};
+
+typedef Span<Expression*> ExpressionLine;
+typedef Span<ExpressionLine> ExpressionBlock;
+
+// a parsed fn. parameters are the only locals, every other name is global
+struct FunctionDefinition {
+    Span<std::string_view> params;
+    ExpressionBlock body;
+    bool pure = false; // set by markPureFunctions(), see memo.hpp
+};
+
+// what a VALUE last resolved to in the tree-walker, see evaluator.cpp
+enum class NameBinding : uint8_t {
+    SLOT,     // the global's current value
+    FUNCTION, // a call
+    LITERAL,  // the name itself as a number or a bare word
+};
+
+const uint32_t NO_LITERAL = UINT32_MAX;
+
+// VALUE: a name or number. function is filled in by resolve() when the name
+// is a function, so a call goes straight to the body without a lookup
+struct ValueExpression : Expression {
+    TokenType tokenType;
+    Symbol symbol;
+    std::string_view payload;
+    const FunctionDefinition* function;
+
+    // inline cache, only good while cacheVersion matches the evaluator's
+    // binding version. literal is an index into the evaluator's decoded
+    // literals and stays good across versions, the payload never changes
+    mutable uint32_t cacheVersion;
+    mutable NameBinding binding;
+    mutable uint32_t literal;
+
+    ValueExpression(TokenType tokenType, Symbol symbol, std::string_view payload) : Expression(ExpressionType::VALUE), tokenType(tokenType), symbol(symbol), payload(payload), function(nullptr), cacheVersion(0), binding(NameBinding::SLOT), literal(NO_LITERAL) {}
+};
+
+// ADD, SUB, MUL, DIV, IS_* and their specialized versions
+struct BinaryExpression : Expression {
+    Expression* left;
+    Expression* right;
+
+    BinaryExpression(ExpressionType expressionType, Expression* left, Expression* right) : Expression(expressionType), left(left), right(right) {}
+};
+
+// PAREN, PRINT, RETURN
+struct ListExpression : Expression {
+    ExpressionLine core;
+
+    ListExpression(ExpressionType expressionType, ExpressionLine core) : Expression(expressionType), core(core) {}
+};
+
+// STRING
+struct StringExpression : Expression {
+    std::string_view payload;
+
+    explicit StringExpression(std::string_view payload) : Expression(ExpressionType::STRING), payload(payload) {}
+};
+
+// INT: an integer literal decoded ahead of time by optimize()
+struct IntExpression : Expression {
+    int value;
+
+    explicit IntExpression(int value) : Expression(ExpressionType::INT), value(value) {}
+};
+
+// VAR
+struct VarExpression : Expression {
+    ValueExpression* var;
+    ExpressionLine core;
+
+    VarExpression(ValueExpression* var, ExpressionLine core) : Expression(ExpressionType::VAR), var(var), core(core) {}
+};
+
+// IF
+struct IfExpression : Expression {
+    Expression* conditional;
+    ExpressionBlock ifStatements;
+    ExpressionBlock elseStatements;
+
+    IfExpression(Expression* conditional, ExpressionBlock ifStatements, ExpressionBlock elseStatements) : Expression(ExpressionType::IF), conditional(conditional), ifStatements(ifStatements), elseStatements(elseStatements) {}
+};
+
+// FOR: for var = from to limit ... endfor. both bounds are evaluated once,
+// the body runs with var set to from, from + 1, ... limit, and assigning to
+// var in the body doesn't change how many times it runs. slot is var's slot
+struct ForExpression : Expression {
+    ValueExpression* var;
+    Expression* from;
+    Expression* limit;
+    ExpressionBlock body;
+
+    ForExpression(ValueExpression* var, Expression* from, Expression* limit, ExpressionBlock body) : Expression(ExpressionType::FOR), var(var), from(from), limit(limit), body(body) {}
+};
+
+// WHILE: while conditional ... endwhile
+struct WhileExpression : Expression {
+    Expression* conditional;
+    ExpressionBlock body;
+
+    WhileExpression(Expression* conditional, ExpressionBlock body) : Expression(ExpressionType::WHILE), conditional(conditional), body(body) {}
+};
+
+// CALL: name(arg, ...). missing arguments leave their parameter NONE, extra
+// ones are evaluated and dropped. if callee isn't a function this is read
+// the old way, as the name followed by a paren group.
+// SPAWN: spawn name(arg, ...), the same call started as a task that runs
+// alongside the caller. the parser makes sure callee is a function.
+// JOIN is a bare Expression, it waits for the tasks the caller spawned
+struct CallExpression : Expression {
+    ValueExpression* callee;
+    ExpressionLine args;
+
+    CallExpression(ValueExpression* callee, ExpressionLine args, ExpressionType expressionType = ExpressionType::CALL) : Expression(expressionType), callee(callee), args(args) {}
+};
+
+// function name -> body. std::less<> so lookups can use a string_view
+typedef std::map<std::string, FunctionDefinition, std::less<>> FunctionTable;
+
+std::string printExpressionType(ExpressionType expressionType);
+
+// every function as "fn name(params)", one line of Expression::str() per source line, "endfn"
+std::string printFunctionTable(const FunctionTable& funcExpressions);
+
+// every node in every function body, names on the left of `=` and callees included
+size_t countNodes(const FunctionTable& funcExpressions);
+
+// how many Expressions of each kind every function body holds, indexed by
+// ExpressionType. unlike countNodes() a name on the left of `=` or a callee
+// is part of its VAR or CALL, not a node of its own
+std::vector<size_t> countNodesByType(const FunctionTable& funcExpressions);
+
+// the source line of every statement line, keyed by ExpressionLine::items.
+// the tree doesn't keep line numbers, parse() only fills this in when asked
+// (for --profile). lines without expressions have no items and aren't in it
+typedef std::unordered_map<const Expression* const*, uint32_t> LineNumbers;
+
+struct Diagnostic {
+    uint32_t line; // 1-based
+    std::string message;
+
     std::string str() const;
 };
 
-std::vector<std::shared_ptr<Expression>> wrapTokens(const std::vector<Token> tokens);
-void parse(
-           std::map<std::string, std::vector<std::vector<std::shared_ptr<Expression>>>>& funcExpressions,
-           const std::vector<std::vector<std::shared_ptr<Expression>>>& expressionLines);
+// builds every function's body straight from the token stream. problems are
+// appended to diagnostics and the offending line or block is skipped
+void parse(Arena& arena, FunctionTable& funcExpressions, const TokenStream& tokens, std::vector<Diagnostic>& diagnostics, LineNumbers* lineNumbers = nullptr);
+
+// a spawn and the line it's on
+typedef std::pair<const CallExpression*, uint32_t> SpawnSite;
+
+// parse() in two halves, for parsing a file a stretch at a time (see
+// frontend.hpp). parseLines numbers the stretch's lines from firstLine and
+// is false if something in it carries over into whatever follows: a
+// function without its endfn, or statements outside any function.
+// checkSpawns needs every function, so it goes last
+bool parseLines(Arena& arena, FunctionTable& funcExpressions, const TokenStream& tokens, uint32_t firstLine, std::vector<Diagnostic>& diagnostics, std::vector<SpawnSite>& spawns, LineNumbers* lineNumbers = nullptr);
+void checkSpawns(const FunctionTable& funcExpressions, const std::vector<SpawnSite>& spawns, std::vector<Diagnostic>& diagnostics);
+// the same with isFunction saying which names are functions, for a reload
+// that checks before it has built its table (see ruddy::Program::reload())
+void checkSpawns(const std::function<bool(std::string_view)>& isFunction, const std::vector<SpawnSite>& spawns, std::vector<Diagnostic>& diagnostics);
 
 #endif /* parser_hpp */
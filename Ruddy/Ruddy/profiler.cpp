@@ -0,0 +1,142 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+
+namespace {
+
+double toMs(int64_t ns) { return ns / 1e6; }
+
+// where every line of source starts, so line n is [starts[n - 1], starts[n])
+std::vector<size_t> lineStarts(std::string_view source) {
+    std::vector<size_t> starts(1, 0);
+    for (size_t offset = source.find('\n'); offset != std::string_view::npos; offset = source.find('\n', offset + 1)) {
+        starts.push_back(offset + 1);
+    }
+    starts.push_back(source.size() + 1);
+    return starts;
+}
+
+// a line's text without its indentation, "" past the end
+std::string_view sourceLine(std::string_view source, const std::vector<size_t>& starts, uint32_t line) {
+    if (line == 0 || line >= starts.size()) { return std::string_view(); }
+    std::string_view text = source.substr(starts[line - 1], starts[line] - 1 - starts[line - 1]);
+    size_t first = text.find_first_not_of(" \t");
+    return first == std::string_view::npos ? std::string_view() : text.substr(first);
+}
+
+}
+
+Profiler::Profiler(std::vector<std::string> functionNames) : functionNames(std::move(functionNames)), last(Clock::now()) {
+    functions.resize(this->functionNames.size());
+}
+
+Profiler::Clock::time_point Profiler::charge() {
+    Clock::time_point now = Clock::now();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    last = now;
+    if (!stack.empty()) {
+        const Activation& running = stack.back();
+        functions[running.function].exclusiveNs += elapsed;
+        nodes[running.node].selfNs += elapsed;
+        if (running.line != 0) { lines[running.line].ns += elapsed; }
+    }
+    return now;
+}
+
+int Profiler::childNode(int parent, int function) {
+    uint64_t key = (uint64_t) (uint32_t) parent << 32 | (uint32_t) function;
+    std::unordered_map<uint64_t, int>::iterator it = children.find(key);
+    if (it != children.end()) { return it->second; }
+    nodes.push_back({function, parent, 0});
+    return children[key] = (int) nodes.size() - 1;
+}
+
+void Profiler::push(int function, int parent, Clock::time_point now) {
+    functions[function].calls++;
+    functions[function].active++;
+    stack.push_back({function, childNode(parent, function), 0, now});
+}
+
+void Profiler::pop(Clock::time_point now) {
+    const Activation& finished = stack.back();
+    FunctionStats& stats = functions[finished.function];
+    // a recursive call's time is already inside the outer one's
+    if (--stats.active == 0) {
+        stats.inclusiveNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - finished.start).count();
+    }
+    stack.pop_back();
+}
+
+void Profiler::enter(int function) {
+    Clock::time_point now = charge();
+    push(function, stack.empty() ? -1 : stack.back().node, now);
+}
+
+void Profiler::tailCall(int function) {
+    Clock::time_point now = charge();
+    int parent = nodes[stack.back().node].parent;
+    pop(now);
+    push(function, parent, now);
+}
+
+void Profiler::leave() {
+    pop(charge());
+}
+
+void Profiler::line(uint32_t line) {
+    charge();
+    if (line >= lines.size()) { lines.resize(line + 1); }
+    lines[line].hits++;
+    if (lines[line].function < 0) { lines[line].function = stack.back().function; }
+    stack.back().line = line;
+}
+
+std::string Profiler::report(std::string_view source) const {
+    std::string representation;
+    char row[256];
+
+    std::vector<int> byTime;
+    for (int function = 0; function < (int) functions.size(); function++) {
+        if (functions[function].calls > 0) { byTime.push_back(function); }
+    }
+    std::stable_sort(byTime.begin(), byTime.end(), [this](int a, int b) { return functions[a].exclusiveNs > functions[b].exclusiveNs; });
+    representation += "--- functions, by exclusive time ---\n";
+    snprintf(row, sizeof(row), "%12s %12s %12s  %s\n", "calls", "incl ms", "excl ms", "function");
+    representation += row;
+    for (int function : byTime) {
+        const FunctionStats& stats = functions[function];
+        snprintf(row, sizeof(row), "%12llu %12.3f %12.3f  ", (unsigned long long) stats.calls, toMs(stats.inclusiveNs), toMs(stats.exclusiveNs));
+        representation += row + functionNames[function] + "\n";
+    }
+
+    std::vector<size_t> starts = lineStarts(source);
+    std::vector<uint32_t> linesByTime;
+    for (uint32_t line = 1; line < lines.size(); line++) {
+        if (lines[line].hits > 0) { linesByTime.push_back(line); }
+    }
+    std::stable_sort(linesByTime.begin(), linesByTime.end(), [this](uint32_t a, uint32_t b) { return lines[a].ns > lines[b].ns; });
+    representation += "\n--- lines, by time (not counting calls made from them) ---\n";
+    snprintf(row, sizeof(row), "%12s %12s %8s  %s\n", "hits", "ms", "line", "function: source");
+    representation += row;
+    for (uint32_t line : linesByTime) {
+        snprintf(row, sizeof(row), "%12llu %12.3f %8u  ", (unsigned long long) lines[line].hits, toMs(lines[line].ns), line);
+        representation += row + functionNames[lines[line].function] + ": " + std::string(sourceLine(source, starts, line)) + "\n";
+    }
+    return representation;
+}
+
+std::string Profiler::foldedStacks() const {
+    std::string representation;
+    std::vector<int> path;
+    for (int node = 0; node < (int) nodes.size(); node++) {
+        int64_t us = nodes[node].selfNs / 1000;
+        if (us == 0) { continue; }
+        path.clear();
+        for (int frame = node; frame >= 0; frame = nodes[frame].parent) { path.push_back(nodes[frame].function); }
+        for (size_t frameIdx = path.size(); frameIdx-- > 0;) {
+            representation += functionNames[path[frameIdx]] + (frameIdx > 0 ? ";" : " ");
+        }
+        representation += std::to_string(us) + "\n";
+    }
+    return representation;
+}
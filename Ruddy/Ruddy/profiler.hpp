@@ -0,0 +1,80 @@
+#ifndef profiler_hpp
+#define profiler_hpp
+
+#include <stdio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// --- Profiler
+// exact, not sampled: the VM reports every call, return and statement line
+// it starts (see VM::execute<true>) and the time since the last event goes
+// to whatever was running. functions are Program::functions indices
+class Profiler {
+public:
+    explicit Profiler(std::vector<std::string> functionNames);
+
+    void enter(int function);
+    void tailCall(int function); // the running function is replaced by function
+    void leave();
+    void line(uint32_t line);
+
+    // one row per function that ran, most exclusive time first, then one per
+    // line. source is the script, for showing each line's text
+    std::string report(std::string_view source) const;
+
+    // "main;f;g <microseconds>" per distinct call stack, the input format of
+    // flamegraph.pl and most other flame graph tools
+    std::string foldedStacks() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct FunctionStats {
+        uint64_t calls = 0;
+        int64_t inclusiveNs = 0;
+        int64_t exclusiveNs = 0;
+        int active = 0; // activations on the stack, inclusive time only counts the outermost
+    };
+
+    struct LineStats {
+        uint64_t hits = 0;
+        int64_t ns = 0;
+        int function = -1; // the function it was first seen in
+    };
+
+    // one per distinct call stack, a child per function called from it
+    struct StackNode {
+        int function;
+        int parent;
+        int64_t selfNs;
+    };
+
+    struct Activation {
+        int function;
+        int node;
+        uint32_t line; // 0 until the function's first line starts
+        Clock::time_point start;
+    };
+
+    // charges the time since the last event to the running function, line
+    // and stack
+    Clock::time_point charge();
+    int childNode(int parent, int function);
+    void push(int function, int parent, Clock::time_point now);
+    void pop(Clock::time_point now);
+
+    std::vector<std::string> functionNames;
+    std::vector<FunctionStats> functions;
+    std::vector<LineStats> lines; // by line number
+    std::vector<StackNode> nodes;
+    std::unordered_map<uint64_t, int> children; // parent node and function -> node
+    std::vector<Activation> stack;
+    Clock::time_point last;
+};
+
+#endif /* profiler_hpp */
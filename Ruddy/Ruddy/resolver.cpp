@@ -0,0 +1,195 @@
+#include "resolver.hpp"
+
+#include <algorithm>
+
+namespace {
+
+struct Names {
+    SlotTable& slots;
+    std::vector<const FunctionDefinition*> functions; // by symbol, unless table is set
+    const FunctionTable* table = nullptr;             // for looking functions up by name instead
+    std::vector<Symbol> params;                       // of the function being resolved
+    std::vector<Symbol>* reads = nullptr;             // globals the function reads, when asked for
+
+    explicit Names(SlotTable& slots) : slots(slots) {}
+
+    // index of symbol among the current function's parameters, or -1
+    int localOf(Symbol symbol) const {
+        for (size_t paramIdx = 0; paramIdx < params.size(); paramIdx++) {
+            if (params[paramIdx] == symbol) { return (int) paramIdx; }
+        }
+        return -1;
+    }
+
+    const FunctionDefinition* functionOf(const ValueExpression* value) const {
+        if (table == nullptr) { return value->symbol < functions.size() ? functions[value->symbol] : nullptr; }
+        FunctionTable::const_iterator function = table->find(value->payload);
+        return function != table->end() ? &function->second : nullptr;
+    }
+
+    // parameters shadow globals of the same name. a global gets a slot the
+    // first time it's assigned
+    void bind(Expression* expression, const ValueExpression* var, bool assigning) {
+        int local = localOf(var->symbol);
+        if (local >= 0) {
+            expression->local = true;
+            expression->slot = local;
+            return;
+        }
+        int slot = slots.slotOf(var->symbol);
+        if (slot < 0 && assigning) { slot = slots.add(var->symbol, var->payload); }
+        expression->slot = slot;
+    }
+};
+
+void resolveLine(Names& names, const ExpressionLine& expressionLine, bool assigning);
+
+void resolveBlock(Names& names, const ExpressionBlock& expressions, bool assigning) {
+    for (const ExpressionLine& expressionLine : expressions) {
+        resolveLine(names, expressionLine, assigning);
+    }
+}
+
+// first pass (assigning) hands out slots to VAR targets, second pass points reads at them
+void resolveExpression(Names& names, Expression* expression, bool assigning) {
+    switch(expression->expressionType) {
+        case ExpressionType::VALUE: {
+            if (assigning) { break; }
+            ValueExpression* value = expression->as<ValueExpression>();
+            names.bind(value, value, false);
+            if (names.reads != nullptr && !value->local) { names.reads->push_back(value->symbol); }
+            value->function = names.functionOf(value);
+            break;
+        }
+        case ExpressionType::VAR: {
+            VarExpression* varExpr = expression->as<VarExpression>();
+            names.bind(varExpr, varExpr->var, assigning);
+            varExpr->var->local = varExpr->local;
+            varExpr->var->slot = varExpr->slot;
+            resolveLine(names, varExpr->core, assigning);
+            break;
+        }
+        case ExpressionType::IF: {
+            IfExpression* ifExpr = expression->as<IfExpression>();
+            resolveExpression(names, ifExpr->conditional, assigning);
+            resolveBlock(names, ifExpr->ifStatements, assigning);
+            resolveBlock(names, ifExpr->elseStatements, assigning);
+            break;
+        }
+        case ExpressionType::FOR: {
+            // the loop variable is assigned like a VAR target
+            ForExpression* forExpr = expression->as<ForExpression>();
+            names.bind(forExpr, forExpr->var, true);
+            forExpr->var->local = forExpr->local;
+            forExpr->var->slot = forExpr->slot;
+            resolveExpression(names, forExpr->from, assigning);
+            resolveExpression(names, forExpr->limit, assigning);
+            resolveBlock(names, forExpr->body, assigning);
+            break;
+        }
+        case ExpressionType::WHILE: {
+            WhileExpression* whileExpr = expression->as<WhileExpression>();
+            resolveExpression(names, whileExpr->conditional, assigning);
+            resolveBlock(names, whileExpr->body, assigning);
+            break;
+        }
+        case ExpressionType::CALL:
+        case ExpressionType::SPAWN: {
+            CallExpression* call = expression->as<CallExpression>();
+            resolveExpression(names, call->callee, assigning);
+            resolveLine(names, call->args, assigning);
+            break;
+        }
+        case ExpressionType::PAREN:
+        case ExpressionType::PRINT:
+        case ExpressionType::RETURN: {
+            resolveLine(names, expression->as<ListExpression>()->core, assigning);
+            break;
+        }
+        case ExpressionType::STRING:
+        case ExpressionType::INT:
+        case ExpressionType::JOIN: {
+            break;
+        }
+        default: {
+            resolveExpression(names, expression->as<BinaryExpression>()->left, assigning);
+            resolveExpression(names, expression->as<BinaryExpression>()->right, assigning);
+            break;
+        }
+    }
+}
+
+void resolveLine(Names& names, const ExpressionLine& expressionLine, bool assigning) {
+    for (Expression* expression : expressionLine) {
+        resolveExpression(names, expression, assigning);
+    }
+}
+
+// one pass over one function, see resolveExpression()
+void resolveFunction(Names& names, FunctionDefinition& function, bool assigning) {
+    names.params.clear();
+    for (std::string_view param : function.params) {
+        names.params.push_back(symbolTable.intern(param));
+    }
+    resolveBlock(names, function.body, assigning);
+}
+
+// both passes over functions, in order
+void resolveFunctions(Names& names, const std::vector<FunctionDefinition*>& functions, std::vector<std::vector<Symbol>>* reads) {
+    if (reads != nullptr) { reads->assign(functions.size(), std::vector<Symbol>()); }
+    for (bool assigning : {true, false}) {
+        for (size_t functionIdx = 0; functionIdx < functions.size(); functionIdx++) {
+            if (reads != nullptr && !assigning) { names.reads = &(*reads)[functionIdx]; }
+            resolveFunction(names, *functions[functionIdx], assigning);
+            if (names.reads != nullptr) {
+                std::sort(names.reads->begin(), names.reads->end());
+                names.reads->erase(std::unique(names.reads->begin(), names.reads->end()), names.reads->end());
+            }
+        }
+    }
+}
+
+}
+
+SlotTable resolve(FunctionTable& funcExpressions, std::vector<std::vector<Symbol>>* reads) {
+    SlotTable slots;
+    Names names(slots);
+    std::vector<FunctionDefinition*> functions;
+    for (auto& funcExpression : funcExpressions) {
+        Symbol symbol = symbolTable.intern(funcExpression.first);
+        if (symbol >= names.functions.size()) { names.functions.resize(symbol + 1, nullptr); }
+        names.functions[symbol] = &funcExpression.second;
+        functions.push_back(&funcExpression.second);
+    }
+    resolveFunctions(names, functions, reads);
+    return slots;
+}
+
+void assignSlots(const std::vector<FunctionDefinition*>& functions, SlotTable& slots) {
+    Names names(slots);
+    for (FunctionDefinition* function : functions) {
+        resolveFunction(names, *function, true);
+    }
+}
+
+void resolveFunctions(const FunctionTable& funcExpressions, const std::vector<FunctionDefinition*>& functions, SlotTable& slots, std::vector<std::vector<Symbol>>* reads) {
+    // a few functions read too few names to be worth a table of every function by symbol
+    Names names(slots);
+    names.table = &funcExpressions;
+    resolveFunctions(names, functions, reads);
+}
+
+const FunctionDefinition* tailCallee(const ExpressionLine& returned, ExpressionLine& args) {
+    if (returned.size() != 1) { return nullptr; }
+    const Expression* expression = returned[0];
+    if (expression->expressionType == ExpressionType::CALL) {
+        args = expression->as<CallExpression>()->args;
+        return expression->as<CallExpression>()->callee->function;
+    }
+    // a bare name is only certainly a call if no variable shadows it
+    if (expression->expressionType == ExpressionType::VALUE && expression->slot < 0) {
+        args = ExpressionLine();
+        return expression->as<ValueExpression>()->function;
+    }
+    return nullptr;
+}
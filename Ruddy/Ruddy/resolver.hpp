@@ -0,0 +1,53 @@
+#ifndef resolver_hpp
+#define resolver_hpp
+
+#include <stdio.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+
+// --- Resolver
+// apart from parameters, variables are shared by every function, so there's a
+// single global scope: each name that's assigned anywhere in the program gets
+// a fixed index into one flat frame. a parameter is slot = its position in
+// the parameter list, with Expression::local set
+struct SlotTable {
+    std::vector<int> slotBySymbol; // -1 for names that are never assigned
+    std::vector<std::string> slotNames;
+
+    int size() const { return (int) slotNames.size(); }
+    int slotOf(Symbol symbol) const { return symbol < slotBySymbol.size() ? slotBySymbol[symbol] : -1; }
+    int add(Symbol symbol, std::string_view name) {
+        if (symbol >= slotBySymbol.size()) { slotBySymbol.resize(symbol + 1, -1); }
+        slotBySymbol[symbol] = size();
+        slotNames.push_back(std::string(name));
+        return slotBySymbol[symbol];
+    }
+};
+
+// fills in Expression::slot on every variable read/write and
+// ValueExpression::function on every name that's a function. run once after
+// parse(). with reads, also gives every function's globals read (in table
+// order), see resolveFunctions()
+SlotTable resolve(FunctionTable& funcExpressions, std::vector<std::vector<Symbol>>* reads = nullptr);
+
+// resolve() a few functions at a time, for reloading a script whose other
+// functions are already resolved (see ruddy::Program::reload()). slots
+// starts out as the version before's, so every variable keeps its slot and
+// new ones go on the end. assignSlots() is resolve()'s first pass on its
+// own, it only adds the slots functions assign. resolveFunctions() does
+// both passes, and with reads also gives every function's globals read,
+// sorted: the names whose meaning its resolved (and optimized) tree depends on
+void assignSlots(const std::vector<FunctionDefinition*>& functions, SlotTable& slots);
+void resolveFunctions(const FunctionTable& funcExpressions, const std::vector<FunctionDefinition*>& functions, SlotTable& slots, std::vector<std::vector<Symbol>>* reads = nullptr);
+
+// the function a `return` hands straight over to, when all it returns is a
+// call: `return f(x)` or `return f`. nullptr otherwise. both backends turn
+// these into jumps so tail recursion runs in constant space
+const FunctionDefinition* tailCallee(const ExpressionLine& returned, ExpressionLine& args);
+
+#endif /* resolver_hpp */
@@ -0,0 +1,474 @@
+#include "ruddy.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+#include "frontend.hpp"
+#include "lexer.hpp"
+#include "memo.hpp"
+#include "optimizer.hpp"
+#include "types.hpp"
+
+namespace ruddy {
+
+namespace {
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the function regions of source (all but the first) by name, false if a
+// name comes up twice or a region has none
+bool regionsByName(const std::vector<SourceRegion>& regions, std::unordered_map<std::string_view, size_t>& byName) {
+    byName.reserve(regions.size());
+    for (size_t regionIdx = 1; regionIdx < regions.size(); regionIdx++) {
+        if (regions[regionIdx].name.empty() || !byName.emplace(regions[regionIdx].name, regionIdx).second) { return false; }
+    }
+    return true;
+}
+
+// false if statements outside any function sit in region, the parser hands
+// them to whatever function comes next: a region has to be nothing but
+// blanks before the first function, and end on its endfn after that
+bool selfContained(const SourceRegion& region) {
+    std::string_view text = region.text;
+    size_t last = text.find_last_not_of(" \t\r\n");
+    if (region.name.empty()) { return last == std::string_view::npos; }
+    text = text.substr(0, last + 1);
+    size_t lineStart = text.find_last_of('\n') + 1;
+    size_t keyword = text.find_first_not_of(" \t", lineStart);
+    return keyword != std::string_view::npos && text.substr(keyword) == "endfn";
+}
+
+bool samePurityFacts(const PurityFacts& a, const PurityFacts& b) {
+    if (a.localOnly != b.localOnly) { return false; }
+    std::vector<const FunctionDefinition*> aCallees = a.callees, bCallees = b.callees;
+    std::sort(aCallees.begin(), aCallees.end());
+    aCallees.erase(std::unique(aCallees.begin(), aCallees.end()), aCallees.end());
+    std::sort(bCallees.begin(), bCallees.end());
+    bCallees.erase(std::unique(bCallees.begin(), bCallees.end()), bCallees.end());
+    return aCallees == bCallees;
+}
+
+}
+
+bool Program::compile(std::string_view source, const CompileOptions& options) {
+    generation = std::make_shared<Generation>();
+    generation->text = std::string(source);
+    const std::string& text = generation->text;
+    Arena& arena = generation->arena;
+    CompileStats& stats = compileStats;
+
+    // a warm start maps the parsed program straight out of the .rdc cache and
+    // skips the whole front end
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    AllocationCount allocationsBefore = allocationsSoFar();
+    uint64_t sourceHash = 0;
+    if (!options.cachePath.empty()) {
+        sourceHash = hashSource(text);
+        // dumpAst wants the tree before optimization, a profile wants line
+        // numbers and reload() the names each function reads before
+        // optimize() folds some away, the cache keeps none of them
+        stats.cacheHit = !options.dumpAst && !options.lineNumbers && !options.reloadable && generation->cache.load(options.cachePath, sourceHash, options.optimize, funcExpressions, slotTable);
+        stats.cacheMs = elapsedMs(phaseStart);
+        stats.cacheAllocations = allocationsSoFar() - allocationsBefore;
+    }
+
+    // basic flow: source -> tokens -> expressions -> bytecode
+    LineNumbers lineNumbers;
+    LineNumbers* statementLines = options.lineNumbers ? &lineNumbers : nullptr;
+    if (!stats.cacheHit) {
+        // parse straight into the arena, the whole AST is freed in one go with the Program
+        stats.parseThreads = options.memoryStats ? 1 : frontEndThreads(text, options.parseThreads);
+        if (stats.parseThreads > 1) {
+            // lexing happens piece by piece inside, so it all counts as parse
+            phaseStart = std::chrono::steady_clock::now();
+            if (!parseInParallel(text, arena, funcExpressions, problems, stats.parseThreads, statementLines)) {
+                stats.parseThreads = 1;
+            }
+        } else {
+            phaseStart = std::chrono::steady_clock::now();
+            allocationsBefore = allocationsSoFar();
+            TokenStream tokens = tokenize(text);
+            stats.lexMs = elapsedMs(phaseStart);
+            stats.lexAllocations = allocationsSoFar() - allocationsBefore;
+            if (options.memoryStats) {
+                stats.tokensByType = countTokensByType(tokens);
+            }
+
+            phaseStart = std::chrono::steady_clock::now();
+            allocationsBefore = allocationsSoFar();
+            parse(arena, funcExpressions, tokens, problems, statementLines);
+        }
+        if (!problems.empty()) {
+            return false;
+        }
+        std::vector<std::vector<Symbol>> reads;
+        slotTable = resolve(funcExpressions, options.reloadable ? &reads : nullptr);
+        stats.parseMs = elapsedMs(phaseStart);
+        stats.parseAllocations = allocationsSoFar() - allocationsBefore;
+
+        // throughput is per parsed node, so count before optimize() folds any away
+        if (options.countNodes) {
+            stats.nodes = countNodes(funcExpressions);
+        }
+        if (options.memoryStats) {
+            stats.parsedByType = countNodesByType(funcExpressions);
+        }
+
+        if (options.dumpAst) {
+            stats.astBefore = printFunctionTable(funcExpressions);
+        }
+        phaseStart = std::chrono::steady_clock::now();
+        allocationsBefore = allocationsSoFar();
+        if (options.optimize) {
+            optimize(arena, funcExpressions);
+        }
+        stats.optimizeMs = elapsedMs(phaseStart);
+        stats.optimizeAllocations = allocationsSoFar() - allocationsBefore;
+        if (options.dumpAst) {
+            stats.astAfter = printFunctionTable(funcExpressions);
+        }
+
+        if (!options.cachePath.empty()) {
+            writeProgramCache(options.cachePath, sourceHash, options.optimize, funcExpressions, slotTable);
+        }
+        if (options.reloadable) {
+            keepRecords(reads);
+        }
+    }
+
+    // purity isn't kept in the cache, it's cheap enough to work out every time
+    if (records.empty()) {
+        markPureFunctions(funcExpressions);
+    } else {
+        std::vector<const PurityFacts*> facts;
+        for (const auto& record : records) { facts.push_back(&record.second.purity); }
+        markPureFunctions(funcExpressions, facts);
+    }
+
+    phaseStart = std::chrono::steady_clock::now();
+    allocationsBefore = allocationsSoFar();
+    bytecode = ::compile(funcExpressions, slotTable, statementLines);
+    stats.compileMs = elapsedMs(phaseStart);
+    stats.compileAllocations = allocationsSoFar() - allocationsBefore;
+    if (options.memoryStats) {
+        stats.optimizedByType = countNodesByType(funcExpressions);
+        stats.arenaBytes = arena.bytesUsed();
+        stats.arenaReserved = arena.bytesReserved();
+    }
+    return true;
+}
+
+void Program::keepRecords(const std::vector<std::vector<Symbol>>& reads) {
+    // a function defined twice, or one region running into the next, and
+    // reload() can't tell which text a function came from
+    std::vector<SourceRegion> regions = cutAtFunctions(generation->text, 0);
+    std::unordered_map<std::string_view, size_t> byName;
+    if (!regionsByName(regions, byName) || byName.size() != funcExpressions.size()) { return; }
+    for (const SourceRegion& region : regions) {
+        if (!selfContained(region)) { return; }
+    }
+    for (const auto& funcExpression : funcExpressions) {
+        if (byName.find(funcExpression.first) == byName.end()) { return; }
+    }
+
+    for (const SourceRegion& region : regions) {
+        regionHashes.emplace_back(region.name, hashSource(region.text));
+    }
+    size_t functionIdx = 0;
+    for (const auto& funcExpression : funcExpressions) {
+        FunctionRecord& record = records[funcExpression.first];
+        record.hash = regionHashes[byName[funcExpression.first]].second;
+        record.generation = generation;
+        record.reads = reads[functionIdx++];
+        record.purity = purityFacts(funcExpression.second);
+    }
+}
+
+bool Program::reload(Program& previous, std::string_view source, const CompileOptions& options) {
+    CompileOptions reloadOptions = options;
+    reloadOptions.reloadable = true;
+    if (previous.records.empty() || options.lineNumbers || options.dumpAst) {
+        return compile(source, reloadOptions);
+    }
+    // starting over leaves previous alone, nothing is taken from it until
+    // the new version is known to compile
+    auto compileFromScratch = [&]() {
+        problems.clear();
+        regionHashes.clear();
+        compileStats = CompileStats();
+        return compile(source, reloadOptions);
+    };
+
+    generation = std::make_shared<Generation>();
+    generation->text = std::string(source);
+    CompileStats& stats = compileStats;
+
+    // the usual edit leaves the same functions in the same order, and then
+    // nothing needs looking up by name
+    std::vector<SourceRegion> regions = cutAtFunctions(generation->text, 0);
+    bool sameLayout = regions.size() == previous.regionHashes.size();
+    for (size_t regionIdx = 0; sameLayout && regionIdx < regions.size(); regionIdx++) {
+        sameLayout = regions[regionIdx].name == previous.regionHashes[regionIdx].first;
+    }
+    std::unordered_map<std::string_view, size_t> byName;
+    if (!sameLayout && !regionsByName(regions, byName)) {
+        return compileFromScratch();
+    }
+    auto isFunction = [&](std::string_view name) {
+        return sameLayout ? previous.records.find(name) != previous.records.end() : byName.find(name) != byName.end();
+    };
+
+    // the regions whose text changed, checked against the region in the
+    // same place first. a whole new version is quicker to compile from scratch
+    std::vector<size_t> edited;
+    size_t kept = 0; // functions previous has too
+    for (size_t regionIdx = 0; regionIdx < regions.size(); regionIdx++) {
+        const SourceRegion& region = regions[regionIdx];
+        regionHashes.emplace_back(region.name, hashSource(region.text));
+        uint64_t hash = regionHashes.back().second;
+        bool same = regionIdx < previous.regionHashes.size() && previous.regionHashes[regionIdx].first == region.name && previous.regionHashes[regionIdx].second == hash;
+        bool existed = same || regionIdx == 0;
+        if (!same && regionIdx > 0) {
+            std::map<std::string, FunctionRecord, std::less<>>::const_iterator record = previous.records.find(region.name);
+            existed = record != previous.records.end();
+            same = existed && record->second.hash == hash;
+        }
+        kept += regionIdx > 0 && existed ? 1 : 0;
+        if (!same) { edited.push_back(regionIdx); }
+    }
+    if (edited.size() > regions.size() / 2) {
+        return compileFromScratch();
+    }
+
+    // each of them on its own, into a table of just those. a region that
+    // doesn't hold exactly the function it's named for has to be read in context
+    FunctionTable parsed;
+    std::map<std::string_view, size_t> parsedFrom; // region by function
+    std::vector<SpawnSite> spawns;
+    auto parseRegion = [&](size_t regionIdx) {
+        const SourceRegion& region = regions[regionIdx];
+        std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+        TokenStream tokens = tokenize(region.text);
+        stats.lexMs += elapsedMs(phaseStart);
+
+        phaseStart = std::chrono::steady_clock::now();
+        size_t parsedBefore = parsed.size();
+        bool complete = parseLines(generation->arena, parsed, tokens, region.firstLine, problems, spawns);
+        stats.parseMs += elapsedMs(phaseStart);
+        if (region.name.empty()) { return complete && parsed.size() == parsedBefore; }
+        parsedFrom[region.name] = regionIdx;
+        return complete && parsed.size() == parsedBefore + 1 && parsed.find(region.name) != parsed.end();
+    };
+    for (size_t regionIdx : edited) {
+        if (!parseRegion(regionIdx)) {
+            return compileFromScratch();
+        }
+    }
+    if (!problems.empty()) {
+        return false;
+    }
+
+    // names that mean something else now. a function that reads one has a
+    // tree resolved and optimized for the old meaning, so it's parsed again too
+    SlotTable slots = previous.slotTable;
+    std::vector<FunctionDefinition*> changedFunctions;
+    for (auto& function : parsed) { changedFunctions.push_back(&function.second); }
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    assignSlots(changedFunctions, slots);
+    stats.parseMs += elapsedMs(phaseStart);
+
+    std::vector<bool> meaningChanged; // by symbol
+    bool anyMeaningChanged = false;
+    auto changeMeaning = [&](std::string_view name) {
+        Symbol symbol = symbolTable.intern(name);
+        if (symbol >= meaningChanged.size()) { meaningChanged.resize(symbol + 1, false); }
+        meaningChanged[symbol] = true;
+        anyMeaningChanged = true;
+    };
+    for (int slot = previous.slotTable.size(); slot < slots.size(); slot++) {
+        changeMeaning(slots.slotNames[slot]);
+    }
+    for (const auto& function : parsed) {
+        std::map<std::string, int, std::less<>>::const_iterator indexed = previous.bytecode.functionIndex.find(function.first);
+        if (indexed == previous.bytecode.functionIndex.end() || previous.bytecode.functions[indexed->second].paramCount != (int) function.second.params.size()) {
+            changeMeaning(function.first);
+        }
+    }
+    std::vector<std::string_view> gone;
+    if (kept < previous.records.size()) {
+        for (const auto& record : previous.records) {
+            if (isFunction(record.first)) { continue; }
+            gone.push_back(record.first);
+            changeMeaning(record.first);
+        }
+    }
+    if (anyMeaningChanged) {
+        for (size_t regionIdx = 1; regionIdx < regions.size(); regionIdx++) {
+            if (parsed.find(regions[regionIdx].name) != parsed.end()) { continue; }
+            for (Symbol symbol : previous.records.find(regions[regionIdx].name)->second.reads) {
+                if (symbol < meaningChanged.size() && meaningChanged[symbol]) {
+                    parseRegion(regionIdx);
+                    break;
+                }
+            }
+        }
+    }
+    checkSpawns(isFunction, spawns, problems);
+    if (!problems.empty()) {
+        return false;
+    }
+    // the types of globals are only followed while nothing spawns (see
+    // types.hpp), so the functions kept can't stay if that changes
+    bool sharedGlobals = previous.bytecode.usesTasks;
+    if (sharedGlobals && spawns.empty()) {
+        sharedGlobals = false;
+        for (const auto& function : previous.funcExpressions) {
+            if (parsed.find(function.first) == parsed.end() && isFunction(function.first) && spawnsTasks(function.second)) {
+                sharedGlobals = true;
+                break;
+            }
+        }
+    }
+    if (options.optimize && sharedGlobals != (previous.bytecode.usesTasks || !spawns.empty())) {
+        return compileFromScratch();
+    }
+
+    // nothing can fail from here on, so the tree is taken over. a function
+    // that changed keeps its node, with the new definition in it, since
+    // the trees of the others point at it
+    funcExpressions = std::move(previous.funcExpressions);
+    records = std::move(previous.records);
+    previous.funcExpressions.clear();
+    previous.records.clear();
+    for (std::string_view name : gone) {
+        funcExpressions.erase(funcExpressions.find(name));
+        records.erase(records.find(name));
+    }
+    std::vector<std::string_view> changed;
+    std::vector<bool> wasPure;
+    changedFunctions.clear();
+    for (std::pair<const std::string, FunctionDefinition>& function : parsed) {
+        FunctionTable::iterator entry = funcExpressions.find(function.first);
+        bool existed = entry != funcExpressions.end();
+        if (!existed) { entry = funcExpressions.emplace(function.first, FunctionDefinition()).first; }
+        wasPure.push_back(existed && entry->second.pure);
+        entry->second = function.second;
+        changed.push_back(entry->first);
+        changedFunctions.push_back(&entry->second);
+    }
+    slotTable = std::move(slots);
+
+    phaseStart = std::chrono::steady_clock::now();
+    std::vector<std::vector<Symbol>> reads;
+    resolveFunctions(funcExpressions, changedFunctions, slotTable, &reads);
+    stats.parseMs += elapsedMs(phaseStart);
+
+    phaseStart = std::chrono::steady_clock::now();
+    if (options.optimize) {
+        for (FunctionDefinition* function : changedFunctions) { optimize(generation->arena, *function, sharedGlobals); }
+    }
+    stats.optimizeMs = elapsedMs(phaseStart);
+
+    // purity only has to be worked out again if what it's worked out from
+    // changed, which an edit inside a function body mostly doesn't
+    bool purityChanged = !gone.empty();
+    for (size_t changedIdx = 0; changedIdx < changed.size(); changedIdx++) {
+        PurityFacts purity = purityFacts(*changedFunctions[changedIdx]);
+        std::map<std::string, FunctionRecord, std::less<>>::iterator record = records.find(changed[changedIdx]);
+        if (record == records.end()) {
+            purityChanged = true;
+            record = records.emplace(std::string(changed[changedIdx]), FunctionRecord()).first;
+        } else if (!samePurityFacts(record->second.purity, purity)) {
+            purityChanged = true;
+        }
+        record->second.hash = regionHashes[parsedFrom[changed[changedIdx]]].second;
+        record->second.generation = generation;
+        record->second.reads = std::move(reads[changedIdx]);
+        record->second.purity = std::move(purity);
+    }
+    if (purityChanged) {
+        std::vector<const PurityFacts*> facts;
+        for (const auto& record : records) { facts.push_back(&record.second.purity); }
+        markPureFunctions(funcExpressions, facts);
+    } else {
+        for (size_t changedIdx = 0; changedIdx < changed.size(); changedIdx++) {
+            changedFunctions[changedIdx]->pure = wasPure[changedIdx];
+        }
+    }
+
+    phaseStart = std::chrono::steady_clock::now();
+    bytecode = recompile(previous.bytecode, funcExpressions, slotTable, changed, purityChanged);
+    stats.compileMs = elapsedMs(phaseStart);
+    stats.reparsed = (int) changed.size();
+    stats.reused = (int) (funcExpressions.size() - changed.size());
+    return true;
+}
+
+bool LiveProgram::compile(std::string_view source, const CompileOptions& compileOptions) {
+    std::lock_guard<std::mutex> lock(reloading);
+    options = compileOptions;
+    options.reloadable = true;
+    std::shared_ptr<Program> next = std::make_shared<Program>();
+    bool compiled = next->compile(source, options);
+    problems = next->diagnostics();
+    compileStats = next->stats();
+    if (compiled) { std::atomic_store(&program, next); }
+    return compiled;
+}
+
+bool LiveProgram::reload(std::string_view source) {
+    std::lock_guard<std::mutex> lock(reloading);
+    std::shared_ptr<Program> previous = std::atomic_load(&program);
+    std::shared_ptr<Program> next = std::make_shared<Program>();
+    bool compiled = previous ? next->reload(*previous, source, options) : next->compile(source, options);
+    problems = next->diagnostics();
+    compileStats = next->stats();
+    if (compiled) { std::atomic_store(&program, next); }
+    return compiled;
+}
+
+Interpreter::Interpreter(const Program& program, OutputSink& out) : program(&program) {
+    vm.out = &out;
+    vm.variables.resize(program.code().slotNames.size());
+}
+
+void Interpreter::setProgram(const Program& next) {
+    // reload() only ever adds slots, each variable stays where it was
+    program = &next;
+    vm.forgetProgram();
+    vm.variables.resize(next.code().slotNames.size());
+}
+
+bool Interpreter::run(const std::string& function, const std::vector<Value>& args) {
+    return vm.run(program->code(), function, args);
+}
+
+void Interpreter::reset() {
+    vm.variables.assign(program->code().slotNames.size(), Value());
+}
+
+int Interpreter::slotOf(std::string_view name) const {
+    const std::vector<std::string>& slotNames = program->code().slotNames;
+    for (size_t slot = 0; slot < slotNames.size(); slot++) {
+        if (slotNames[slot] == name) { return (int) slot; }
+    }
+    return -1;
+}
+
+Value Interpreter::get(std::string_view name) const {
+    int slot = slotOf(name);
+    return slot < 0 ? Value() : vm.variables[slot];
+}
+
+bool Interpreter::set(std::string_view name, Value value) {
+    int slot = slotOf(name);
+    if (slot < 0) { return false; }
+    vm.variables[slot] = std::move(value);
+    return true;
+}
+
+}
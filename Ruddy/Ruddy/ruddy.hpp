@@ -0,0 +1,216 @@
+#ifndef ruddy_hpp
+#define ruddy_hpp
+
+#include <stdio.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "allocations.hpp"
+#include "arena.hpp"
+#include "cache.hpp"
+#include "compiler.hpp"
+#include "memo.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "profiler.hpp"
+#include "resolver.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+
+// --- libruddy
+// the embedding API, everything the command line tool does goes through it.
+// a Program is a script compiled once, an Interpreter runs its functions on
+// the VM as often as the host likes. only the command line tool's
+// --tree_walk still works on the process-wide globals in evaluator.hpp
+namespace ruddy {
+
+struct CompileOptions {
+    bool optimize = true;
+    int parseThreads = 0;     // for scripts of 256 KB or more, 0 for one per core, see frontend.hpp
+    bool lineNumbers = false; // keep every statement's line, what a Profiler reports by
+    bool dumpAst = false;     // keep printouts of the tree before and after optimization
+    bool countNodes = false;
+    // count allocations per phase (see allocations.hpp) and tokens and nodes
+    // by type. the front end then runs in one piece, lexing and parsing on
+    // several threads at once couldn't be told apart
+    bool memoryStats = false;
+    std::string cachePath;    // an .rdc file to load from and write to, empty for none (see cache.hpp)
+    bool reloadable = false;  // keep what reload() needs. the cache is only written then, never read
+};
+
+// what compile() did and how long each phase took
+struct CompileStats {
+    double cacheMs = 0, lexMs = 0, parseMs = 0, optimizeMs = 0, compileMs = 0;
+    bool cacheHit = false;
+    int parseThreads = 1;  // more than one if the front end really ran in parallel
+    size_t nodes = 0;      // before optimization, only with countNodes and on a cache miss
+    int reparsed = 0;      // functions reload() lexed and parsed again
+    int reused = 0;        // and the ones it took over as they were
+    std::string astBefore; // only with dumpAst
+    std::string astAfter;
+
+    // only with memoryStats and from compile(). the tokens and the nodes
+    // before optimization only on a cache miss
+    AllocationCount cacheAllocations, lexAllocations, parseAllocations, optimizeAllocations, compileAllocations;
+    std::vector<size_t> tokensByType;    // by TokenType
+    std::vector<size_t> parsedByType;    // by ExpressionType, as parse() made them
+    std::vector<size_t> optimizedByType; // and as they're run
+    size_t arenaBytes = 0;               // the tree's arena, used and reserved
+    size_t arenaReserved = 0;
+};
+
+// a compiled script. immutable once compile() has succeeded, so any number
+// of Interpreters can share it, except that a reload() from it takes its
+// tree over. Programs can be compiled on several threads at once
+class Program {
+public:
+    Program() {}
+
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    // lexes, parses, resolves, optimizes and compiles source, which is
+    // copied (the tree points into it). false if it doesn't parse, with
+    // the reasons in diagnostics(). call it once per Program
+    bool compile(std::string_view source, const CompileOptions& options = CompileOptions());
+
+    // compile() for an edited version of the script previous was compiled
+    // from (reloadable). source is cut into its `fn` ... endfn regions
+    // (see cutAtFunctions()) and only the regions whose text changed are
+    // lexed and parsed, together with any function whose tree depends on a
+    // name that changed meaning: a new global, a function that came, went
+    // or takes a different number of arguments. every other function's
+    // tree, and its bytecode, is taken over as it is, so the time it takes
+    // goes with the size of the edit rather than of the file.
+    // previous keeps its code(), so Interpreters that are still running it
+    // can finish, but hands its functions() over. false if source doesn't
+    // compile, and previous is left as it was. whenever reusing isn't safe
+    // (a name defined twice, statements outside functions, line numbers or
+    // an AST dump asked for) it quietly compiles from scratch
+    bool reload(Program& previous, std::string_view source, const CompileOptions& options = CompileOptions());
+
+    bool has(std::string_view function) const { return bytecode.functionIndex.find(function) != bytecode.functionIndex.end(); }
+
+    std::string_view source() const { return generation->text; }
+    const std::vector<Diagnostic>& diagnostics() const { return problems; }
+    const CompileStats& stats() const { return compileStats; }
+
+    // the tree (optimized unless turned off) and the bytecode made from it
+    const FunctionTable& functions() const { return funcExpressions; }
+    const SlotTable& slots() const { return slotTable; }
+    const ::Program& code() const { return bytecode; }
+
+private:
+    // the source and everything the tree points into. a reloaded Program
+    // shares the ones its unchanged functions came from with the version
+    // before
+    struct Generation {
+        std::string text;
+        Arena arena;
+        ProgramCache cache; // on a hit the tree lives in here rather than in arena
+    };
+
+    // what reload() needs to know to keep a function
+    struct FunctionRecord {
+        uint64_t hash;                          // of its region of the source
+        std::shared_ptr<Generation> generation; // the one its tree lives in
+        std::vector<Symbol> reads;              // see resolveFunctions()
+        PurityFacts purity;
+    };
+
+    // fills in records, if every function has a region of its own
+    void keepRecords(const std::vector<std::vector<Symbol>>& reads);
+
+    std::shared_ptr<Generation> generation;
+    std::map<std::string, FunctionRecord, std::less<>> records; // by name, empty unless reloadable
+    // every region's name and hash in source order, starting with whatever
+    // comes before the first function (see cutAtFunctions())
+    std::vector<std::pair<std::string_view, uint64_t>> regionHashes;
+    FunctionTable funcExpressions;
+    SlotTable slotTable;
+    ::Program bytecode;
+    std::vector<Diagnostic> problems;
+    CompileStats compileStats;
+};
+
+// a script that's edited while it runs: compile() it once, then reload()
+// it whenever the source changes. every version is a Program of its own,
+// and reload() swaps the next one in with a single atomic store, so
+// current() always hands out a whole version, never half of one. runs
+// already going on an older version finish on it. current() can be called
+// from any thread at any time, reloads take turns
+class LiveProgram {
+public:
+    bool compile(std::string_view source, const CompileOptions& options = CompileOptions());
+    // false if source doesn't compile, current() then stays what it was
+    bool reload(std::string_view source);
+
+    std::shared_ptr<const Program> current() const { return std::atomic_load(&program); }
+
+    // of the last compile() or reload(), for the thread that made it
+    const std::vector<Diagnostic>& diagnostics() const { return problems; }
+    const CompileStats& stats() const { return compileStats; }
+
+private:
+    std::mutex reloading;
+    CompileOptions options;
+    std::shared_ptr<Program> program; // only ever loaded and stored atomically
+    std::vector<Diagnostic> problems;
+    CompileStats compileStats;
+};
+
+// runs one Program. variables live from one run to the next until reset(),
+// so a host can call an init function once and then others that build on
+// what it set up. an Interpreter is for one thread at a time, but any number
+// of them can run the same Program at once, each on its own thread. several
+// of them printing to one sink need it setShared(true) first
+class Interpreter {
+public:
+    // print goes to out, which has to outlive the interpreter
+    explicit Interpreter(const Program& program, OutputSink& out = output);
+
+    // same as the VM's, see vm.hpp
+    void setJit(bool enabled) { vm.jitEnabled = enabled; }
+    void setThreads(int threads) { vm.threads = threads; }
+    void setMemoSize(size_t entries) { vm.memo.resize(entries); }
+    void setProfiler(Profiler* profiler) { vm.profiler = profiler; }
+
+    // runs the named function with args for its parameters, false if the
+    // program has no such function
+    bool run(const std::string& function = "main", const std::vector<Value>& args = std::vector<Value>());
+
+    // runs from now on run next instead, a later version of the same
+    // script (see Program::reload()): variables keep their values, and
+    // the ones next adds start out unassigned. not while a run is going
+    void setProgram(const Program& next);
+
+    // what the last run's function returned, NONE if it didn't
+    const Value& result() const { return vm.result; }
+
+    // every variable back to unassigned, as if nothing had run yet
+    void reset();
+
+    // a variable by name, NONE if it's unassigned or the script never
+    // assigns it anywhere
+    Value get(std::string_view name) const;
+    // false if the script never assigns name, there's nowhere to keep it
+    bool set(std::string_view name, Value value);
+
+    int jitCompiled() const { return vm.jitCompiled; }
+    const MemoCache& memo() const { return vm.memo; }
+
+private:
+    int slotOf(std::string_view name) const;
+
+    const Program* program;
+    VM vm;
+};
+
+}
+
+#endif /* ruddy_hpp */
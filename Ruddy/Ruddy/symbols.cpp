@@ -0,0 +1,63 @@
+#include "symbols.hpp"
+
+SymbolTable symbolTable;
+
+SymbolTable::SymbolTable() : arena(4 * 1024), buckets(256, 0) {
+    // same order as KeywordSymbol
+    for (std::string_view keyword : {"fn", "endfn", "if", "else", "endif", "print", "for", "to", "endfor", "while", "endwhile", "return", "spawn", "join"}) {
+        intern(keyword);
+    }
+}
+
+// FNV-1a, identifiers are short enough that anything fancier doesn't pay off
+uint32_t SymbolTable::hash(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+        h = (h ^ (unsigned char) c) * 16777619u;
+    }
+    return h;
+}
+
+Symbol SymbolTable::intern(std::string_view name, uint32_t h) {
+    std::lock_guard<std::mutex> guard(lock);
+    return insert(name, h);
+}
+
+Symbol SymbolTable::insert(std::string_view name, uint32_t h) {
+    size_t mask = buckets.size() - 1;
+    for (size_t bucketIdx = h & mask; ; bucketIdx = (bucketIdx + 1) & mask) {
+        uint32_t entry = buckets[bucketIdx];
+        if (entry == 0) {
+            Symbol symbol = (Symbol) names.size();
+            names.push_back(arena.copy(name));
+            hashes.push_back(h);
+            buckets[bucketIdx] = symbol + 1;
+            // keep the load factor under a half so probes stay short
+            if (names.size() * 2 > buckets.size()) { grow(); }
+            return symbol;
+        }
+        if (hashes[entry - 1] == h && names[entry - 1] == name) {
+            return entry - 1;
+        }
+    }
+}
+
+void SymbolTable::grow() {
+    std::vector<uint32_t> grown(buckets.size() * 2, 0);
+    size_t mask = grown.size() - 1;
+    for (Symbol symbol = 0; symbol < names.size(); symbol++) {
+        size_t bucketIdx = hashes[symbol] & mask;
+        while (grown[bucketIdx] != 0) { bucketIdx = (bucketIdx + 1) & mask; }
+        grown[bucketIdx] = symbol + 1;
+    }
+    buckets.swap(grown);
+}
+
+Symbol SymbolCache::intern(std::string_view name) {
+    uint32_t h = SymbolTable::hash(name);
+    Entry& entry = entries[h & (SIZE - 1)];
+    if (entry.symbol != NO_SYMBOL && entry.name == name) { return entry.symbol; }
+    entry.name = name;
+    entry.symbol = symbolTable.intern(name, h);
+    return entry.symbol;
+}
@@ -0,0 +1,92 @@
+#ifndef symbols_hpp
+#define symbols_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+
+// dense id for an identifier, keyword or number. the same spelling always
+// gets the same id within a process, so names compare as ints and anything
+// keyed by name can be a vector indexed by symbol
+typedef uint32_t Symbol;
+
+const Symbol NO_SYMBOL = UINT32_MAX;
+
+// interned before anything else, so their ids are fixed
+enum KeywordSymbol : Symbol {
+    FN_SYMBOL,
+    ENDFN_SYMBOL,
+    IF_SYMBOL,
+    ELSE_SYMBOL,
+    ENDIF_SYMBOL,
+    PRINT_SYMBOL,
+    FOR_SYMBOL,
+    TO_SYMBOL,
+    ENDFOR_SYMBOL,
+    WHILE_SYMBOL,
+    ENDWHILE_SYMBOL,
+    RETURN_SYMBOL,
+    SPAWN_SYMBOL,
+    JOIN_SYMBOL,
+    KEYWORD_COUNT
+};
+
+// --- Symbol table
+// open-addressed hash of spelling -> symbol. spellings are copied into the
+// table's own arena, so symbols stay valid after the source is unmapped.
+// there's one per process, shared by every Program however many threads are
+// compiling them, so intern() always takes a lock. which symbol a new
+// spelling gets depends on who gets there first, nothing may rely on the
+// order. the lexer goes through a SymbolCache, which keeps the lock off the
+// path for all but a file's first few uses of a name
+class SymbolTable {
+public:
+    SymbolTable();
+
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    Symbol intern(std::string_view name) { return intern(name, hash(name)); }
+    Symbol intern(std::string_view name, uint32_t h);
+    // not locked, only safe while nothing is being interned
+    std::string_view name(Symbol symbol) const { return names[symbol]; }
+    size_t size() const { return names.size(); }
+
+    static uint32_t hash(std::string_view name);
+
+private:
+    Symbol insert(std::string_view name, uint32_t h);
+    void grow();
+
+    std::mutex lock;
+    Arena arena;
+    std::vector<std::string_view> names; // by symbol
+    std::vector<uint32_t> hashes;        // by symbol
+    std::vector<uint32_t> buckets;       // symbol + 1, 0 is empty
+};
+
+extern SymbolTable symbolTable;
+
+// direct-mapped cache of recent spellings in front of symbolTable, one per
+// lexer (or cache load), so the table is only locked for spellings this one
+// hasn't seen lately. the spellings it keeps point into the text being read
+class SymbolCache {
+public:
+    Symbol intern(std::string_view name);
+
+private:
+    static const size_t SIZE = 1024;
+
+    struct Entry {
+        std::string_view name;
+        Symbol symbol = NO_SYMBOL;
+    };
+    Entry entries[SIZE];
+};
+
+#endif /* symbols_hpp */
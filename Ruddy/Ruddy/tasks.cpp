@@ -0,0 +1,77 @@
+#include "tasks.hpp"
+
+TaskPool::TaskPool(int threads, RunTask runTask) : runTask(std::move(runTask)) {
+    if (threads < 1) { threads = 1; }
+    for (int worker = 0; worker < threads; worker++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int worker = 0; worker < threads - 1; worker++) {
+        workers.emplace_back(&TaskPool::workerLoop, this, worker);
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+        stopping = true;
+    }
+    idle.notify_all();
+    for (std::thread& worker : workers) { worker.join(); }
+}
+
+void TaskPool::submit(int worker, Task task) {
+    task.group->pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(queues[worker]->lock);
+        queues[worker]->tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    // taking idleLock orders this against a worker that's just about to sleep
+    { std::lock_guard<std::mutex> guard(idleLock); }
+    idle.notify_one();
+}
+
+bool TaskPool::take(int worker, Task& task) {
+    for (int offset = 0; offset < threads(); offset++) {
+        int victim = (worker + offset) % threads();
+        Queue& queue = *queues[victim];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) { continue; }
+        // the owner takes its newest task, a thief the oldest
+        if (victim == worker) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::wait(TaskGroup& group, int worker) {
+    Task task;
+    while (group.pending.load(std::memory_order_acquire) > 0) {
+        if (take(worker, task)) {
+            runTask(worker, task);
+        } else {
+            // what's left is running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskPool::workerLoop(int worker) {
+    Task task;
+    for (;;) {
+        if (take(worker, task)) {
+            runTask(worker, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(idleLock);
+        idle.wait(guard, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping) { return; }
+    }
+}
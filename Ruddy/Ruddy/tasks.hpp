@@ -0,0 +1,76 @@
+#ifndef tasks_hpp
+#define tasks_hpp
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "value.hpp"
+
+// the tasks someone spawned and hasn't seen finish yet
+struct TaskGroup {
+    std::atomic<int> pending{0};
+};
+
+// one `spawn`: a function and its arguments. the arguments share no strings
+// with anything else (Value::unshared()), so whichever thread runs the task
+// owns them outright
+struct Task {
+    int function;
+    std::vector<Value> args;
+    TaskGroup* group;
+};
+
+// --- Task pool
+// work stealing: every worker has its own deque, pushes and pops at the back
+// and, when that's empty, steals from the front of someone else's. worker
+// `threads - 1` is whoever created the pool, it has a deque but no thread of
+// its own and only runs tasks while it waits in wait()
+class TaskPool {
+public:
+    typedef std::function<void(int worker, Task& task)> RunTask;
+
+    TaskPool(int threads, RunTask runTask);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    int threads() const { return (int) queues.size(); }
+
+    // counts the task into its group, which has to outlive it
+    void submit(int worker, Task task);
+
+    // runs other tasks until everything in group has finished, so a worker
+    // waiting on its children never leaves its thread idle
+    void wait(TaskGroup& group, int worker);
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    // own deque first, then the others round-robin
+    bool take(int worker, Task& task);
+    void workerLoop(int worker);
+
+    RunTask runTask;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    // idle workers sleep until something is queued
+    std::atomic<int> queued{0};
+    std::mutex idleLock;
+    std::condition_variable idle;
+    bool stopping = false;
+};
+
+#endif /* tasks_hpp */
@@ -0,0 +1,291 @@
+#include "types.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// what's known at one point of a function: the variables that certainly hold
+// an int or a string, sorted by key. a parameter's key is ~slot, a global's
+// its slot, anything missing could be anything
+typedef std::vector<std::pair<int32_t, StaticType>> Facts;
+
+int32_t keyOf(const Expression* variable) {
+    return variable->local ? ~variable->slot : variable->slot;
+}
+
+// only what holds on both paths
+Facts meet(const Facts& a, const Facts& b) {
+    Facts both;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(both));
+    return both;
+}
+
+// where both operands are ints, the int-only node for a generic one
+ExpressionType intVersion(ExpressionType expressionType) {
+    switch(expressionType) {
+        case ExpressionType::ADD:        { return ExpressionType::INT_ADD; }
+        case ExpressionType::SUB:        { return ExpressionType::INT_SUB; }
+        case ExpressionType::MUL:        { return ExpressionType::INT_MUL; }
+        case ExpressionType::DIV:        { return ExpressionType::INT_DIV; }
+        case ExpressionType::IS_LESS:    { return ExpressionType::INT_LT; }
+        case ExpressionType::IS_LEQ:     { return ExpressionType::INT_LEQ; }
+        case ExpressionType::IS_GREATER: { return ExpressionType::INT_GT; }
+        case ExpressionType::IS_GEQ:     { return ExpressionType::INT_GEQ; }
+        case ExpressionType::IS_EQ:      { return ExpressionType::INT_EQ; }
+        default:                         { return expressionType; }
+    }
+}
+
+// walks a function in the order it runs, keeping facts up to date. a loop is
+// first run round without rewriting anything until what's known at its top
+// stops changing, then once more for real, so nothing is rewritten on the
+// strength of a fact a later iteration breaks
+class Typer {
+public:
+    explicit Typer(bool sharedGlobals) : sharedGlobals(sharedGlobals), rewrite(true) {}
+
+    void block(const ExpressionBlock& expressions) {
+        for (const ExpressionLine& expressionLine : expressions) { line(expressionLine); }
+    }
+
+private:
+    // a line is worth the last value in it that isn't NONE
+    StaticType line(const ExpressionLine& expressionLine) {
+        StaticType last = StaticType::ANY;
+        for (Expression* expression : expressionLine) { last = visit(expression); }
+        return last;
+    }
+
+    StaticType visit(Expression* expression) {
+        switch(expression->expressionType) {
+            case ExpressionType::VALUE: {
+                const ValueExpression* value = expression->as<ValueExpression>();
+                StaticType known = value->slot >= 0 ? typeOf(keyOf(value)) : StaticType::ANY;
+                // an unassigned global falls back to the function of the same name
+                if (known == StaticType::ANY && !value->local && value->function != nullptr) { forgetGlobals(); }
+                return known;
+            }
+            case ExpressionType::INT:    { return StaticType::INT; }
+            case ExpressionType::STRING: { return StaticType::STR; }
+            case ExpressionType::PAREN:  { return line(expression->as<ListExpression>()->core); }
+            case ExpressionType::PRINT:
+            case ExpressionType::RETURN: {
+                line(expression->as<ListExpression>()->core);
+                return StaticType::ANY;
+            }
+            case ExpressionType::VAR: {
+                // assigning NONE stores "", so only a sure type carries over
+                StaticType assigned = line(expression->as<VarExpression>()->core);
+                assign(keyOf(expression), assigned);
+                return StaticType::ANY;
+            }
+            case ExpressionType::IF: {
+                IfExpression* ifExpr = expression->as<IfExpression>();
+                if (ifExpr->conditional != nullptr) { visit(ifExpr->conditional); }
+                Facts before = facts;
+                block(ifExpr->ifStatements);
+                Facts afterIf = std::move(facts);
+                facts = std::move(before);
+                block(ifExpr->elseStatements);
+                facts = meet(afterIf, facts);
+                return StaticType::ANY;
+            }
+            case ExpressionType::FOR: {
+                // the variable is set to the counter at the top of every
+                // iteration, and left alone if the body never runs
+                ForExpression* forExpr = expression->as<ForExpression>();
+                visit(forExpr->from);
+                visit(forExpr->limit);
+                Facts before = facts;
+                Facts top = loopTop(before, [&]() {
+                    assign(keyOf(forExpr), StaticType::INT);
+                    block(forExpr->body);
+                });
+                facts = std::move(top);
+                assign(keyOf(forExpr), StaticType::INT);
+                block(forExpr->body);
+                facts = meet(before, facts);
+                return StaticType::ANY;
+            }
+            case ExpressionType::WHILE: {
+                // the loop is left right after a condition that came out false
+                WhileExpression* whileExpr = expression->as<WhileExpression>();
+                Facts before = facts;
+                Facts top = loopTop(before, [&]() {
+                    visit(whileExpr->conditional);
+                    block(whileExpr->body);
+                });
+                facts = std::move(top);
+                visit(whileExpr->conditional);
+                Facts exit = facts;
+                block(whileExpr->body);
+                facts = std::move(exit);
+                return StaticType::ANY;
+            }
+            case ExpressionType::CALL: {
+                CallExpression* call = expression->as<CallExpression>();
+                if (call->callee->function == nullptr) {
+                    // the name followed by a paren group
+                    visit(call->callee);
+                    line(call->args);
+                    return StaticType::ANY;
+                }
+                line(call->args);
+                forgetGlobals();
+                return StaticType::ANY;
+            }
+            case ExpressionType::SPAWN: {
+                line(expression->as<CallExpression>()->args);
+                forgetGlobals();
+                return StaticType::ANY;
+            }
+            case ExpressionType::JOIN: {
+                forgetGlobals();
+                return StaticType::ANY;
+            }
+            case ExpressionType::INT_ADD:
+            case ExpressionType::INT_SUB:
+            case ExpressionType::INT_MUL:
+            case ExpressionType::INT_DIV:
+            case ExpressionType::INT_LT:
+            case ExpressionType::INT_LEQ:
+            case ExpressionType::INT_GT:
+            case ExpressionType::INT_GEQ:
+            case ExpressionType::INT_EQ:
+            case ExpressionType::STR_CONCAT: {
+                BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+                visit(binaryOp->left);
+                visit(binaryOp->right);
+                return expression->expressionType == ExpressionType::STR_CONCAT ? StaticType::STR : StaticType::INT;
+            }
+            default: {
+                // ADD is an int sum if the left side is an int and a
+                // concatenation otherwise, everything else always gives an int
+                BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+                StaticType left = visit(binaryOp->left);
+                StaticType right = visit(binaryOp->right);
+                bool isAdd = expression->expressionType == ExpressionType::ADD;
+                if (rewrite && left == StaticType::INT && right == StaticType::INT) {
+                    expression->expressionType = intVersion(expression->expressionType);
+                } else if (rewrite && isAdd && left == StaticType::STR) {
+                    expression->expressionType = ExpressionType::STR_CONCAT;
+                }
+                if (!isAdd || left == StaticType::INT) { return StaticType::INT; }
+                return left == StaticType::STR ? StaticType::STR : StaticType::ANY;
+            }
+        }
+    }
+
+    // what's known at the top of a loop whose body is iteration, entered
+    // with before. facts only ever get fewer, so this settles
+    template <typename Iteration>
+    Facts loopTop(const Facts& before, Iteration iteration) {
+        bool rewriting = rewrite;
+        rewrite = false;
+        Facts top = before;
+        for (;;) {
+            facts = top;
+            iteration();
+            Facts next = meet(before, facts);
+            if (next == top) { break; }
+            top = std::move(next);
+        }
+        rewrite = rewriting;
+        return top;
+    }
+
+    StaticType typeOf(int32_t key) const {
+        Facts::const_iterator fact = std::lower_bound(facts.begin(), facts.end(), std::make_pair(key, StaticType::ANY));
+        return fact != facts.end() && fact->first == key ? fact->second : StaticType::ANY;
+    }
+
+    void assign(int32_t key, StaticType type) {
+        Facts::iterator fact = std::lower_bound(facts.begin(), facts.end(), std::make_pair(key, StaticType::ANY));
+        bool known = fact != facts.end() && fact->first == key;
+        if (type == StaticType::ANY || (key >= 0 && sharedGlobals)) {
+            if (known) { facts.erase(fact); }
+        } else if (known) {
+            fact->second = type;
+        } else {
+            facts.insert(fact, std::make_pair(key, type));
+        }
+    }
+
+    // parameters are the running call's own, nothing else can touch them
+    void forgetGlobals() {
+        facts.erase(std::lower_bound(facts.begin(), facts.end(), std::make_pair(0, StaticType::ANY)), facts.end());
+    }
+
+    bool sharedGlobals;
+    bool rewrite; // false while a loop is being run round to see what holds at its top
+    Facts facts;
+};
+
+bool spawns(const ExpressionBlock& block);
+
+bool spawns(const ExpressionLine& expressionLine);
+
+bool spawns(const Expression* expression) {
+    switch(expression->expressionType) {
+        case ExpressionType::SPAWN:  { return true; }
+        case ExpressionType::VALUE:
+        case ExpressionType::STRING:
+        case ExpressionType::INT:
+        case ExpressionType::JOIN:   { return false; }
+        case ExpressionType::PAREN:
+        case ExpressionType::PRINT:
+        case ExpressionType::RETURN: { return spawns(expression->as<ListExpression>()->core); }
+        case ExpressionType::VAR:    { return spawns(expression->as<VarExpression>()->core); }
+        case ExpressionType::CALL:   { return spawns(expression->as<CallExpression>()->args); }
+        case ExpressionType::IF: {
+            const IfExpression* ifExpr = expression->as<IfExpression>();
+            return (ifExpr->conditional != nullptr && spawns(ifExpr->conditional)) || spawns(ifExpr->ifStatements) || spawns(ifExpr->elseStatements);
+        }
+        case ExpressionType::FOR: {
+            const ForExpression* forExpr = expression->as<ForExpression>();
+            return spawns(forExpr->from) || spawns(forExpr->limit) || spawns(forExpr->body);
+        }
+        case ExpressionType::WHILE: {
+            const WhileExpression* whileExpr = expression->as<WhileExpression>();
+            return spawns(whileExpr->conditional) || spawns(whileExpr->body);
+        }
+        default: {
+            const BinaryExpression* binaryOp = expression->as<BinaryExpression>();
+            return spawns(binaryOp->left) || spawns(binaryOp->right);
+        }
+    }
+}
+
+bool spawns(const ExpressionLine& expressionLine) {
+    for (const Expression* expression : expressionLine) {
+        if (spawns(expression)) { return true; }
+    }
+    return false;
+}
+
+bool spawns(const ExpressionBlock& block) {
+    for (const ExpressionLine& expressionLine : block) {
+        if (spawns(expressionLine)) { return true; }
+    }
+    return false;
+}
+
+}
+
+void specializeTypes(FunctionDefinition& function, bool sharedGlobals) {
+    Typer typer(sharedGlobals);
+    typer.block(function.body);
+}
+
+bool spawnsTasks(const FunctionTable& funcExpressions) {
+    for (const auto& function : funcExpressions) {
+        if (spawns(function.second.body)) { return true; }
+    }
+    return false;
+}
+
+bool spawnsTasks(const FunctionDefinition& function) {
+    return spawns(function.body);
+}
@@ -0,0 +1,38 @@
+#ifndef types_hpp
+#define types_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+
+#include "parser.hpp"
+
+// --- Type inference
+// values are typed at run time, but plenty of them can only ever be one
+// type: literals, whatever SUB, MUL, DIV and the comparisons give (always an
+// int), a variable right after it's been assigned one of those, a for
+// loop's variable inside the loop. specializeTypes() follows a function
+// statement by statement, works out which variables are certainly an int or
+// a string at each point, and rewrites the nodes whose operands it can prove
+// are ints into INT_ADD, INT_SUB ... INT_EQ, and an ADD whose left side is
+// certainly a string into STR_CONCAT. the backends run those without
+// looking at a tag. everything it can't prove keeps its generic node.
+// parameters start out unknown. what a global holds is forgotten at anything
+// that can run other code (a call, a name that may be a function, spawn,
+// join), and globals aren't followed at all when sharedGlobals, since then
+// a task on another thread can assign one at any moment
+enum class StaticType : uint8_t {
+    ANY, // could be anything, NONE included
+    INT,
+    STR,
+};
+
+// run on each function once optimize() has folded its constants, which is
+// where it's called from
+void specializeTypes(FunctionDefinition& function, bool sharedGlobals);
+
+// whether any function spawns, which makes every global shared between threads
+bool spawnsTasks(const FunctionTable& funcExpressions);
+bool spawnsTasks(const FunctionDefinition& function);
+
+#endif /* types_hpp */
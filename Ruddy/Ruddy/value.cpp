@@ -0,0 +1,93 @@
+#include "value.hpp"
+
+#include <cstddef>
+#include <vector>
+
+std::string valueTypeToStr(ValueType valueType) {
+    switch(valueType) {
+        case ValueType::INT:  { return "INT"; }
+        case ValueType::STR:  { return "STR"; }
+        case ValueType::NONE: { return "NONE"; }
+    }
+    return "";
+}
+
+const std::string& StringObject::flat() {
+    if (isFlat()) { return str; }
+
+    // in-order walk with an explicit stack, `s = s + ...` in a loop builds
+    // chains far deeper than the C stack
+    std::string joined;
+    joined.reserve(length);
+    std::vector<const StringObject*> pending{this};
+    while (!pending.empty()) {
+        const StringObject* object = pending.back();
+        pending.pop_back();
+        if (object->isFlat()) {
+            joined += object->str;
+        } else {
+            pending.push_back(object->right);
+            pending.push_back(object->left);
+        }
+    }
+
+    str = std::move(joined);
+    StringObject* parts[] = {left, right};
+    left = right = nullptr;
+    for (StringObject* part : parts) {
+        if (--part->refCount == 0) { destroy(part); }
+    }
+    return str;
+}
+
+void StringObject::destroy(StringObject* object) {
+    std::vector<StringObject*> dead{object};
+    while (!dead.empty()) {
+        object = dead.back();
+        dead.pop_back();
+        if (!object->isFlat()) {
+            if (--object->left->refCount == 0)  { dead.push_back(object->left); }
+            if (--object->right->refCount == 0) { dead.push_back(object->right); }
+        }
+        delete object;
+    }
+}
+
+Value Value::concat(const Value& left, const Value& right) {
+    StringObject* l = left.isStr() ? left.strValue : nullptr;
+    StringObject* r = right.isStr() ? right.strValue : nullptr;
+    if (r == nullptr || r->length == 0) { return l != nullptr ? left : fromStr(""); }
+    if (l == nullptr || l->length == 0) { return right; }
+
+    if (l->length + r->length < ROPE_MIN_LENGTH) {
+        return fromStr(l->flat() + r->flat());
+    }
+    l->refCount++;
+    r->refCount++;
+    Value value;
+    value.valueType = ValueType::STR;
+    value.strValue = new StringObject(l, r);
+    return value;
+}
+
+const std::string& Value::asStr() const {
+    static const std::string empty;
+    return valueType == ValueType::STR ? strValue->flat() : empty;
+}
+
+std::string Value::str() const {
+    switch(valueType) {
+        case ValueType::INT:  { return std::to_string(intValue); }
+        case ValueType::STR:  { return strValue->flat(); }
+        case ValueType::NONE: { return ""; }
+    }
+    return "";
+}
+
+size_t Value::typeOffset() {
+    return offsetof(Value, valueType);
+}
+
+size_t Value::intOffset() {
+    return offsetof(Value, intValue);
+}
@@ -0,0 +1,139 @@
+#ifndef value_hpp
+#define value_hpp
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+enum class ValueType : uint8_t {
+    NONE,
+    INT,
+    STR
+};
+
+// heap half of a string value. shared by every copy and never changed after
+// it's built, so copying a string value is just a refcount bump.
+// concatenating long strings doesn't copy either: the result just points at
+// both halves, and the characters are only joined the first time someone
+// asks for them (asStr()), after which the halves are let go
+struct StringObject {
+    int refCount;
+    size_t length;
+    StringObject* left;  // both set while this is an unjoined concatenation
+    StringObject* right;
+    std::string str;     // empty until joined
+
+    explicit StringObject(std::string s) : refCount(1), length(s.size()), left(nullptr), right(nullptr), str(std::move(s)) {}
+    StringObject(StringObject* left, StringObject* right) : refCount(1), length(left->length + right->length), left(left), right(right) {}
+
+    bool isFlat() const { return left == nullptr; }
+    const std::string& flat();
+
+    // frees this and every part that isn't shared any more, without
+    // recursing, so a long chain of concatenations can't overflow the stack
+    static void destroy(StringObject* object);
+};
+
+// concatenations shorter than this are copied straight away, joining a rope
+// of tiny pieces later would cost more than it saves
+const size_t ROPE_MIN_LENGTH = 64;
+
+// --- Value
+// a tag plus an inline int or a string handle. ints and NONE copy as plain
+// bits and never allocate, only building a new string touches the heap
+class Value {
+public:
+    Value() : valueType(ValueType::NONE), bits(0) {}
+
+    static Value fromInt(int i) {
+        Value value;
+        value.valueType = ValueType::INT;
+        value.intValue = i;
+        return value;
+    }
+
+    static Value fromStr(std::string s) {
+        Value value;
+        value.valueType = ValueType::STR;
+        value.strValue = new StringObject(std::move(s));
+        return value;
+    }
+
+    // what ADD does when the left side isn't an int. anything that isn't a
+    // string counts as ""
+    static Value concat(const Value& left, const Value& right);
+
+    // a copy that shares no string with this one. refcounts aren't atomic,
+    // so this is how a value is handed to another thread
+    Value unshared() const { return isStr() ? fromStr(asStr()) : *this; }
+
+    Value(const Value& other) : valueType(other.valueType), bits(other.bits) {
+        if (valueType == ValueType::STR) { strValue->refCount++; }
+    }
+
+    Value(Value&& other) noexcept : valueType(other.valueType), bits(other.bits) {
+        other.valueType = ValueType::NONE;
+    }
+
+    Value& operator=(const Value& other) {
+        if (other.valueType == ValueType::STR) { other.strValue->refCount++; }
+        release();
+        valueType = other.valueType;
+        bits = other.bits;
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            release();
+            valueType = other.valueType;
+            bits = other.bits;
+            other.valueType = ValueType::NONE;
+        }
+        return *this;
+    }
+
+    ~Value() { release(); }
+
+    ValueType type() const { return valueType; }
+    bool isInt() const { return valueType == ValueType::INT; }
+    bool isStr() const { return valueType == ValueType::STR; }
+    bool isNone() const { return valueType == ValueType::NONE; }
+
+    // reading the wrong half gives 0 / "" rather than failing. asStr() joins
+    // a pending concatenation
+    int asInt() const { return valueType == ValueType::INT ? intValue : 0; }
+    const std::string& asStr() const;
+
+    // for values type inference has proven to be ints (see types.hpp): no
+    // tag check, and overwriting one in place has nothing to release
+    int knownInt() const { return intValue; }
+    void setKnownInt(int i) { intValue = i; }
+
+    std::string str() const;
+
+    // where the tag and the int sit inside a Value, for native code that
+    // reads and writes int values in place (jit.cpp)
+    static size_t typeOffset();
+    static size_t intOffset();
+
+private:
+    void release() {
+        if (valueType == ValueType::STR && --strValue->refCount == 0) { StringObject::destroy(strValue); }
+    }
+
+    ValueType valueType;
+    union {
+        int intValue;
+        StringObject* strValue;
+        uint64_t bits;
+    };
+};
+
+static_assert(sizeof(Value) <= 16, "Value should stay two words");
+
+std::string valueTypeToStr(ValueType valueType);
+
+#endif /* value_hpp */
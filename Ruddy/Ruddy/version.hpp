@@ -0,0 +1,8 @@
+#ifndef version_hpp
+#define version_hpp
+
+// bump whenever the AST layout, bytecode or language semantics change, so
+// stale .rdc caches get rebuilt instead of reused
+#define RUDDY_VERSION "0.8.0"
+
+#endif /* version_hpp */
@@ -0,0 +1,522 @@
+#include "vm.hpp"
+
+#include <algorithm>
+
+// every dispatch of execute<true> first tells the profiler when a line starts
+#define VM_PROFILE_LINE()                                             \
+    if (PROFILE && !function->lines.empty()) {                        \
+        uint32_t line = function->lines[ip - function->code.data()];  \
+        if (line != 0) { profiler->line(line); }                      \
+    }
+
+#if RUDDY_COMPUTED_GOTO
+#define VM_CASE(op)   L_##op:
+#define VM_DISPATCH() do { VM_PROFILE_LINE() goto *dispatchTable[static_cast<int>(ip->op)]; } while (0)
+#else
+#define VM_CASE(op)   case OpCode::op:
+#define VM_DISPATCH() continue
+#endif
+
+bool VM::run(const Program& program, const std::string& entry, const std::vector<Value>& args) {
+    std::map<std::string, int, std::less<>>::const_iterator entryIt = program.functionIndex.find(entry);
+    if (entryIt == program.functionIndex.end()) { return false; }
+
+    // string constants are copied rather than shared with the Program, other
+    // interpreters may be bumping its refcounts on other threads
+    if (this->program != &program) {
+        ownStrings.clear();
+        for (const Value& string : program.strings) { ownStrings.push_back(string.unshared()); }
+    }
+    this->program = &program;
+    stack.clear();
+    stack.reserve(256);
+    frames.clear();
+    memoArgs.clear();
+    memo.clear();
+    variables.resize(program.slotNames.size());
+    globals = variables.data();
+    strings = ownStrings.data();
+
+    // native code reads and writes globals without locks, and reports
+    // nothing to the profiler. it's compiled once per program, not per run
+    if (!jitEnabled || profiler != nullptr || program.usesTasks) {
+        jit.clear();
+        jitProgram = nullptr;
+        jitCompiled = 0;
+    } else if (jitProgram != &program) {
+        jitCompiled = jit.compile(program);
+        jitProgram = &program;
+    }
+    if (program.usesTasks) {
+        startTasks();
+    }
+    jitContext.variables = variables.data();
+    jitContext.vm = this;
+    jitContext.jit = &jit;
+    jitContext.depth = 0;
+
+    // native functions take no parameters and return nothing
+    Jit::NativeFunction native = jit.function(entryIt->second);
+    result = Value();
+    if (native != nullptr) {
+        native(&jitContext);
+    } else {
+        const Function* function = &program.functions[entryIt->second];
+        stack.resize(function->paramCount);
+        for (int argIdx = 0; argIdx < function->paramCount && argIdx < (int) args.size(); argIdx++) {
+            stack[argIdx] = args[argIdx];
+        }
+        if (profiler != nullptr) { profiler->enter(entryIt->second); }
+        execute(function, function->code.data(), 0);
+        result = std::move(stack[0]);
+        stack.clear();
+    }
+    if (tasks != nullptr) {
+        stopTasks();
+    }
+    return true;
+}
+
+void VM::forgetProgram() {
+    program = nullptr;
+    ownStrings.clear();
+    jit.clear();
+    jitProgram = nullptr;
+    jitCompiled = 0;
+}
+
+void VM::startTasks() {
+    // with a single thread tasks only ever run inside this one's join, so
+    // nothing is shared and globals need no locks
+    int threadCount = profiler != nullptr ? 1 : std::max(threads, 1);
+    if (threadCount > 1) {
+        globalLocks.reset(new GlobalLocks());
+        locks = globalLocks.get();
+    }
+
+    workers.clear();
+    for (int workerIdx = 0; workerIdx < threadCount - 1; workerIdx++) {
+        std::unique_ptr<VM> vm(new VM());
+        vm->program = program;
+        vm->globals = globals;
+        vm->out = out;
+        vm->locks = locks;
+        for (const Value& string : program->strings) {
+            vm->ownStrings.push_back(string.unshared());
+        }
+        vm->strings = vm->ownStrings.data();
+        vm->memo.resize(memo.capacity());
+        vm->worker = workerIdx;
+        vm->stack.reserve(256);
+        workers.push_back(std::move(vm));
+    }
+
+    // this thread is the last worker
+    worker = threadCount - 1;
+    group = &rootGroup;
+    pool.reset(new TaskPool(threadCount, [this](int workerIdx, Task& task) {
+        (workerIdx == worker ? this : workers[workerIdx].get())->runTask(task);
+    }));
+    tasks = pool.get();
+    for (std::unique_ptr<VM>& vm : workers) { vm->tasks = tasks; }
+    // a sink the host already shares is left as it is
+    if (threadCount > 1 && !out->isShared()) {
+        out->setShared(true);
+        sharedOut = true;
+    }
+}
+
+void VM::stopTasks() {
+    // the program isn't over until every task is
+    tasks->wait(rootGroup, worker);
+    pool.reset();
+    workers.clear();
+    globalLocks.reset();
+    tasks = nullptr;
+    locks = nullptr;
+    group = nullptr;
+    if (sharedOut) {
+        out->setShared(false);
+        sharedOut = false;
+    }
+}
+
+void VM::runTask(Task& task) {
+    TaskGroup children;
+    TaskGroup* parentGroup = group;
+    group = &children;
+
+    const Function* function = &program->functions[task.function];
+    size_t base = stack.size();
+    for (Value& arg : task.args) { stack.push_back(std::move(arg)); }
+    if (profiler != nullptr) { profiler->enter(task.function); }
+    execute(function, function->code.data(), base);
+    stack.resize(base);
+
+    // a task isn't finished until everything it spawned is
+    tasks->wait(children, worker);
+    group = parentGroup;
+    task.group->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void VM::spawn(int functionIdx) {
+    int paramCount = program->functions[functionIdx].paramCount;
+    Task task;
+    task.function = functionIdx;
+    task.group = group;
+    for (size_t argIdx = stack.size() - paramCount; argIdx < stack.size(); argIdx++) {
+        task.args.push_back(stack[argIdx].unshared());
+    }
+    stack.resize(stack.size() - paramCount);
+    tasks->submit(worker, std::move(task));
+}
+
+bool VM::loadShared(int slot) {
+    std::lock_guard<std::mutex> guard(locks->forSlot(slot));
+    if (globals[slot].isNone()) { return false; }
+    stack.push_back(globals[slot].unshared());
+    return true;
+}
+
+void VM::storeShared(int slot, const Value& value) {
+    Value copy = value.isNone() ? Value::fromStr("") : value.unshared();
+    std::lock_guard<std::mutex> guard(locks->forSlot(slot));
+    globals[slot] = std::move(copy);
+}
+
+// native code only calls functions without parameters or return values, so
+// both of these throw away the NONE the function leaves behind
+void VM::interpret(int functionIdx) {
+    const Function* function = &program->functions[functionIdx];
+    execute(function, function->code.data(), stack.size());
+    stack.pop_back();
+}
+
+void VM::resume(int functionIdx, int ip, const Value* stackValues, int count) {
+    size_t base = stack.size();
+    stack.insert(stack.end(), stackValues, stackValues + count);
+    const Function* function = &program->functions[functionIdx];
+    execute(function, function->code.data() + ip, base);
+    stack.pop_back();
+}
+
+template <bool PROFILE>
+void VM::execute(const Function* function, const Instruction* ip, size_t base) {
+    const Program& program = *this->program;
+    size_t baseFrames = frames.size();
+
+    // a native callee in tail position returns through this, see TAIL_CALL
+    static const Instruction returnInstruction(OpCode::RETURN);
+
+#if RUDDY_COMPUTED_GOTO
+    // has to line up with the order of OpCode
+    static void* dispatchTable[] = {
+        &&L_PUSH_INT, &&L_PUSH_STR, &&L_PUSH_NONE, &&L_POP, &&L_LOAD_SLOT, &&L_STORE_SLOT,
+        &&L_LOAD_LOCAL, &&L_STORE_LOCAL, &&L_CALL, &&L_TAIL_CALL,
+        &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV,
+        &&L_IS_LESS, &&L_IS_LEQ, &&L_IS_GREATER, &&L_IS_GEQ, &&L_IS_EQ,
+        &&L_INT_ADD, &&L_INT_SUB, &&L_INT_MUL, &&L_INT_DIV,
+        &&L_INT_LT, &&L_INT_LEQ, &&L_INT_GT, &&L_INT_GEQ, &&L_INT_EQ, &&L_STR_CONCAT,
+        &&L_PRINT, &&L_JUMP, &&L_JUMP_IF_FALSE, &&L_FOR_ENTER, &&L_FOR_SET, &&L_FOR_SET_LOCAL, &&L_FOR_NEXT,
+        &&L_SPAWN, &&L_JOIN, &&L_RETURN,
+    };
+#endif
+
+#define BINARY_INT_OP(op, expr)                                       \
+    VM_CASE(op) {                                                     \
+        int right = stack.back().asInt();                             \
+        stack.pop_back();                                             \
+        Value& left = stack.back();                                   \
+        left = Value::fromInt(expr);                                  \
+        ip++;                                                         \
+        VM_DISPATCH();                                                \
+    }
+
+// both operands are ints (see types.hpp), so the left one is overwritten in place
+#define KNOWN_INT_OP(op, expr)                                        \
+    VM_CASE(op) {                                                     \
+        int right = stack.back().knownInt();                          \
+        stack.pop_back();                                             \
+        Value& left = stack.back();                                   \
+        left.setKnownInt(expr);                                       \
+        ip++;                                                         \
+        VM_DISPATCH();                                                \
+    }
+
+#if RUDDY_COMPUTED_GOTO
+    VM_DISPATCH();
+#else
+    for (;;) {
+        VM_PROFILE_LINE()
+        switch (ip->op) {
+#endif
+            VM_CASE(PUSH_INT) {
+                stack.push_back(Value::fromInt(ip->operand));
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(PUSH_STR) {
+                stack.push_back(strings[ip->operand]);
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(PUSH_NONE) {
+                stack.push_back(Value());
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(POP) {
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(LOAD_SLOT) {
+                if (locks != nullptr) {
+                    if (loadShared(ip->operand)) {
+                        ip++;
+                        VM_DISPATCH();
+                    }
+                } else if (!globals[ip->operand].isNone()) {
+                    stack.push_back(globals[ip->operand]);
+                    ip++;
+                    VM_DISPATCH();
+                }
+
+                // not assigned yet, same fallback as the tree-walker: function, then bare word
+                int functionIdx = program.slotFunctions[ip->operand];
+                if (functionIdx >= 0 && jit.function(functionIdx) != nullptr && jitContext.depth < JIT_MAX_DEPTH) {
+                    jit.function(functionIdx)(&jitContext);
+                    stack.push_back(Value());
+                    ip++;
+                    VM_DISPATCH();
+                }
+                if (functionIdx >= 0) {
+                    if (PROFILE) { profiler->enter(functionIdx); }
+                    frames.push_back({function, ip + 1, base, nullptr});
+                    function = &program.functions[functionIdx];
+                    stack.resize(stack.size() + function->paramCount);
+                    base = stack.size() - function->paramCount;
+                    ip = function->code.data();
+                    VM_DISPATCH();
+                }
+
+                stack.push_back(Value::fromStr(program.slotNames[ip->operand]));
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(STORE_SLOT) {
+                if (locks != nullptr) {
+                    storeShared(ip->operand, stack.back());
+                    stack.pop_back();
+                    ip++;
+                    VM_DISPATCH();
+                }
+                Value& variable = globals[ip->operand];
+                variable = std::move(stack.back());
+                if (variable.isNone()) {
+                    variable = Value::fromStr("");
+                }
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(LOAD_LOCAL) {
+                stack.push_back(stack[base + ip->operand]);
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(STORE_LOCAL) {
+                Value& local = stack[base + ip->operand];
+                local = std::move(stack.back());
+                if (local.isNone()) {
+                    local = Value::fromStr("");
+                }
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(CALL) {
+                if (jit.function(ip->operand) != nullptr && jitContext.depth < JIT_MAX_DEPTH) {
+                    jit.function(ip->operand)(&jitContext);
+                    stack.push_back(Value());
+                    ip++;
+                    VM_DISPATCH();
+                }
+                // the arguments on top of the stack become the callee's locals
+                const Function* callee = &program.functions[ip->operand];
+                const Function* memoized = nullptr;
+                if (callee->pure && memo.enabled()) {
+                    const Value* args = stack.data() + stack.size() - callee->paramCount;
+                    const Value* result = memo.find(callee, args, callee->paramCount);
+                    if (result != nullptr) {
+                        stack.resize(stack.size() - callee->paramCount);
+                        stack.push_back(*result);
+                        ip++;
+                        VM_DISPATCH();
+                    }
+                    // the callee is free to assign its parameters, so the key is kept apart
+                    memoArgs.insert(memoArgs.end(), args, args + callee->paramCount);
+                    memoized = callee;
+                }
+                if (PROFILE) { profiler->enter(ip->operand); }
+                frames.push_back({function, ip + 1, base, memoized});
+                function = callee;
+                base = stack.size() - function->paramCount;
+                ip = function->code.data();
+                VM_DISPATCH();
+            }
+            VM_CASE(TAIL_CALL) {
+                if (jit.function(ip->operand) != nullptr && jitContext.depth < JIT_MAX_DEPTH) {
+                    jit.function(ip->operand)(&jitContext);
+                    stack.push_back(Value());
+                    ip = &returnInstruction;
+                    VM_DISPATCH();
+                }
+                // the arguments replace this frame's locals and nothing goes on
+                // frames, so tail recursion runs in constant space
+                if (PROFILE) { profiler->tailCall(ip->operand); }
+                function = &program.functions[ip->operand];
+                std::move(stack.end() - function->paramCount, stack.end(), stack.begin() + base);
+                stack.resize(base + function->paramCount);
+                ip = function->code.data();
+                VM_DISPATCH();
+            }
+            VM_CASE(ADD) {
+                // no locals with destructors in here, computed goto jumps out without running them
+                Value& left = stack[stack.size() - 2];
+                if (left.isInt()) {
+                    left = Value::fromInt(left.asInt() + stack.back().asInt());
+                } else {
+                    left = Value::concat(left, stack.back());
+                }
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            BINARY_INT_OP(SUB,        left.asInt() -  right)
+            BINARY_INT_OP(MUL,        left.asInt() *  right)
+            BINARY_INT_OP(DIV,        left.asInt() /  right)
+            BINARY_INT_OP(IS_LESS,    left.asInt() <  right)
+            BINARY_INT_OP(IS_LEQ,     left.asInt() <= right)
+            BINARY_INT_OP(IS_GREATER, left.asInt() >  right)
+            BINARY_INT_OP(IS_GEQ,     left.asInt() >= right)
+            BINARY_INT_OP(IS_EQ,      left.asInt() == right)
+            KNOWN_INT_OP(INT_ADD, left.knownInt() +  right)
+            KNOWN_INT_OP(INT_SUB, left.knownInt() -  right)
+            KNOWN_INT_OP(INT_MUL, left.knownInt() *  right)
+            KNOWN_INT_OP(INT_DIV, left.knownInt() /  right)
+            KNOWN_INT_OP(INT_LT,  left.knownInt() <  right)
+            KNOWN_INT_OP(INT_LEQ, left.knownInt() <= right)
+            KNOWN_INT_OP(INT_GT,  left.knownInt() >  right)
+            KNOWN_INT_OP(INT_GEQ, left.knownInt() >= right)
+            KNOWN_INT_OP(INT_EQ,  left.knownInt() == right)
+            VM_CASE(STR_CONCAT) {
+                Value& left = stack[stack.size() - 2];
+                left = Value::concat(left, stack.back());
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINT) {
+                const Value& printValue = stack.back();
+                if (printValue.isInt()) {
+                    out->writeLine(printValue.asInt());
+                } else {
+                    out->writeLine(printValue.asStr());
+                }
+                stack.pop_back();
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(JUMP) {
+                ip = function->code.data() + ip->operand;
+                VM_DISPATCH();
+            }
+            VM_CASE(JUMP_IF_FALSE) {
+                bool condition = stack.back().asInt() != 0;
+                stack.pop_back();
+                ip = condition ? ip + 1 : function->code.data() + ip->operand;
+                VM_DISPATCH();
+            }
+            VM_CASE(FOR_ENTER) {
+                Value& counter = stack[stack.size() - 2];
+                Value& limit = stack.back();
+                if (!counter.isInt()) { counter = Value::fromInt(counter.asInt()); }
+                if (!limit.isInt()) { limit = Value::fromInt(limit.asInt()); }
+                if (counter.asInt() > limit.asInt()) {
+                    stack.resize(stack.size() - 2);
+                    ip = function->code.data() + ip->operand;
+                } else {
+                    ip++;
+                }
+                VM_DISPATCH();
+            }
+            VM_CASE(FOR_SET) {
+                if (locks != nullptr) {
+                    storeShared(ip->operand, stack[stack.size() - 2]);
+                } else {
+                    globals[ip->operand] = stack[stack.size() - 2];
+                }
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(FOR_SET_LOCAL) {
+                stack[base + ip->operand] = stack[stack.size() - 2];
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(FOR_NEXT) {
+                // stops on reaching the limit rather than passing it, so a limit of INT_MAX can't wrap
+                Value& counter = stack[stack.size() - 2];
+                if (counter.asInt() == stack.back().asInt()) {
+                    stack.resize(stack.size() - 2);
+                    ip++;
+                } else {
+                    counter = Value::fromInt(counter.asInt() + 1);
+                    ip = function->code.data() + ip->operand;
+                }
+                VM_DISPATCH();
+            }
+            VM_CASE(SPAWN) {
+                spawn(ip->operand);
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(JOIN) {
+                tasks->wait(*group, worker);
+                ip++;
+                VM_DISPATCH();
+            }
+            VM_CASE(RETURN) {
+                if (PROFILE) { profiler->leave(); }
+                // the result takes the place of the frame's locals and
+                // whatever loops it returned out of left on the stack
+                stack[base] = std::move(stack.back());
+                stack.resize(base + 1);
+                if (frames.size() == baseFrames) { return; }
+
+                // a tail call may have replaced the function that was called,
+                // the result still belongs to the original call
+                const Function* memoized = frames.back().memoized;
+                if (memoized != nullptr) {
+                    size_t keyStart = memoArgs.size() - memoized->paramCount;
+                    memo.insert(memoized, memoArgs.data() + keyStart, memoized->paramCount, stack.back());
+                    memoArgs.resize(keyStart);
+                }
+                function = frames.back().function;
+                ip = frames.back().returnIp;
+                base = frames.back().base;
+                frames.pop_back();
+                VM_DISPATCH();
+            }
+#if !RUDDY_COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef BINARY_INT_OP
+#undef KNOWN_INT_OP
+}
+
+template void VM::execute<false>(const Function* function, const Instruction* ip, size_t base);
+template void VM::execute<true>(const Function* function, const Instruction* ip, size_t base);
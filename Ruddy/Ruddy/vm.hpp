@@ -0,0 +1,142 @@
+#ifndef vm_hpp
+#define vm_hpp
+
+#include <stdio.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "jit.hpp"
+#include "memo.hpp"
+#include "output.hpp"
+#include "profiler.hpp"
+#include "tasks.hpp"
+#include "value.hpp"
+
+// computed goto is a GNU extension, plain switch dispatch everywhere else
+#if defined(__GNUC__) || defined(__clang__)
+#define RUDDY_COMPUTED_GOTO 1
+#else
+#define RUDDY_COMPUTED_GOTO 0
+#endif
+
+// a program that spawns shares its globals between threads: every access
+// takes the lock of the slot's shard, and values cross in and out as
+// unshared copies
+struct GlobalLocks {
+    static const int SHARDS = 64;
+    std::mutex shards[SHARDS];
+
+    std::mutex& forSlot(int slot) { return shards[slot % SHARDS]; }
+};
+
+// --- Bytecode VM
+// everything a run changes lives in the VM, the Program is only read, so
+// any number of VMs can run the same Program on different threads without
+// locking each other out. a program that spawns gets one VM per worker
+// thread on top of this one. they share the program and the globals, each
+// has its own stack, frames and memo cache
+class VM {
+public:
+    VM() : jitEnabled(false), jitCompiled(0), threads(1), profiler(nullptr), out(&output), sharedOut(false), program(nullptr), jitProgram(nullptr), globals(nullptr), strings(nullptr), locks(nullptr), tasks(nullptr), worker(0), group(nullptr) {}
+
+    // runs the named function of a compiled program with args for its first
+    // parameters (the rest start out NONE), returns false if it doesn't
+    // exist. variables keep whatever earlier runs left in them
+    bool run(const Program& program, const std::string& entry, const std::vector<Value>& args = std::vector<Value>());
+
+    // drops what run() keeps from one run of a program to the next (its
+    // string constants, native code). for when the next program might sit
+    // where a freed one used to, run() only notices a new program by address
+    void forgetProgram();
+
+    // indexed by slot, NONE until a slot is first assigned
+    std::vector<Value> variables;
+
+    // what the last run's entry function returned
+    Value result;
+
+    // compile integer-only functions to native code before running, see jit.hpp
+    bool jitEnabled;
+    int jitCompiled;
+
+    // results of calls to pure functions. empty (off) until someone resizes it
+    MemoCache memo;
+
+    // threads that run spawned tasks, this one included. programs that
+    // spawn are never handed to the JIT
+    int threads;
+
+    // when set, every call, return and line start is reported to it. the
+    // program then runs without the JIT and with one thread
+    Profiler* profiler;
+
+    // where print goes, stdout unless set
+    OutputSink* out;
+
+    // entry points for native code handing control back: interpret a whole
+    // function, or finish one from ip with the given operand stack
+    void interpret(int functionIdx);
+    void resume(int functionIdx, int ip, const Value* stackValues, int count);
+
+private:
+    // the caller's state, restored on return
+    struct Frame {
+        const Function* function;
+        const Instruction* returnIp;
+        size_t base;
+        const Function* memoized; // the callee whose result goes in memo on return, its key is on top of memoArgs
+    };
+
+    // runs until the function it was started in returns, leaving its result
+    // at stack[base]. the function's locals start at base. execute<true> is
+    // the same loop with the profiler's hooks compiled in, so plain runs
+    // don't pay for them
+    template <bool PROFILE>
+    void execute(const Function* function, const Instruction* ip, size_t base);
+    void execute(const Function* function, const Instruction* ip, size_t base) {
+        profiler != nullptr ? execute<true>(function, ip, base) : execute<false>(function, ip, base);
+    }
+    int indexOf(const Function* function) const { return (int) (function - program->functions.data()); }
+
+    // tasks, see tasks.hpp
+    void startTasks();
+    void stopTasks();
+    void runTask(Task& task);
+    void spawn(int functionIdx);
+
+    // globals when they're shared. loadShared is false for an unassigned slot
+    bool loadShared(int slot);
+    void storeShared(int slot, const Value& value);
+
+    bool sharedOut; // out was made shared for this run's tasks
+
+    const Program* program;
+    const Program* jitProgram; // what jit was last compiled from
+    Value* globals;       // variables, or the main VM's for a worker
+    const Value* strings; // ownStrings
+    std::vector<Value> ownStrings; // unshared copies of Program::strings
+    std::vector<Value> stack;
+    std::vector<Frame> frames;
+    std::vector<Value> memoArgs;
+
+    Jit jit;
+    JitContext jitContext;
+
+    // all nullptr / empty unless the program spawns. a worker only has
+    // locks, tasks, worker and group set
+    std::unique_ptr<GlobalLocks> globalLocks;
+    std::unique_ptr<TaskPool> pool;
+    std::vector<std::unique_ptr<VM>> workers;
+    GlobalLocks* locks;
+    TaskPool* tasks;
+    int worker;        // this VM's deque in tasks
+    TaskGroup* group;  // what `join` waits for: the running task's children, or main's
+    TaskGroup rootGroup;
+};
+
+#endif /* vm_hpp */
@@ -0,0 +1,41 @@
+#!/bin/sh
+# lexes and parses a generated script of many small functions with 1, 2, 4
+# and 8 front-end threads and reports the time per MB
+# usage: bench/frontend_bench.sh path/to/Ruddy [megabytes] [runs]
+set -e
+ruddy=${1:?usage: frontend_bench.sh path/to/Ruddy [megabytes] [runs]}
+megabytes=${2:-8}
+runs=${3:-5}
+
+script=$(mktemp "${TMPDIR:-/tmp}/frontend_bench.XXXXXX")
+trap 'rm -f "$script"' EXIT
+
+# about 300 bytes a function
+awk -v count=$((megabytes * 1024 * 1024 / 300)) 'BEGIN {
+    for (f = 0; f < count; f++) {
+        printf "fn f%d(a, b)\n", f
+        printf "    x%d = a * %d + b / 3 - (a - %d)\n", f % 100, f, f % 7
+        printf "    if x%d > %d\n", f % 100, f
+        printf "        print(\"f%d big\" + x%d)\n", f, f % 100
+        printf "    else\n"
+        printf "        for i = 1 to b\n"
+        printf "            x%d = x%d + i * 2\n", f % 100, f % 100
+        printf "        endfor\n"
+        printf "    endif\n"
+        printf "    return x%d + a\n", f % 100
+        printf "endfn\n\n"
+    }
+    printf "fn main\n    print(f1(2, 3))\nendfn\n"
+}' > "$script"
+size=$(wc -c < "$script")
+
+printf 'front end on %s bytes\n' "$size"
+for threads in 1 2 4 8; do
+    best=
+    for run in $(seq "$runs"); do
+        ms=$("$ruddy" --input_path="$script" --nocache --nooptimize --timing --parse_threads=$threads 2>&1 >/dev/null |
+            awk '/^lex:/ { lex = $2 } /^parse:/ { parse = $2 } END { print lex + parse }')
+        best=$(printf '%s\n%s\n' "$best" "$ms" | sed '/^$/d' | sort -n | head -1)
+    done
+    printf '%2s threads %10s ms %8s ms/MB (best of %s)\n' "$threads" "$best" "$(awk "BEGIN { printf \"%.2f\", $best / ($size / 1048576) }")" "$runs"
+done
@@ -0,0 +1,164 @@
+// stress test and throughput benchmark for running many interpreters at
+// once. for 1, 2, 4 ... threads, every thread runs a script over and over
+// on an Interpreter of its own, first all on one shared Program, then each
+// on a Program it compiled itself. every run starts from reset variables
+// and prints into the thread's own sink, and has to print exactly what a
+// run on its own did. one JSON object per thread count and mode
+//
+// build it against the library (or the sources minus main.cpp), with
+// -fsanitize=thread to have races reported as well:
+//   c++ -std=gnu++17 -O2 -IRuddy/Ruddy bench/instances.cpp path/to/libruddy.a -o instances -pthread
+// usage: instances [script.rd] [max threads] [runs per thread]
+//   without a script a built-in one exercises strings, calls, memoized
+//   functions, loops and spawn/join
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lexer.hpp"
+#include "ruddy.hpp"
+
+namespace {
+
+const char* builtInScript = R"(fn fib(n)
+    if n < 2
+        return n
+    endif
+    return fib(n - 1) + fib(n - 2)
+endfn
+
+fn label(i)
+    return "item " + i + ": "
+endfn
+
+fn work(from, to)
+    sum = 0
+    for i = from to to
+        sum = sum + i * i
+    endfor
+    print("work " + from + " " + sum)
+endfn
+
+fn main
+    total = 0
+    text = ""
+    for i = 1 to 200
+        total = total + fib(i / 10)
+        text = text + label(i)
+    endfor
+    spawn work(1, 1000)
+    spawn work(1001, 2000)
+    join
+    print(total)
+    print(text)
+endfn
+)";
+
+struct Result {
+    uint64_t runs = 0;
+    uint64_t mismatches = 0;
+};
+
+// runs the program `runs` times on a fresh Interpreter, comparing every
+// run's output with expected
+void runMany(const ruddy::Program& program, const std::string& expected, int runs, Result& result) {
+    std::string printed;
+    OutputSink sink([&printed](std::string_view text) { printed += text; });
+    ruddy::Interpreter interpreter(program, sink);
+    interpreter.setThreads(1);
+    interpreter.setMemoSize(4096);
+    for (int run = 0; run < runs; run++) {
+        printed.clear();
+        interpreter.reset();
+        interpreter.run("main");
+        sink.flush();
+        result.runs++;
+        if (printed != expected) { result.mismatches++; }
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string source = builtInScript;
+    std::string scriptName = "built-in";
+    if (argc > 1) {
+        SourceFile file;
+        if (!file.open(argv[1])) {
+            std::cerr << "could not open " << argv[1] << std::endl;
+            return 1;
+        }
+        source = std::string(file.text());
+        scriptName = argv[1];
+    }
+    int maxThreads = argc > 2 ? std::atoi(argv[2]) : (int) std::max(std::thread::hardware_concurrency(), 1u);
+    int runs = argc > 3 ? std::atoi(argv[3]) : 200;
+
+    ruddy::Program shared;
+    if (!shared.compile(source)) {
+        for (const Diagnostic& diagnostic : shared.diagnostics()) {
+            std::cerr << scriptName << ":" << diagnostic.str() << std::endl;
+        }
+        return 1;
+    }
+    if (!shared.has("main")) {
+        std::cerr << scriptName << " has no main" << std::endl;
+        return 1;
+    }
+    std::string expected;
+    {
+        OutputSink sink([&expected](std::string_view text) { expected += text; });
+        ruddy::Interpreter interpreter(shared, sink);
+        interpreter.setThreads(1);
+        interpreter.run("main");
+    }
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) { threadCounts.push_back(threads); }
+    threadCounts.push_back(std::max(maxThreads, 1));
+
+    uint64_t mismatches = 0;
+    for (bool ownPrograms : {false, true}) {
+        double base = 0;
+        for (int threads : threadCounts) {
+            std::vector<Result> results(threads);
+            std::vector<std::thread> workers;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int threadIdx = 0; threadIdx < threads; threadIdx++) {
+                workers.emplace_back([&, threadIdx]() {
+                    if (!ownPrograms) {
+                        runMany(shared, expected, runs, results[threadIdx]);
+                        return;
+                    }
+                    ruddy::Program program;
+                    if (!program.compile(source)) {
+                        results[threadIdx].mismatches++;
+                        return;
+                    }
+                    runMany(program, expected, runs, results[threadIdx]);
+                });
+            }
+            for (std::thread& worker : workers) { worker.join(); }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            Result total;
+            for (const Result& result : results) {
+                total.runs += result.runs;
+                total.mismatches += result.mismatches;
+            }
+            mismatches += total.mismatches;
+            double runsPerS = ms > 0 ? total.runs / (ms / 1000) : 0;
+            if (base == 0) { base = runsPerS; }
+            char line[512];
+            snprintf(line, sizeof(line), "{\"script\": \"%s\", \"program\": \"%s\", \"threads\": %d, \"runs\": %llu, \"ms\": %.3f, \"runs_per_s\": %.1f, \"speedup\": %.2f, \"mismatches\": %llu}",
+                     scriptName.c_str(), ownPrograms ? "own" : "shared", threads, (unsigned long long) total.runs, ms, runsPerS,
+                     base > 0 ? runsPerS / base : 0, (unsigned long long) total.mismatches);
+            std::cout << line << std::endl;
+        }
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# compares the tree-walker, the VM and the VM with --jit on a compute-bound script
+# usage: bench/jit_bench.sh path/to/Ruddy [script.rd] [runs]
+set -e
+ruddy=${1:?usage: jit_bench.sh path/to/Ruddy [script.rd] [runs]}
+script=${2:-$(dirname "$0")/jit_compute.rd}
+runs=${3:-5}
+
+for mode in --tree_walk --nojit --jit; do
+    best=
+    for run in $(seq "$runs"); do
+        ms=$("$ruddy" --input_path="$script" --nocache --timing $mode 2>&1 >/dev/null | sed -n 's/^evaluate: *\([0-9.]*\) ms.*/\1/p')
+        best=$(printf '%s\n%s\n' "$best" "$ms" | sed '/^$/d' | sort -n | head -1)
+    done
+    printf '%-12s %10s ms (best of %s)\n' "$mode" "$best" "$runs"
+done
@@ -0,0 +1,18 @@
+#!/bin/sh
+# runs a spawning script on the VM with 1, 2, 4 and 8 threads
+# usage: bench/parallel_bench.sh path/to/Ruddy [script.rd] [runs]
+set -e
+ruddy=${1:?usage: parallel_bench.sh path/to/Ruddy [script.rd] [runs]}
+script=${2:-$(dirname "$0")/parallel_sum.rd}
+runs=${3:-5}
+
+base=
+for threads in 1 2 4 8; do
+    best=
+    for run in $(seq "$runs"); do
+        ms=$("$ruddy" --input_path="$script" --nocache --timing --threads=$threads 2>&1 >/dev/null | sed -n 's/^evaluate: *\([0-9.]*\) ms.*/\1/p')
+        best=$(printf '%s\n%s\n' "$best" "$ms" | sed '/^$/d' | sort -n | head -1)
+    done
+    base=${base:-$best}
+    printf '%2s threads %10s ms (best of %s)  x%s\n' "$threads" "$best" "$runs" "$(awk "BEGIN { printf \"%.2f\", $base / $best }")"
+done
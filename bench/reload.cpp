@@ -0,0 +1,141 @@
+// reload latency against the size of the edit. a script of many small
+// functions (generated, or one given) is compiled reloadable, then edited
+// in 1, 10, 100 ... of its functions, and each edit is both compiled from
+// scratch and reloaded from the compiled original. a reload has to come out
+// with the same tree as the compile from scratch and print the same when
+// main runs. one JSON object per edit size
+//
+// build it against the library (or the sources minus main.cpp):
+//   c++ -std=gnu++17 -O2 -IRuddy/Ruddy bench/reload.cpp path/to/libruddy.a -o reload -pthread
+// usage: reload [script.rd | function count] [repetitions]
+//   a script has its numbers edited: the first number in each edited
+//   function's body goes up by one in its first digit
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "frontend.hpp"
+#include "lexer.hpp"
+#include "ruddy.hpp"
+
+namespace {
+
+std::string generate(int functions) {
+    std::string source;
+    for (int functionIdx = 0; functionIdx < functions; functionIdx++) {
+        std::string n = std::to_string(functionIdx);
+        source += "fn f" + n + "(a, b)\n";
+        source += "    x" + n + " = a * " + n + " + b / 3 - (a - " + std::to_string(functionIdx % 7) + ")\n";
+        source += "    return x" + n + " + a\n";
+        source += "endfn\n\n";
+    }
+    source += "fn main\n    total = 0\n";
+    for (int functionIdx = 0; functionIdx < functions; functionIdx += std::max(functions / 100, 1)) {
+        source += "    total = total + f" + std::to_string(functionIdx) + "(" + std::to_string(functionIdx) + ", 7)\n";
+    }
+    source += "    print(total)\nendfn\n";
+    return source;
+}
+
+// source with `edits` of its functions changed, spread out evenly
+std::string edit(std::string_view source, int edits) {
+    std::vector<SourceRegion> regions = cutAtFunctions(source, 0);
+    int functions = (int) regions.size() - 1;
+    int step = std::max(functions / std::max(edits, 1), 1);
+    std::string edited(regions[0].text);
+    int made = 0;
+    for (int functionIdx = 0; functionIdx < functions; functionIdx++) {
+        std::string text(regions[functionIdx + 1].text);
+        if (made < edits && functionIdx % step == 0) {
+            // a number past the `fn` line, names stay as they are
+            size_t digit = text.find('\n');
+            do {
+                digit = text.find_first_of("0123456789", digit + 1);
+            } while (digit != std::string::npos && (std::isalnum((unsigned char) text[digit - 1]) || text[digit - 1] == '_'));
+            if (digit != std::string::npos) {
+                text[digit] = text[digit] == '9' ? '1' : text[digit] + 1;
+                made++;
+            }
+        }
+        edited += text;
+    }
+    return edited;
+}
+
+std::string runMain(const ruddy::Program& program) {
+    std::string printed;
+    OutputSink sink([&printed](std::string_view text) { printed += text; });
+    ruddy::Interpreter interpreter(program, sink);
+    interpreter.run("main");
+    sink.flush();
+    return printed;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string source;
+    std::string scriptName;
+    if (argc > 1 && std::atoi(argv[1]) <= 0) {
+        SourceFile file;
+        if (!file.open(argv[1])) {
+            std::cerr << "could not open " << argv[1] << std::endl;
+            return 1;
+        }
+        source = std::string(file.text());
+        scriptName = argv[1];
+    } else {
+        int functions = argc > 1 ? std::atoi(argv[1]) : 20000;
+        source = generate(functions);
+        scriptName = "generated-" + std::to_string(functions);
+    }
+    int repetitions = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 5;
+
+    ruddy::CompileOptions options;
+    options.reloadable = true;
+    int functions = (int) cutAtFunctions(source, 0).size() - 1;
+
+    uint64_t mismatches = 0;
+    for (int edits = 1; ; edits = std::min(edits * 10, functions)) {
+        std::string edited = edit(source, edits);
+        double compileMs = 1e30, reloadMs = 1e30;
+        int reparsed = 0;
+        uint64_t editMismatches = 0;
+        for (int repetition = 0; repetition < repetitions; repetition++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ruddy::Program scratch;
+            bool compiled = scratch.compile(edited, options);
+            compileMs = std::min(compileMs, elapsedMs(start));
+
+            ruddy::Program original;
+            original.compile(source, options);
+            start = std::chrono::steady_clock::now();
+            ruddy::Program reloaded;
+            bool reloadedOk = reloaded.reload(original, edited, options);
+            reloadMs = std::min(reloadMs, elapsedMs(start));
+            reparsed = reloaded.stats().reparsed;
+
+            if (compiled != reloadedOk || (compiled && (printFunctionTable(scratch.functions()) != printFunctionTable(reloaded.functions())
+                                                        || (scratch.has("main") && runMain(scratch) != runMain(reloaded))))) {
+                editMismatches++;
+            }
+        }
+        mismatches += editMismatches;
+
+        char line[512];
+        snprintf(line, sizeof(line), "{\"script\": \"%s\", \"functions\": %d, \"edited\": %d, \"reparsed\": %d, \"compile_ms\": %.3f, \"reload_ms\": %.3f, \"speedup\": %.1f, \"mismatches\": %llu}",
+                 scriptName.c_str(), functions, edits, reparsed, compileMs, reloadMs, reloadMs > 0 ? compileMs / reloadMs : 0, (unsigned long long) editMismatches);
+        std::cout << line << std::endl;
+        if (edits >= functions) { break; }
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+# generates scalable workloads and times lexing, parsing and evaluation of
+# each separately. prints one JSON object per workload (JSON Lines), so runs
+# can be appended to a file and tracked over time
+# usage: bench/suite.sh path/to/Ruddy [scale] [runs] [extra Ruddy flags...]
+#   scale multiplies the size of every workload (default 1)
+#   runs  is how many times each one is run, the fastest run counts (default 3)
+set -e
+ruddy=${1:?usage: suite.sh path/to/Ruddy [scale] [runs] [extra Ruddy flags...]}
+scale=${2:-1}
+runs=${3:-3}
+shift $(($# < 3 ? $# : 3))
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/ruddy_suite.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+
+# --- Workloads
+
+# long lines of arithmetic, 100 operators each
+awk -v lines=$((2000 * scale)) 'BEGIN {
+    print "fn main\n    x = 0"
+    for (l = 0; l < lines; l++) {
+        printf "    x = x"
+        for (t = 0; t < 25; t++) { printf " + %d * 3 - %d / 2 + 1", t, t * 2 }
+        printf "\n"
+    }
+    print "    print(x)\nendfn"
+}' > "$dir/long_arithmetic.rd"
+
+# ifs nested 50 deep, every condition true
+awk -v blocks=$((200 * scale)) 'BEGIN {
+    print "fn main\n    x = 0"
+    indent[0] = "    "
+    for (d = 1; d <= 50; d++) { indent[d] = indent[d - 1] "    " }
+    for (b = 0; b < blocks; b++) {
+        for (d = 0; d < 50; d++) { printf "%sif x >= %d\n", indent[d], -d - 1 }
+        printf "%sx = x + 1\n", indent[50]
+        for (d = 49; d >= 0; d--) { printf "%sendif\n", indent[d] }
+    }
+    print "    print(x)\nendfn"
+}' > "$dir/deep_if.rd"
+
+# lots of small functions, each called once from main
+awk -v count=$((5000 * scale)) 'BEGIN {
+    for (f = 0; f < count; f++) {
+        printf "fn f%d(a, b)\n    c = a * %d + b\n    if c > %d\n        c = c - %d\n    endif\n    return c\nendfn\n\n", f, f % 13, f, f % 7
+    }
+    print "fn main\n    total = 0"
+    for (f = 0; f < count; f++) { printf "    total = total + f%d(%d, 2)\n", f, f }
+    print "    print(total)\nendfn"
+}' > "$dir/many_functions.rd"
+
+# strings built up piece by piece, printed once at the end
+awk -v lines=$((1000 * scale)) 'BEGIN {
+    print "fn main\n    s = \"\"\n    for i = 1 to 20"
+    for (l = 0; l < lines; l++) { printf "        s = s + \"word%d \" + i + \", \" + (i * %d) + \" \"\n", l, l }
+    print "    endfor\n    print(s)\nendfn"
+}' > "$dir/string_concat.rd"
+
+# a print per line, ints and strings
+awk -v lines=$((2000 * scale)) 'BEGIN {
+    print "fn main\n    for i = 1 to 20"
+    for (l = 0; l < lines; l++) { printf "        print(i * %d)\n        print(\"line %d of the output \" + i)\n", l, l }
+    print "    endfor\nendfn"
+}' > "$dir/print_heavy.rd"
+
+# --- Runs
+
+commit=$(git -C "$(dirname "$0")" rev-parse --short HEAD 2>/dev/null || echo unknown)
+for workload in long_arithmetic deep_if many_functions string_concat print_heavy; do
+    script="$dir/$workload.rd"
+    for run in $(seq "$runs"); do
+        # one front-end thread, or lexing is folded into parse
+        "$ruddy" --input_path="$script" --nocache --timing --parse_threads=1 "$@" 2>&1 >/dev/null | awk '
+            /^size:/     { bytes = $2; lines = $4; nodes = $6 }
+            /^lex:/      { lex = $2 }
+            /^parse:/    { parse = $2 }
+            /^optimize:/ { optimize = $2 }
+            /^compile:/  { compile = $2 }
+            /^evaluate:/ { evaluate = $2 }
+            /^memory:/   { memory = $2 }
+            END { print bytes, lines, nodes, lex, parse, optimize, compile + 0, evaluate, memory }'
+    done | sort -n -k8 | head -1 | awk -v workload=$workload -v scale=$scale -v runs=$runs -v commit=$commit -v flags="$*" '{
+        frontEnd = ($4 + $5) / 1000
+        printf "{\"workload\": \"%s\", \"scale\": %s, \"runs\": %s, \"commit\": \"%s\", \"flags\": \"%s\", ", workload, scale, runs, commit, flags
+        printf "\"bytes\": %d, \"lines\": %d, \"nodes\": %d, ", $1, $2, $3
+        printf "\"lex_ms\": %.3f, \"parse_ms\": %.3f, \"optimize_ms\": %.3f, \"compile_ms\": %.3f, \"evaluate_ms\": %.3f, ", $4, $5, $6, $7, $8
+        printf "\"lines_per_s\": %.0f, \"nodes_per_s\": %.0f, \"peak_rss_kb\": %d}\n", (frontEnd > 0 ? $2 / frontEnd : 0), ($5 > 0 ? $3 / ($5 / 1000) : 0), $9
+    }'
+done
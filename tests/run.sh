@@ -0,0 +1,26 @@
+#!/bin/sh
+# runs every tests/*.rd on the VM and on the tree-walker. both have to print
+# the same (stdout and stderr) and exit the same way, and match name.out
+# where there is one. a run that takes more than 10 s counts as a hang
+# usage: tests/run.sh path/to/Ruddy
+ruddy=${1:?usage: run.sh path/to/Ruddy}
+case $ruddy in /*) ;; *) ruddy=$(pwd)/$ruddy ;; esac
+cd "$(dirname "$0")" || exit 1
+limit=
+command -v timeout >/dev/null && limit="timeout 10"
+
+failed=0
+for script in *.rd; do
+    name=${script%.rd}
+    vm=$($limit "$ruddy" --input_path="$script" --nocache --threads=1 2>&1; echo "exit $?")
+    tree=$($limit "$ruddy" --input_path="$script" --nocache --tree_walk 2>&1; echo "exit $?")
+    if [ "$vm" != "$tree" ]; then
+        printf 'FAIL %s: the VM and --tree_walk differ\n--- vm\n%s\n--- tree_walk\n%s\n' "$name" "$vm" "$tree"
+        failed=$((failed + 1))
+    elif [ -f "$name.out" ] && [ "$vm" != "$(cat "$name.out")" ]; then
+        printf 'FAIL %s: not what %s.out expects\n%s\n' "$name" "$name" "$vm"
+        failed=$((failed + 1))
+    fi
+done
+[ "$failed" -eq 0 ] && echo "all passed" || echo "$failed failed"
+[ "$failed" -eq 0 ]